@@ -0,0 +1,690 @@
+// Headless benchmark for the Chipmunk2D library.
+// Builds a set of canonical scenes and reports step timings for cpSpaceStep and cpHastySpaceStep.
+//
+// Usage: chipmunk_bench [options]
+//   --scene NAME       pyramid, ballpit, chains, tumble, terrain or all (default: all)
+//   --bodies N[,N...]  body counts to run each scene at (default: a per-scene count)
+//   --steps N          number of timed steps (default: 300)
+//   --warmup N         number of untimed steps before measuring (default: 60)
+//   --threads N        worker threads for cpHastySpaceStep, 0 for one per core (default: 0)
+//   --iterations N     solver iterations (default: 10)
+//   --stepper NAME     space, hasty or both (default: both)
+//   --spin             let cpHastySpaceStep threads spin before sleeping
+//   --solver NAME      cpHastySpaceStep solver, default, colored or islands (default: default)
+//   --simd             solve contacts with SIMD in the colored and island solvers
+//   --index NAME       spatial index, bbtree, flat, lbvh, grid, hash or adaptive (default: bbtree)
+//   --refit THRESHOLD  refit the dynamic bounding box tree, rebuilding it at THRESHOLD times its built cost (default: 0, off)
+//   --stats            print the average per-phase step statistics
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <chipmunk/chipmunk.h>
+#include <chipmunk/cpMarch.h>
+#include <chipmunk/cpHastySpace.h>
+
+#define BENCH_DT (1.0/60.0)
+#define BENCH_MAX_COUNTS 16
+
+//MARK: Timing
+
+static double
+NowMilliseconds(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {0};
+	if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return 1e3*(double)counter.QuadPart/(double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1e3*(double)ts.tv_sec + 1e-6*(double)ts.tv_nsec;
+#endif
+}
+
+//MARK: Deterministic Random Numbers
+
+// Scenes must be identical from run to run, so avoid rand().
+static uint32_t BenchSeed = 0x12345678;
+
+static cpFloat
+RandUnit(void)
+{
+	// xorshift32
+	uint32_t x = BenchSeed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	BenchSeed = x;
+
+	return (cpFloat)(x >> 8)/(cpFloat)(1 << 24);
+}
+
+static cpFloat
+RandRange(cpFloat min, cpFloat max)
+{
+	return min + (max - min)*RandUnit();
+}
+
+//MARK: Scenes
+
+static cpShape *
+AddStaticSegment(cpSpace *space, cpVect a, cpVect b, cpFloat radius)
+{
+	cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(cpSpaceGetStaticBody(space), a, b, radius));
+	cpShapeSetElasticity(shape, 0.0f);
+	cpShapeSetFriction(shape, 1.0f);
+
+	return shape;
+}
+
+static cpBody *
+AddBox(cpSpace *space, cpVect pos, cpFloat width, cpFloat height)
+{
+	cpFloat mass = 1.0f;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForBox(mass, width, height)));
+	cpBodySetPosition(body, pos);
+
+	cpShape *shape = cpSpaceAddShape(space, cpBoxShapeNew(body, width, height, 0.0f));
+	cpShapeSetElasticity(shape, 0.0f);
+	cpShapeSetFriction(shape, 0.8f);
+
+	return body;
+}
+
+static cpBody *
+AddBall(cpSpace *space, cpVect pos, cpFloat radius)
+{
+	cpFloat mass = 1.0f;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, radius, cpvzero)));
+	cpBodySetPosition(body, pos);
+
+	cpShape *shape = cpSpaceAddShape(space, cpCircleShapeNew(body, radius, cpvzero));
+	cpShapeSetElasticity(shape, 0.0f);
+	cpShapeSetFriction(shape, 0.7f);
+
+	return body;
+}
+
+static cpBody *
+AddRandomPolygon(cpSpace *space, cpVect pos, cpFloat radius)
+{
+	cpVect verts[8];
+	int count = 3 + (int)(RandUnit()*6.0f);
+	for(int i=0; i<count; i++){
+		cpFloat angle = 2.0f*CP_PI*((cpFloat)i + RandRange(0.0f, 0.5f))/(cpFloat)count;
+		verts[i] = cpvmult(cpvforangle(angle), radius*RandRange(0.7f, 1.0f));
+	}
+
+	cpFloat mass = 1.0f;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForPoly(mass, count, verts, cpvzero, 0.0f)));
+	cpBodySetPosition(body, pos);
+	cpBodySetAngle(body, RandRange(0.0f, 2.0f*CP_PI));
+
+	cpShape *shape = cpSpaceAddShape(space, cpPolyShapeNew(body, count, verts, cpTransformIdentity, 0.0f));
+	cpShapeSetElasticity(shape, 0.0f);
+	cpShapeSetFriction(shape, 0.7f);
+
+	return body;
+}
+
+// Side by side pyramids of boxes, 20 rows tall each.
+static void
+BuildPyramids(cpSpace *space, int count)
+{
+	const int rows = 20;
+	const cpFloat size = 1.0f;
+	int perPyramid = rows*(rows + 1)/2;
+	int pyramids = (count + perPyramid - 1)/perPyramid;
+	cpFloat spacing = (rows + 2)*size;
+	cpFloat width = pyramids*spacing;
+
+	AddStaticSegment(space, cpv(-width, 0.0f), cpv(width, 0.0f), 0.0f);
+
+	int added = 0;
+	for(int p=0; p<pyramids; p++){
+		cpFloat x0 = -0.5f*width + p*spacing;
+		for(int i=0; i<rows; i++){
+			for(int j=0; j<rows - i && added < count; j++, added++){
+				cpVect pos = cpv(x0 + (j + 0.5f*i)*size, (i + 0.5f)*size);
+				AddBox(space, pos, size, size);
+			}
+		}
+	}
+}
+
+// A walled pit densely filled with small circles.
+static void
+BuildBallPit(cpSpace *space, int count)
+{
+	const cpFloat radius = 0.5f;
+	int columns = (int)cpfsqrt((cpFloat)count);
+	if(columns < 1) columns = 1;
+
+	cpFloat width = columns*2.0f*radius;
+	cpFloat height = (count/columns + 1)*2.0f*radius;
+
+	AddStaticSegment(space, cpv(-0.5f*width, 0.0f), cpv(0.5f*width, 0.0f), 0.0f);
+	AddStaticSegment(space, cpv(-0.5f*width, 0.0f), cpv(-0.5f*width, 2.0f*height), 0.0f);
+	AddStaticSegment(space, cpv(0.5f*width, 0.0f), cpv(0.5f*width, 2.0f*height), 0.0f);
+
+	for(int i=0; i<count; i++){
+		int x = i%columns;
+		int y = i/columns;
+		cpVect pos = cpv(-0.5f*width + (x + 0.5f)*2.0f*radius + RandRange(-0.05f, 0.05f), (y + 0.5f)*2.0f*radius);
+		AddBall(space, pos, radius*RandRange(0.8f, 0.98f));
+	}
+}
+
+// Hanging chains of circles linked with pivot joints, dangling over a floor.
+static void
+BuildChains(cpSpace *space, int count)
+{
+	const int links = 20;
+	const cpFloat radius = 0.25f;
+	const cpFloat spacing = 2.0f*radius;
+	int chains = (count + links - 1)/links;
+	cpFloat width = chains*4.0f*radius;
+	cpFloat top = links*spacing + 5.0f;
+
+	AddStaticSegment(space, cpv(-width, 0.0f), cpv(width, 0.0f), 0.0f);
+
+	int added = 0;
+	for(int c=0; c<chains; c++){
+		cpFloat x = -0.5f*width + c*4.0f*radius;
+		cpBody *prev = cpSpaceGetStaticBody(space);
+		cpVect anchor = cpv(x, top);
+
+		for(int i=0; i<links && added < count; i++, added++){
+			// Give every chain an initial swing so they collide with their neighbors.
+			cpVect pos = cpvadd(cpv(x, top), cpvmult(cpvforangle(-0.5f*CP_PI + 0.5f), (i + 0.5f)*spacing));
+			cpBody *body = AddBall(space, pos, radius);
+			cpSpaceAddConstraint(space, cpPivotJointNew(prev, body, anchor));
+
+			prev = body;
+			anchor = cpvadd(cpv(x, top), cpvmult(cpvforangle(-0.5f*CP_PI + 0.5f), (i + 1)*spacing));
+		}
+	}
+}
+
+// Random convex polygons inside of a rotating kinematic drum.
+static void
+BuildTumble(cpSpace *space, int count)
+{
+	cpFloat radius = 0.5f;
+	int columns = (int)cpfsqrt((cpFloat)count);
+	if(columns < 1) columns = 1;
+	cpFloat half = 0.6f*columns*2.0f*radius + 2.0f;
+
+	cpBody *drum = cpSpaceAddBody(space, cpBodyNewKinematic());
+	cpBodySetAngularVelocity(drum, 0.4f);
+
+	cpVect corners[] = {cpv(-half, -half), cpv(-half, half), cpv(half, half), cpv(half, -half)};
+	for(int i=0; i<4; i++){
+		cpShape *shape = cpSpaceAddShape(space, cpSegmentShapeNew(drum, corners[i], corners[(i + 1)%4], 0.25f));
+		cpShapeSetElasticity(shape, 0.0f);
+		cpShapeSetFriction(shape, 0.7f);
+	}
+
+	for(int i=0; i<count; i++){
+		int x = i%columns;
+		int y = i/columns;
+		cpFloat step = 2.2f*radius;
+		cpVect pos = cpv((x - 0.5f*columns)*step, (y - 0.5f*columns)*step);
+		AddRandomPolygon(space, pos, radius);
+	}
+}
+
+struct TerrainContext {
+	cpSpace *space;
+	int segments;
+};
+
+static cpFloat
+TerrainSample(cpVect p, void *data)
+{
+	// Rolling hills with a few caves punched into them.
+	cpFloat ground = 20.0f + 8.0f*cpfsin(p.x*0.05f) + 3.0f*cpfsin(p.x*0.23f + 1.0f) + 1.0f*cpfcos(p.x*0.71f);
+	cpFloat density = ground - p.y;
+
+	cpFloat cave = cpfsin(p.x*0.11f)*cpfcos(p.y*0.17f);
+	if(cave > 0.7f && p.y < ground - 4.0f) density = -1.0f;
+
+	return density;
+}
+
+static void
+TerrainSegment(cpVect v0, cpVect v1, struct TerrainContext *context)
+{
+	AddStaticSegment(context->space, v0, v1, 0.1f);
+	context->segments++;
+}
+
+// Dynamic bodies dropped onto a large static terrain traced with cpMarchHard().
+static void
+BuildTerrain(cpSpace *space, int count)
+{
+	cpFloat width = cpfmax(200.0f, 0.5f*count);
+	cpBB bb = cpBBNew(-0.5f*width, 0.0f, 0.5f*width, 40.0f);
+	struct TerrainContext context = {space, 0};
+
+	cpMarchHard(
+		bb, (unsigned long)(width*2.0f), 80, 0.0f,
+		(cpMarchSegmentFunc)TerrainSegment, &context,
+		TerrainSample, NULL
+	);
+
+	for(int i=0; i<count; i++){
+		cpVect pos = cpv(RandRange(-0.5f*width + 2.0f, 0.5f*width - 2.0f), RandRange(45.0f, 45.0f + count/(width*0.5f) + 10.0f));
+
+		if(i%2 == 0){
+			AddBall(space, pos, 0.4f);
+		} else {
+			AddBox(space, pos, 0.8f, 0.8f);
+		}
+	}
+}
+
+typedef void (*SceneBuildFunc)(cpSpace *space, int count);
+
+struct Scene {
+	const char *name;
+	SceneBuildFunc build;
+	int defaultCount;
+};
+
+static const struct Scene Scenes[] = {
+	{"pyramid", BuildPyramids, 2000},
+	{"ballpit", BuildBallPit, 10000},
+	{"chains", BuildChains, 2000},
+	{"tumble", BuildTumble, 2000},
+	{"terrain", BuildTerrain, 2000},
+};
+
+#define SCENE_COUNT (int)(sizeof(Scenes)/sizeof(*Scenes))
+
+//MARK: Space Cleanup
+
+static void
+PostShapeFree(cpSpace *space, cpShape *shape, void *unused)
+{
+	cpSpaceRemoveShape(space, shape);
+	cpShapeFree(shape);
+}
+
+static void
+PostConstraintFree(cpSpace *space, cpConstraint *constraint, void *unused)
+{
+	cpSpaceRemoveConstraint(space, constraint);
+	cpConstraintFree(constraint);
+}
+
+static void
+PostBodyFree(cpSpace *space, cpBody *body, void *unused)
+{
+	cpSpaceRemoveBody(space, body);
+	cpBodyFree(body);
+}
+
+static void
+ShapeFreeWrap(cpShape *shape, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostShapeFree, shape, NULL);
+}
+
+static void
+ConstraintFreeWrap(cpConstraint *constraint, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostConstraintFree, constraint, NULL);
+}
+
+static void
+BodyFreeWrap(cpBody *body, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostBodyFree, body, NULL);
+}
+
+static void
+FreeSpaceChildren(cpSpace *space)
+{
+	// Must remove these BEFORE freeing the body or you will access dangling pointers.
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)ShapeFreeWrap, space);
+	cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)ConstraintFreeWrap, space);
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)BodyFreeWrap, space);
+}
+
+//MARK: Benchmark Runner
+
+enum Stepper {
+	STEPPER_SPACE,
+	STEPPER_HASTY,
+};
+
+enum Index {
+	INDEX_BBTREE,
+	INDEX_FLAT,
+	INDEX_LBVH,
+	INDEX_GRID,
+	INDEX_HASH,
+	INDEX_ADAPTIVE,
+};
+
+struct Options {
+	const char *scene;
+	int counts[BENCH_MAX_COUNTS];
+	int countsLength;
+	int steps;
+	int warmup;
+	unsigned long threads;
+	int iterations;
+	cpBool runSpace, runHasty;
+	cpBool spin;
+	cpHastySolverMode solver;
+	cpBool simd;
+	enum Index index;
+	cpFloat refit;
+	cpBool stats;
+};
+
+struct Result {
+	double total;
+	double p50, p99;
+	unsigned long threads;
+	
+	// Sum of the step statistics over all of the timed steps.
+	cpSpaceStepStats stats;
+};
+
+static int
+CompareDoubles(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+static double
+Percentile(const double *sorted, int count, double percentile)
+{
+	int i = (int)(percentile*(count - 1) + 0.5);
+	return sorted[i < count ? i : count - 1];
+}
+
+static void
+AccumulateStats(cpSpaceStepStats *sum, cpSpaceStepStats stats)
+{
+	sum->integratePositionsTime += stats.integratePositionsTime;
+	sum->updateBBTime += stats.updateBBTime;
+	sum->collideTime += stats.collideTime;
+	sum->componentsTime += stats.componentsTime;
+	sum->arbiterFilterTime += stats.arbiterFilterTime;
+	sum->preStepTime += stats.preStepTime;
+	sum->integrateVelocitiesTime += stats.integrateVelocitiesTime;
+	sum->solverTime += stats.solverTime;
+	sum->callbacksTime += stats.callbacksTime;
+	sum->totalTime += stats.totalTime;
+	
+	sum->pairsTested += stats.pairsTested;
+	sum->pairsRejected += stats.pairsRejected;
+	sum->collideCalls += stats.collideCalls;
+	sum->contacts += stats.contacts;
+	sum->arbiters += stats.arbiters;
+	sum->constraints += stats.constraints;
+	sum->gjkBudgetExceeded += stats.gjkBudgetExceeded;
+	sum->epaBudgetExceeded += stats.epaBudgetExceeded;
+}
+
+static struct Result
+RunScene(const struct Scene *scene, int count, enum Stepper stepper, const struct Options *options)
+{
+	BenchSeed = 0x12345678;
+
+	cpSpace *space = (stepper == STEPPER_HASTY ? cpHastySpaceNew() : cpSpaceNew());
+	cpSpaceSetIterations(space, options->iterations);
+	cpSpaceSetGravity(space, cpv(0.0f, -10.0f));
+
+	if(stepper == STEPPER_HASTY){
+		cpHastySpaceSetThreads(space, options->threads);
+		cpHastySpaceSetSpinWait(space, options->spin);
+		cpHastySpaceSetSolverMode(space, options->solver);
+		cpHastySpaceSetSIMDContacts(space, options->simd);
+	}
+	if(options->index == INDEX_FLAT){
+		cpSpaceUseFlatBBTree(space);
+	} else if(options->index == INDEX_LBVH){
+		cpSpaceUseLBVH(space);
+	} else if(options->index == INDEX_GRID){
+		// All of the scenes use shapes about 1 unit across.
+		cpSpaceUseSpatialGrid(space, 1.0f, 4*count);
+	} else if(options->index == INDEX_HASH){
+		cpSpaceUseSpatialHash(space, 0.0f, 0);
+	} else if(options->index == INDEX_ADAPTIVE){
+		cpSpaceSetAdaptiveBroadphase(space, cpTrue);
+	} else {
+		cpSpaceSetBBTreeRefitThreshold(space, options->refit);
+	}
+	cpSpaceSetStepStatsEnabled(space, options->stats);
+
+	scene->build(space, count);
+
+	for(int i=0; i<options->warmup; i++){
+		if(stepper == STEPPER_HASTY){
+			cpHastySpaceStep(space, BENCH_DT);
+		} else {
+			cpSpaceStep(space, BENCH_DT);
+		}
+	}
+
+	double *samples = (double *)calloc(options->steps, sizeof(double));
+	double total = 0.0;
+	cpSpaceStepStats sum = {0};
+
+	for(int i=0; i<options->steps; i++){
+		double start = NowMilliseconds();
+
+		if(stepper == STEPPER_HASTY){
+			cpHastySpaceStep(space, BENCH_DT);
+		} else {
+			cpSpaceStep(space, BENCH_DT);
+		}
+
+		samples[i] = NowMilliseconds() - start;
+		total += samples[i];
+		
+		if(options->stats) AccumulateStats(&sum, cpSpaceGetStepStats(space));
+	}
+
+	qsort(samples, options->steps, sizeof(double), CompareDoubles);
+	struct Result result = {total, Percentile(samples, options->steps, 0.5), Percentile(samples, options->steps, 0.99), 1, sum};
+	free(samples);
+
+	FreeSpaceChildren(space);
+	if(stepper == STEPPER_HASTY){
+		result.threads = cpHastySpaceGetThreads(space);
+		cpHastySpaceFree(space);
+	} else {
+		cpSpaceFree(space);
+	}
+
+	return result;
+}
+
+static void
+PrintResult(const struct Scene *scene, int count, const char *stepper, struct Result result, int steps)
+{
+	double msPerStep = result.total/steps;
+	printf("%-8s %8d  %-16s %7lu %10.3f %10.1f %9.3f %9.3f\n",
+		scene->name, count, stepper, result.threads,
+		msPerStep, 1e3/msPerStep, result.p50, result.p99
+	);
+	fflush(stdout);
+}
+
+static void
+PrintStats(cpSpaceStepStats sum, int steps)
+{
+	double ms = 1e-6/steps;
+	printf("    phase ms: positions %.3f  bb %.3f  collide %.3f  components %.3f  filter %.3f  prestep %.3f  velocities %.3f  solver %.3f  callbacks %.3f\n",
+		sum.integratePositionsTime*ms, sum.updateBBTime*ms, sum.collideTime*ms, sum.componentsTime*ms, sum.arbiterFilterTime*ms,
+		sum.preStepTime*ms, sum.integrateVelocitiesTime*ms, sum.solverTime*ms, sum.callbacksTime*ms
+	);
+	printf("    per step: pairs %u  rejected %u  collides %u  contacts %u  arbiters %u  constraints %u\n",
+		sum.pairsTested/steps, sum.pairsRejected/steps, sum.collideCalls/steps,
+		sum.contacts/steps, sum.arbiters/steps, sum.constraints/steps
+	);
+	printf("    budgets exceeded: gjk %u  epa %u\n", sum.gjkBudgetExceeded, sum.epaBudgetExceeded);
+}
+
+static void
+Usage(const char *name)
+{
+	printf("Usage: %s [--scene pyramid|ballpit|chains|tumble|terrain|all] [--bodies N[,N...]]\n", name);
+	printf("       [--steps N] [--warmup N] [--threads N] [--iterations N] [--stepper space|hasty|both]\n");
+	printf("       [--spin] [--solver default|colored|islands] [--simd]\n");
+	printf("       [--index bbtree|flat|lbvh|grid|hash|adaptive] [--refit THRESHOLD] [--stats]\n");
+}
+
+static bool
+ParseOptions(int argc, char **argv, struct Options *options)
+{
+	for(int i=1; i<argc; i++){
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc ? argv[i + 1] : NULL);
+
+		if(strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) return false;
+		if(strcmp(arg, "--stats") == 0){
+			options->stats = cpTrue;
+			continue;
+		} else if(strcmp(arg, "--spin") == 0){
+			options->spin = cpTrue;
+			continue;
+		} else if(strcmp(arg, "--simd") == 0){
+			options->simd = cpTrue;
+			continue;
+		}
+		
+		if(value == NULL){
+			fprintf(stderr, "Missing value for %s\n", arg);
+			return false;
+		}
+		i++;
+
+		if(strcmp(arg, "--scene") == 0){
+			options->scene = value;
+		} else if(strcmp(arg, "--bodies") == 0){
+			options->countsLength = 0;
+			for(const char *s = value; *s && options->countsLength < BENCH_MAX_COUNTS;){
+				char *end = NULL;
+				long count = strtol(s, &end, 10);
+				if(end == s || count <= 0) return false;
+
+				options->counts[options->countsLength++] = (int)count;
+				s = (*end == ',' ? end + 1 : end);
+			}
+		} else if(strcmp(arg, "--steps") == 0){
+			options->steps = atoi(value);
+		} else if(strcmp(arg, "--warmup") == 0){
+			options->warmup = atoi(value);
+		} else if(strcmp(arg, "--threads") == 0){
+			options->threads = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--iterations") == 0){
+			options->iterations = atoi(value);
+		} else if(strcmp(arg, "--stepper") == 0){
+			options->runSpace = (strcmp(value, "space") == 0 || strcmp(value, "both") == 0);
+			options->runHasty = (strcmp(value, "hasty") == 0 || strcmp(value, "both") == 0);
+			if(!options->runSpace && !options->runHasty) return false;
+		} else if(strcmp(arg, "--solver") == 0){
+			if(strcmp(value, "default") == 0){
+				options->solver = CP_HASTY_SOLVER_DEFAULT;
+			} else if(strcmp(value, "colored") == 0){
+				options->solver = CP_HASTY_SOLVER_COLORED;
+			} else if(strcmp(value, "islands") == 0){
+				options->solver = CP_HASTY_SOLVER_ISLANDS;
+			} else {
+				return false;
+			}
+		} else if(strcmp(arg, "--index") == 0){
+			if(strcmp(value, "bbtree") == 0){
+				options->index = INDEX_BBTREE;
+			} else if(strcmp(value, "flat") == 0){
+				options->index = INDEX_FLAT;
+			} else if(strcmp(value, "lbvh") == 0){
+				options->index = INDEX_LBVH;
+			} else if(strcmp(value, "grid") == 0){
+				options->index = INDEX_GRID;
+			} else if(strcmp(value, "hash") == 0){
+				options->index = INDEX_HASH;
+			} else if(strcmp(value, "adaptive") == 0){
+				options->index = INDEX_ADAPTIVE;
+			} else {
+				return false;
+			}
+		} else if(strcmp(arg, "--refit") == 0){
+			options->refit = atof(value);
+			if(options->refit != 0.0f && options->refit < 1.0f) return false;
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			return false;
+		}
+	}
+
+	return (options->steps > 0 && options->warmup >= 0 && options->iterations > 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct Options options = {"all", {0}, 0, 300, 60, 0, 10, cpTrue, cpTrue, cpFalse, CP_HASTY_SOLVER_DEFAULT, cpFalse, INDEX_BBTREE, 0.0f, cpFalse};
+	if(!ParseOptions(argc, argv, &options)){
+		Usage(argv[0]);
+		return 1;
+	}
+
+	bool found = false;
+	printf("%-8s %8s  %-16s %7s %10s %10s %9s %9s\n", "scene", "bodies", "stepper", "threads", "ms/step", "steps/sec", "p50 ms", "p99 ms");
+
+	for(int s=0; s<SCENE_COUNT; s++){
+		const struct Scene *scene = &Scenes[s];
+		if(strcmp(options.scene, "all") != 0 && strcmp(options.scene, scene->name) != 0) continue;
+		found = true;
+
+		int defaultCount = scene->defaultCount;
+		const int *counts = (options.countsLength > 0 ? options.counts : &defaultCount);
+		int countsLength = (options.countsLength > 0 ? options.countsLength : 1);
+
+		for(int c=0; c<countsLength; c++){
+			if(options.runSpace){
+				struct Result result = RunScene(scene, counts[c], STEPPER_SPACE, &options);
+				PrintResult(scene, counts[c], "cpSpaceStep", result, options.steps);
+				if(options.stats) PrintStats(result.stats, options.steps);
+			}
+
+			if(options.runHasty){
+				struct Result result = RunScene(scene, counts[c], STEPPER_HASTY, &options);
+				PrintResult(scene, counts[c], "cpHastySpaceStep", result, options.steps);
+				if(options.stats) PrintStats(result.stats, options.steps);
+			}
+		}
+	}
+
+	if(!found){
+		fprintf(stderr, "Unknown scene '%s'\n", options.scene);
+		Usage(argv[0]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -82,6 +82,19 @@ CP_EXPORT void cpMessage(const char *condition, const char *file, int line, int
 	#define cpfree free
 #endif
 
+/// Allocation callbacks used by cpSpaceNewWithAllocator() to redirect a space's memory at runtime.
+/// The functions work like calloc(), realloc() and free(), with an extra context pointer.
+typedef struct cpAllocator {
+	/// Allocate zeroed memory for @c count elements of @c size bytes.
+	void *(*callocFunc)(size_t count, size_t size, void *context);
+	/// Resize a block of memory. @c ptr may be NULL.
+	void *(*reallocFunc)(void *ptr, size_t size, void *context);
+	/// Free a block of memory. @c ptr may be NULL.
+	void (*freeFunc)(void *ptr, void *context);
+	/// User defined context pointer passed to the functions.
+	void *context;
+} cpAllocator;
+
 typedef struct cpArray cpArray;
 typedef struct cpHashSet cpHashSet;
 
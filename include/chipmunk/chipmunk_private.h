@@ -22,6 +22,8 @@
 #ifndef CHIPMUNK_PRIVATE_H
 #define CHIPMUNK_PRIVATE_H
 
+#include <string.h>
+
 #include "chipmunk/chipmunk.h"
 #include "chipmunk/chipmunk_structs.h"
 
@@ -32,9 +34,33 @@
 #define MAGIC_EPSILON 1e-5
 
 
+//MARK: cpAllocator
+
+// A NULL allocator uses cpcalloc()/cprealloc()/cpfree().
+
+static inline void *
+cpAllocatorCalloc(const cpAllocator *allocator, size_t count, size_t size)
+{
+	return (allocator ? allocator->callocFunc(count, size, allocator->context) : cpcalloc(count, size));
+}
+
+static inline void *
+cpAllocatorRealloc(const cpAllocator *allocator, void *ptr, size_t size)
+{
+	return (allocator ? allocator->reallocFunc(ptr, size, allocator->context) : cprealloc(ptr, size));
+}
+
+static inline void
+cpAllocatorFree(const cpAllocator *allocator, void *ptr)
+{
+	if(allocator) allocator->freeFunc(ptr, allocator->context); else cpfree(ptr);
+}
+
+
 //MARK: cpArray
 
 cpArray *cpArrayNew(int size);
+cpArray *cpArrayNewWithAllocator(int size, const cpAllocator *allocator);
 
 void cpArrayFree(cpArray *arr);
 
@@ -44,6 +70,8 @@ void cpArrayDeleteObj(cpArray *arr, void *obj);
 cpBool cpArrayContains(cpArray *arr, void *ptr);
 
 void cpArrayFreeEach(cpArray *arr, void (freeFunc)(void*));
+// Free each element using the array's allocator.
+void cpArrayFreeEachBuffer(cpArray *arr);
 
 
 //MARK: cpHashSet
@@ -52,6 +80,7 @@ typedef cpBool (*cpHashSetEqlFunc)(const void *ptr, const void *elt);
 typedef void *(*cpHashSetTransFunc)(const void *ptr, void *data);
 
 cpHashSet *cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc);
+cpHashSet *cpHashSetNewWithAllocator(int size, cpHashSetEqlFunc eqlFunc, const cpAllocator *allocator);
 void cpHashSetSetDefaultValue(cpHashSet *set, void *default_value);
 
 void cpHashSetFree(cpHashSet *set);
@@ -67,6 +96,11 @@ void cpHashSetEach(cpHashSet *set, cpHashSetIteratorFunc func, void *data);
 typedef cpBool (*cpHashSetFilterFunc)(void *elt, void *data);
 void cpHashSetFilter(cpHashSet *set, cpHashSetFilterFunc func, void *data);
 
+// Compact the bins into fresh buffers and free the idle ones, keeping up to 'keepBytes' of them pooled.
+// If 'remap' is not NULL, each element is replaced by the value it returns. Returns the number of bytes freed.
+typedef void *(*cpHashSetRemapFunc)(void *elt, void *data);
+size_t cpHashSetTrim(cpHashSet *set, cpHashSetRemapFunc remap, void *data, size_t keepBytes);
+
 
 //MARK: Bodies
 
@@ -82,6 +116,7 @@ void cpBodyRemoveConstraint(cpBody *body, cpConstraint *constraint);
 //MARK: Spatial Index Functions
 
 cpSpatialIndex *cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+cpBool cpSpatialIndexIsLBVH(cpSpatialIndex *index);
 
 
 //MARK: Arbiters
@@ -115,7 +150,24 @@ cpShapeActive(cpShape *shape)
 }
 
 // Note: This function returns contact points with r1/r2 in absolute coordinates, not body relative.
-struct cpCollisionInfo cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts);
+// A NULL budget uses the default GJK and EPA iteration budgets.
+struct cpCollisionInfo cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts, const struct cpCollisionBudget *budget);
+
+// Maximum number of pairs passed to cpCollideBatch() at once.
+#define CP_COLLIDE_BATCH_SIZE 64
+
+// Index of two shapes' types in the collision function table.
+static inline int
+cpCollisionFuncIndex(const cpShape *a, const cpShape *b)
+{
+	int ta = a->klass->type, tb = b->klass->type;
+	return (ta < tb ? ta + tb*CP_NUM_SHAPES : tb + ta*CP_NUM_SHAPES);
+}
+
+// Collide up to CP_COLLIDE_BATCH_SIZE deferred pairs that all have the same collision type.
+// The pairs are pairs[indexes[i]], and their contacts are written consecutively starting at 'contacts'.
+// Fills in each pair's 'info' and returns the number of contacts written.
+int cpCollideBatch(struct cpCollisionPair *pairs, const int *indexes, int count, struct cpContact *contacts, const struct cpCollisionBudget *budget);
 
 static inline void
 CircleSegmentQuery(cpShape *shape, cpVect center, cpFloat r1, cpVect a, cpVect b, cpFloat r2, cpSegmentQueryInfo *info)
@@ -182,8 +234,17 @@ normal_relative_velocity(cpBody *a, cpBody *b, cpVect r1, cpVect r2, cpVect n){
 	return cpvdot(relative_velocity(a, b, r1, r2), n);
 }
 
+// Static and kinematic bodies have zero inverse mass and moment, so impulses can't change them.
+// The impulse functions skip writing to them so cpHastySpace can solve constraints sharing them in parallel.
+static inline cpBool
+body_is_immovable(cpBody *body){
+	return (body->m_inv == 0.0f && body->i_inv == 0.0f);
+}
+
 static inline void
 apply_impulse(cpBody *body, cpVect j, cpVect r){
+	if(body_is_immovable(body)) return;
+	
 	body->v = cpvadd(body->v, cpvmult(j, body->m_inv));
 	body->w += body->i_inv*cpvcross(r, j);
 }
@@ -198,6 +259,8 @@ apply_impulses(cpBody *a , cpBody *b, cpVect r1, cpVect r2, cpVect j)
 static inline void
 apply_bias_impulse(cpBody *body, cpVect j, cpVect r)
 {
+	if(body_is_immovable(body)) return;
+	
 	body->v_bias = cpvadd(body->v_bias, cpvmult(j, body->m_inv));
 	body->w_bias += body->i_inv*cpvcross(r, j);
 }
@@ -209,6 +272,14 @@ apply_bias_impulses(cpBody *a , cpBody *b, cpVect r1, cpVect r2, cpVect j)
 	apply_bias_impulse(b, j, r2);
 }
 
+static inline void
+apply_angular_impulse(cpBody *body, cpFloat j)
+{
+	if(body_is_immovable(body)) return;
+	
+	body->w += j*body->i_inv;
+}
+
 static inline cpFloat
 k_scalar_body(cpBody *body, cpVect r, cpVect n)
 {
@@ -278,6 +349,15 @@ bias_coef(cpFloat errorBias, cpFloat dt)
 
 void cpSpaceSetStaticBody(cpSpace *space, cpBody *body);
 
+cpSpace *cpSpaceInitWithAllocator(cpSpace *space, const cpAllocator *allocator);
+
+// Allocator for the space's internal memory, NULL when using cpcalloc()/cprealloc()/cpfree().
+static inline const cpAllocator *
+cpSpaceAllocator(cpSpace *space)
+{
+	return (space->allocator.callocFunc ? &space->allocator : NULL);
+}
+
 extern cpCollisionHandler cpCollisionHandlerDoNothing;
 
 void cpSpaceProcessComponents(cpSpace *space, cpFloat dt);
@@ -314,6 +394,62 @@ cpSpaceArrayForBodyType(cpSpace *space, cpBodyType type)
 void cpShapeUpdateFunc(cpShape *shape, void *unused);
 cpCollisionID cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space);
 
+// Deferred narrowphase. Pairs from the broadphase are collected with cpSpaceDeferCollideShapes(),
+// bucketed by shape types with cpSpaceBucketCollisionPairs(),
+// collided in bulk with cpSpaceCollidePairs() (possibly split across threads),
+// then merged into the space in the order the broadphase found them with cpSpaceMergeCollisionPairs().
+// Used by cpHastySpaceStep() so the results don't depend on the thread count. cpSpaceStep() collides each pair
+// as soon as the broadphase finds it with cpSpaceCollideShapes(), which is faster single threaded.
+void cpSpaceBeginDeferredCollisions(cpSpace *space);
+cpCollisionID cpSpaceDeferCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space);
+void cpSpaceBucketCollisionPairs(cpSpace *space);
+void cpSpaceCollidePairs(cpSpace *space, int begin, int end, struct cpContactArray *contacts);
+void cpSpaceMergeCollisionPairs(cpSpace *space);
+
+// Monotonic clock used for the step statistics.
+uint64_t cpTimeNanoseconds(void);
+
+// Clear the step statistics and start timing a new step.
+static inline uint64_t
+cpSpaceStepStatsBegin(cpSpace *space)
+{
+	memset(&space->stepStats, 0, sizeof(cpSpaceStepStats));
+	return (space->stepStatsEnabled ? cpTimeNanoseconds() : 0);
+}
+
+// Add the time since 'lap' to a phase when step timing is enabled and return the new lap time.
+static inline uint64_t
+cpSpaceStepStatsLap(cpSpace *space, uint64_t *phase, uint64_t lap)
+{
+	if(!space->stepStatsEnabled) return 0;
+	
+	uint64_t now = cpTimeNanoseconds();
+	(*phase) += now - lap;
+	return now;
+}
+
+// Pick a new spatial index for the dynamic shapes if the adaptive broadphase is enabled. Must be called while the space is unlocked.
+void cpSpaceAdaptBroadphase(cpSpace *space);
+
+// Start timing the collision phase for the adaptive broadphase.
+static inline uint64_t
+cpSpaceBroadphaseSampleBegin(cpSpace *space)
+{
+	return (space->broadphase.enabled ? cpTimeNanoseconds() : 0);
+}
+
+// Add the collision phase time and the number of colliding pairs of the current step to the adaptive broadphase's sample.
+static inline void
+cpSpaceBroadphaseSampleEnd(cpSpace *space, uint64_t start)
+{
+	struct cpSpaceBroadphaseSampler *sampler = &space->broadphase;
+	if(!sampler->enabled) return;
+	
+	sampler->steps++;
+	sampler->time += cpTimeNanoseconds() - start;
+	sampler->pairs += space->stepStats.collideCalls;
+}
+
 
 //MARK: Foreach loops
 
@@ -30,6 +30,8 @@
 struct cpArray {
 	int num, max;
 	void **arr;
+	
+	const cpAllocator *allocator;
 };
 
 struct cpBody {
@@ -78,6 +80,17 @@ struct cpBody {
 		cpBody *next;
 		cpFloat idleTime;
 	} sleeping;
+	
+	// Scratch data used by the hasty space's solver.
+	struct {
+		// Marks bodies already numbered while preparing the solver bodies. Cleared again afterwards.
+		cpTimestamp stamp;
+		// Bitmask of the colors already used by the constraints attached to this body.
+		uint64_t colors;
+		// Index of the body in the step's solver body array. Dynamic bodies come first, then any static
+		// and kinematic bodies used by arbiters or constraints. Also used to find islands.
+		int index;
+	} solver;
 };
 
 enum cpArbiterState {
@@ -110,6 +123,16 @@ struct cpContact {
 	cpHashValue hash;
 };
 
+// Iteration budgets for GJK and EPA, and the distance improvement below which they stop early.
+struct cpCollisionBudget {
+	int gjkIterations, epaIterations;
+	cpFloat tolerance;
+};
+
+// Flags set in cpCollisionInfo.exhausted when GJK or EPA ran out of iterations.
+#define CP_GJK_EXHAUSTED 1
+#define CP_EPA_EXHAUSTED 2
+
 struct cpCollisionInfo {
 	const cpShape *a, *b;
 	cpCollisionID id;
@@ -119,6 +142,37 @@ struct cpCollisionInfo {
 	int count;
 	// TODO Should this be a unique struct type?
 	struct cpContact *arr;
+	
+	const struct cpCollisionBudget *budget;
+	int exhausted;
+};
+
+// Growable array of contacts used to collect narrowphase results away from the space's contact buffers.
+struct cpContactArray {
+	int num, max;
+	struct cpContact *arr;
+};
+
+// A broadphase pair waiting for (or holding the results of) a deferred narrowphase test.
+struct cpCollisionPair {
+	cpShape *a, *b;
+	cpCollisionID id;
+	
+	// Index of the shape types in the collision function table, used to bucket the pairs by type.
+	int type;
+	
+	// Narrowphase results. The contacts are stored in 'source' starting at 'offset'.
+	struct cpCollisionInfo info;
+	const struct cpContactArray *source;
+	int offset;
+};
+
+struct cpCollisionPairArray {
+	int num, max;
+	struct cpCollisionPair *arr;
+	
+	// Indexes of the pairs bucketed by shape types, 'max' long.
+	int *order;
 };
 
 struct cpArbiter {
@@ -231,6 +285,9 @@ struct cpPolyShape {
 	// The untransformed planes are appended at the end of the transformed planes.
 	struct cpSplittingPlane *planes;
 	
+	// Set when the verts form a rectangle so the collision code can use the box kernels.
+	cpBool box;
+	
 	// Allocate a small number of splitting planes internally for simple poly.
 	struct cpSplittingPlane _planes[2*CP_POLY_SHAPE_INLINE_ALLOC];
 };
@@ -393,6 +450,25 @@ struct cpSimpleMotor {
 typedef struct cpContactBufferHeader cpContactBufferHeader;
 typedef void (*cpSpaceArbiterApplyImpulseFunc)(cpArbiter *arb);
 
+// State for cpSpaceSetAdaptiveBroadphase().
+struct cpSpaceBroadphaseSampler {
+	cpBool enabled;
+	cpSpaceBroadphase current, previous;
+	
+	// Steps, collision phase time and colliding pairs accumulated since the last decision.
+	int steps;
+	uint64_t time, pairs;
+	// Colliding pairs per step at the last decision, used to tell if the workload is steady.
+	cpFloat lastPairs;
+	
+	// Decisions to skip before another switch is considered.
+	int cooldown;
+	// Time per step before the switch that is on trial, or 0 when there is no trial.
+	cpFloat trialBaseline;
+	// Decisions each index sits out for after losing a trial, and how long the next one will be.
+	int banned[3], backoff[3];
+};
+
 struct cpSpace {
 	int iterations;
 	
@@ -405,6 +481,7 @@ struct cpSpace {
 	cpFloat collisionSlop;
 	cpFloat collisionBias;
 	cpTimestamp collisionPersistence;
+	struct cpCollisionBudget collisionBudget;
 	
 	cpDataPointer userData;
 	
@@ -437,6 +514,17 @@ struct cpSpace {
 	cpBool skipPostStep;
 	cpArray *postStepCallbacks;
 	
+	// Broadphase pairs collected for the deferred narrowphase, and the ones from the previous step.
+	struct cpCollisionPairArray collisionPairs, prevCollisionPairs;
+	
+	cpBool stepStatsEnabled;
+	cpSpaceStepStats stepStats;
+	
+	struct cpSpaceBroadphaseSampler broadphase;
+	
+	// All zeros when the space uses cpcalloc()/cprealloc()/cpfree().
+	cpAllocator allocator;
+	
 	cpBody *staticBody;
 	cpBody _staticBody;
 };
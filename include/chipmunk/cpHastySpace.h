@@ -12,16 +12,54 @@ typedef struct cpHastySpace cpHastySpace;
 /// On ARM platforms that support NEON, this will enable the vectorized solver.
 /// cpHastySpace also supports multiple threads, but runs single threaded by default for determinism.
 CP_EXPORT cpSpace *cpHastySpaceNew(void);
+/// Create a new hasty space that uses @c allocator for the space and all of its internal memory, see cpSpaceNewWithAllocator().
+/// The allocator is called from the worker threads and must be thread safe.
+CP_EXPORT cpSpace *cpHastySpaceNewWithAllocator(const cpAllocator *allocator);
 CP_EXPORT void cpHastySpaceFree(cpSpace *space);
 
-/// Set the number of threads to use for the solver.
-/// Currently Chipmunk is limited to 2 threads as using more generally provides very minimal performance gains.
-/// Passing 0 as the thread count on iOS or OS X will cause Chipmunk to automatically detect the number of threads it should use.
-/// On other platforms passing 0 for the thread count will set 1 thread.
+/// Set the number of threads to use for the solver and collision detection.
+/// The thread count is limited to the number of processors available to the process.
+/// Passing 0 as the thread count will cause Chipmunk to use one thread per available processor.
 CP_EXPORT void cpHastySpaceSetThreads(cpSpace *space, unsigned long threads);
 
 /// Returns the number of threads the solver is using to run.
 CP_EXPORT unsigned long cpHastySpaceGetThreads(cpSpace *space);
 
+/// Set whether threads should spin for a short while before sleeping when waiting on each other.
+/// This lowers the latency of handing work to the worker threads at the cost of burning some CPU time.
+/// Disabled by default.
+CP_EXPORT void cpHastySpaceSetSpinWait(cpSpace *space, cpBool spin);
+
+/// Returns true if the threads spin before sleeping.
+CP_EXPORT cpBool cpHastySpaceGetSpinWait(cpSpace *space);
+
+/// Solver algorithms used by a hasty space.
+typedef enum cpHastySolverMode {
+	/// Each thread runs a share of the iterations over all of the arbiters and constraints at the same time.
+	/// Fast, but the results depend on the thread count and timing when using more than one thread.
+	CP_HASTY_SOLVER_DEFAULT,
+	/// Arbiters and constraints are colored into batches that don't share any dynamic bodies.
+	/// The threads split up each batch in turn, so the results are identical for any thread count.
+	CP_HASTY_SOLVER_COLORED,
+	/// Bodies are grouped into islands that don't interact every step, and each island is solved as a separate task.
+	/// Islands that make up a large share of the work are split up using the colored batches instead.
+	/// Results are identical for any thread count.
+	CP_HASTY_SOLVER_ISLANDS,
+} cpHastySolverMode;
+
+/// Set the solver algorithm to use. Defaults to CP_HASTY_SOLVER_DEFAULT.
+CP_EXPORT void cpHastySpaceSetSolverMode(cpSpace *space, cpHastySolverMode mode);
+
+/// Returns the solver algorithm the space is using.
+CP_EXPORT cpHastySolverMode cpHastySpaceGetSolverMode(cpSpace *space);
+
+/// Set whether the colored and island solvers should solve contacts several at a time using SIMD instructions.
+/// Uses AVX when the library is compiled for it (see the CP_ENABLE_AVX CMake option) and SSE2 otherwise on x86.
+/// The results are still identical for any thread count. Disabled by default.
+CP_EXPORT void cpHastySpaceSetSIMDContacts(cpSpace *space, cpBool enabled);
+
+/// Returns true if the SIMD contact solver is enabled.
+CP_EXPORT cpBool cpHastySpaceGetSIMDContacts(cpSpace *space);
+
 /// When stepping a hasty space, you must use this function.
 CP_EXPORT void cpHastySpaceStep(cpSpace *space, cpFloat dt);
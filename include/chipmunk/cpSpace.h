@@ -70,12 +70,22 @@ CP_EXPORT cpSpace* cpSpaceAlloc(void);
 CP_EXPORT cpSpace* cpSpaceInit(cpSpace *space);
 /// Allocate and initialize a cpSpace.
 CP_EXPORT cpSpace* cpSpaceNew(void);
+/// Allocate and initialize a cpSpace that uses @c allocator for the space and all of its internal memory.
+/// The allocator is copied into the space. Bodies, shapes and constraints are allocated by the caller and are not covered.
+/// Passing NULL is the same as calling cpSpaceNew().
+CP_EXPORT cpSpace* cpSpaceNewWithAllocator(const cpAllocator *allocator);
 
 /// Destroy a cpSpace.
 CP_EXPORT void cpSpaceDestroy(cpSpace *space);
 /// Destroy and free a cpSpace.
 CP_EXPORT void cpSpaceFree(cpSpace *space);
 
+/// Return pooled memory to the system after a spike in the number of collisions.
+/// Live arbiters, contacts and spatial index nodes are compacted into fresh blocks and the idle blocks are freed.
+/// Each pool keeps up to @c keepBytes of idle memory around for reuse. Returns the number of bytes freed.
+/// Cannot be called during a step or from a callback. The simulation may differ slightly after trimming.
+CP_EXPORT size_t cpSpaceTrimMemory(cpSpace *space, size_t keepBytes);
+
 
 //MARK: Properties
 
@@ -118,6 +128,27 @@ CP_EXPORT void cpSpaceSetCollisionSlop(cpSpace *space, cpFloat collisionSlop);
 CP_EXPORT cpFloat cpSpaceGetCollisionBias(const cpSpace *space);
 CP_EXPORT void cpSpaceSetCollisionBias(cpSpace *space, cpFloat collisionBias);
 
+/// Largest iteration budget accepted by cpSpaceSetEPAIterations().
+#define CP_MAX_EPA_ITERATIONS 64
+
+/// Number of GJK iterations the narrowphase may spend finding the closest points of a pair of segments or polygons.
+/// Pairs that run out use the closest points found so far and are counted in cpSpaceStepStats.gjkBudgetExceeded.
+/// Defaults to 30.
+CP_EXPORT int cpSpaceGetGJKIterations(const cpSpace *space);
+CP_EXPORT void cpSpaceSetGJKIterations(cpSpace *space, int iterations);
+
+/// Number of EPA iterations the narrowphase may spend finding the penetration of overlapping segments or polygons.
+/// Pairs that run out use the penetration found so far and are counted in cpSpaceStepStats.epaBudgetExceeded.
+/// Defaults to 30, and may be at most CP_MAX_EPA_ITERATIONS.
+CP_EXPORT int cpSpaceGetEPAIterations(const cpSpace *space);
+CP_EXPORT void cpSpaceSetEPAIterations(cpSpace *space, int iterations);
+
+/// GJK and EPA stop early once an iteration moves the closest points by no more than this distance.
+/// Defaults to 0, which only stops them early when an iteration makes no progress at all.
+/// Raising it trades contact accuracy for fewer iterations on shapes with many vertexes.
+CP_EXPORT cpFloat cpSpaceGetCollisionTolerance(const cpSpace *space);
+CP_EXPORT void cpSpaceSetCollisionTolerance(cpSpace *space, cpFloat tolerance);
+
 /// Number of frames that contact information should persist.
 /// Defaults to 3. There is probably never a reason to change this value.
 CP_EXPORT cpTimestamp cpSpaceGetCollisionPersistence(const cpSpace *space);
@@ -157,6 +188,9 @@ CP_EXPORT cpCollisionHandler *cpSpaceAddWildcardHandler(cpSpace *space, cpCollis
 /// Add a collision shape to the simulation.
 /// If the shape is attached to a static body, it will be added as a static shape.
 CP_EXPORT cpShape* cpSpaceAddShape(cpSpace *space, cpShape *shape);
+/// Add @c count collision shapes to the simulation at once.
+/// This is much faster than calling cpSpaceAddShape() in a loop when loading a level as the spatial indexes are built in bulk.
+CP_EXPORT void cpSpaceAddShapes(cpSpace *space, cpShape **shapes, int count);
 /// Add a rigid body to the simulation.
 CP_EXPORT cpBody* cpSpaceAddBody(cpSpace *space, cpBody *body);
 /// Add a constraint to the simulation.
@@ -246,14 +280,103 @@ CP_EXPORT void cpSpaceReindexShape(cpSpace *space, cpShape *shape);
 CP_EXPORT void cpSpaceReindexShapesForBody(cpSpace *space, cpBody *body);
 
 /// Switch the space to use a spatial has as it's spatial index.
+/// Pass 0 for @c dim to let the hashes pick and retune their cell size and table size themselves (see cpSpaceHashSetAutoResize()).
 CP_EXPORT void cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count);
 
+/// Switch the space to use spatial grids as its spatial indexes.
+/// They are rebuilt from scratch every step, which suits many similarly sized shapes that are almost all moving.
+/// See cpSpaceGridNew() for the meaning of @c dim and @c count.
+CP_EXPORT void cpSpaceUseSpatialGrid(cpSpace *space, cpFloat dim, int count);
+
+/// Switch the space to use flat bounding box trees as its spatial indexes.
+/// Queries are faster than with the default trees, but adding or removing shapes is slower.
+CP_EXPORT void cpSpaceUseFlatBBTree(cpSpace *space);
+
+/// Switch the space to use linear BVHs as its spatial indexes.
+/// They are rebuilt from scratch every step, which is faster than updating a tree when almost every shape moves.
+CP_EXPORT void cpSpaceUseLBVH(cpSpace *space);
+
+/// Set the refit threshold of the space's dynamic bounding box tree. See cpBBTreeSetRefitThreshold().
+/// Warns and does nothing if the space is using a spatial hash.
+CP_EXPORT void cpSpaceSetBBTreeRefitThreshold(cpSpace *space, cpFloat threshold);
+
+/// Spatial indexes that the adaptive broadphase can switch the space's dynamic shapes between.
+typedef enum cpSpaceBroadphase {
+	/// Bounding box tree, the default. Only shapes that moved out of their cached bounds are updated.
+	CP_BROADPHASE_BBTREE,
+	/// Spatial hash that picks its own cell size and table size. Suits many similarly sized shapes.
+	CP_BROADPHASE_SPATIAL_HASH,
+	/// Single axis sort and sweep. Suits shapes spread out along one axis, such as a side scroller level.
+	CP_BROADPHASE_SWEEP_1D,
+} cpSpaceBroadphase;
+
+/// Let the space switch its dynamic shapes between the spatial indexes in cpSpaceBroadphase while it steps.
+/// Every few dozen steps it looks at the pairs found per shape, how many shapes move, how their sizes vary
+/// and how long finding collisions took, and tries whichever index it expects to be cheaper.
+/// A switch that doesn't pay off is undone, and that index isn't tried again for a while.
+/// Enabling switches the space back to bounding box trees, and the static shapes always stay in a bounding box tree.
+/// Disabling keeps whichever index is in use at the time.
+/// The choice depends on timings, so pairs may be found in a different order from run to run.
+CP_EXPORT void cpSpaceSetAdaptiveBroadphase(cpSpace *space, cpBool enabled);
+CP_EXPORT cpBool cpSpaceGetAdaptiveBroadphase(const cpSpace *space);
+/// The spatial index the adaptive broadphase is currently using for the dynamic shapes. Only meaningful while it is enabled.
+CP_EXPORT cpSpaceBroadphase cpSpaceGetBroadphase(const cpSpace *space);
+
 
 //MARK: Time Stepping
 
 /// Step the space forward in time by @c dt.
 CP_EXPORT void cpSpaceStep(cpSpace *space, cpFloat dt);
 
+/// Timings and counters describing the most recent call to cpSpaceStep().
+/// The counters are always collected, the phase timings are only collected after calling cpSpaceSetStepStatsEnabled().
+/// All times are in nanoseconds.
+typedef struct cpSpaceStepStats {
+	/// Time spent integrating body positions.
+	uint64_t integratePositionsTime;
+	/// Time spent updating the cached bounding boxes of the dynamic shapes.
+	uint64_t updateBBTime;
+	/// Time spent finding colliding pairs. Includes both the broadphase and the narrowphase (cpCollide(), arbiter updates, begin and pre-solve callbacks).
+	uint64_t collideTime;
+	/// Time spent rebuilding the contact graph and processing sleeping components.
+	uint64_t componentsTime;
+	/// Time spent filtering cached arbiters, including separate callbacks.
+	uint64_t arbiterFilterTime;
+	/// Time spent prestepping arbiters and constraints, including constraint pre-solve callbacks.
+	uint64_t preStepTime;
+	/// Time spent integrating body velocities.
+	uint64_t integrateVelocitiesTime;
+	/// Time spent in the impulse solver, including applying cached impulses.
+	uint64_t solverTime;
+	/// Time spent in post-solve and post-step callbacks.
+	uint64_t callbacksTime;
+	/// Total time spent in the step.
+	uint64_t totalTime;
+	
+	/// Number of pairs reported by the broadphase.
+	unsigned int pairsTested;
+	/// Number of broadphase pairs rejected before the narrowphase. (bounding boxes, filters, same body, constraints)
+	unsigned int pairsRejected;
+	/// Number of narrowphase collision tests performed.
+	unsigned int collideCalls;
+	/// Number of contact points generated by the narrowphase.
+	unsigned int contacts;
+	/// Number of arbiters passed to the solver.
+	unsigned int arbiters;
+	/// Number of constraints passed to the solver.
+	unsigned int constraints;
+	/// Number of pairs that ran out of GJK iterations. See cpSpaceSetGJKIterations().
+	unsigned int gjkBudgetExceeded;
+	/// Number of pairs that ran out of EPA iterations. See cpSpaceSetEPAIterations().
+	unsigned int epaBudgetExceeded;
+} cpSpaceStepStats;
+
+/// Enable or disable timing each phase of cpSpaceStep(). Disabled by default as it requires reading the system clock several times per step.
+CP_EXPORT void cpSpaceSetStepStatsEnabled(cpSpace *space, cpBool enabled);
+CP_EXPORT cpBool cpSpaceGetStepStatsEnabled(const cpSpace *space);
+/// Get the statistics for the most recent call to cpSpaceStep().
+CP_EXPORT cpSpaceStepStats cpSpaceGetStepStats(const cpSpace *space);
+
 
 //MARK: Debug API
 
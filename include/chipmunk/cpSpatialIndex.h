@@ -61,6 +61,9 @@ struct cpSpatialIndex {
 	cpSpatialIndexBBFunc bbfunc;
 	
 	cpSpatialIndex *staticIndex, *dynamicIndex;
+	
+	// Allocator used for the index's memory, NULL to use cpcalloc()/cprealloc()/cpfree().
+	const cpAllocator *allocator;
 };
 
 
@@ -74,12 +77,40 @@ CP_EXPORT cpSpaceHash* cpSpaceHashAlloc(void);
 CP_EXPORT cpSpatialIndex* cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a spatial hash.
 CP_EXPORT cpSpatialIndex* cpSpaceHashNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a spatial hash that makes all of its allocations through @c allocator.
+/// The allocator must outlive the index.
+CP_EXPORT cpSpatialIndex* cpSpaceHashNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
 
 /// Change the cell dimensions and table size of the spatial hash to tune it.
 /// The cell dimensions should roughly match the average size of your objects
 /// and the table size should be ~10 larger than the number of objects inserted.
 /// Some trial and error is required to find the optimum numbers for efficiency.
 CP_EXPORT void cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells);
+/// Let the spatial hash pick its own cell dimensions and table size.
+/// It samples the sizes of its objects as they are inserted and every few reindexes,
+/// and resizes itself when the cell size is more than 2x off from the median object size or the table is too full or too empty.
+CP_EXPORT void cpSpaceHashSetAutoResize(cpSpaceHash *hash, cpBool autoResize);
+
+//MARK: Spatial Grid
+
+typedef struct cpSpaceGrid cpSpaceGrid;
+
+/// Allocate a spatial grid.
+CP_EXPORT cpSpaceGrid* cpSpaceGridAlloc(void);
+/// Initialize a spatial grid.
+/// Like a spatial hash, objects are binned into square cells hashed into a table of @c numcells buckets,
+/// but the table is rebuilt from scratch every reindex by counting sort into a single array.
+/// This favors scenes of many similarly sized objects that almost all move every step, such as bullets or particles.
+CP_EXPORT cpSpatialIndex* cpSpaceGridInit(cpSpaceGrid *grid, cpFloat celldim, int numcells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a spatial grid.
+CP_EXPORT cpSpatialIndex* cpSpaceGridNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a spatial grid that makes all of its allocations through @c allocator.
+/// The allocator must outlive the index.
+CP_EXPORT cpSpatialIndex* cpSpaceGridNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
+
+/// Change the cell dimensions and table size of the spatial grid.
+/// The same advice as for cpSpaceHashResize() applies, the table size is rounded up to a power of two.
+CP_EXPORT void cpSpaceGridResize(cpSpatialIndex *index, cpFloat celldim, int numcells);
 
 //MARK: AABB Tree
 
@@ -91,6 +122,9 @@ CP_EXPORT cpBBTree* cpBBTreeAlloc(void);
 CP_EXPORT cpSpatialIndex* cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a bounding box tree.
 CP_EXPORT cpSpatialIndex* cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a bounding box tree that makes all of its allocations through @c allocator.
+/// The allocator must outlive the tree.
+CP_EXPORT cpSpatialIndex* cpBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
 
 /// Perform a static top down optimization of the tree.
 CP_EXPORT void cpBBTreeOptimize(cpSpatialIndex *index);
@@ -101,6 +135,60 @@ typedef cpVect (*cpBBTreeVelocityFunc)(void *obj);
 /// Set the velocity function for the bounding box tree to enable temporal coherence.
 CP_EXPORT void cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func);
 
+/// Set the refit threshold for the bounding box tree.
+/// By default (0) objects that move out of their leaf's box are removed and reinserted into the tree.
+/// With a threshold >= 1, only the boxes of the leaf's ancestors are grown and refit instead, which is much cheaper,
+/// and the whole tree is rebuilt once its cost grows to more than 'threshold' times its cost right after the last rebuild.
+/// Values around 1.5 work well for scenes where most objects move every step.
+CP_EXPORT void cpBBTreeSetRefitThreshold(cpSpatialIndex *index, cpFloat threshold);
+/// Get the refit threshold for the bounding box tree.
+CP_EXPORT cpFloat cpBBTreeGetRefitThreshold(cpSpatialIndex *index);
+
+//MARK: Flat AABB Tree
+
+typedef struct cpFlatBBTree cpFlatBBTree;
+
+/// Allocate a flat bounding box tree.
+CP_EXPORT cpFlatBBTree* cpFlatBBTreeAlloc(void);
+/// Initialize a flat bounding box tree.
+/// The nodes are stored in a single array in depth first order, which makes queries very cache friendly.
+/// Moving objects are refit every reindex, and the tree is rebuilt when it degrades or objects are added or removed.
+/// This favors indexes that are queried much more often than objects are added or removed.
+CP_EXPORT cpSpatialIndex* cpFlatBBTreeInit(cpFlatBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a flat bounding box tree.
+CP_EXPORT cpSpatialIndex* cpFlatBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a flat bounding box tree that makes all of its allocations through @c allocator.
+/// The allocator must outlive the tree.
+CP_EXPORT cpSpatialIndex* cpFlatBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
+
+//MARK: Linear BVH
+
+typedef struct cpLBVH cpLBVH;
+
+/// Work function passed to a cpLBVHRunnerFunc.
+/// Each worker must be called with a different @c worker index from 0 to @c worker_count - 1.
+typedef void (*cpLBVHWorkFunc)(void *data, unsigned long worker, unsigned long worker_count);
+/// Runner callback used to split the work of building a linear BVH between threads.
+/// It must call @c func once for each of its workers, and only return once they have all finished.
+typedef void (*cpLBVHRunnerFunc)(cpLBVHWorkFunc func, void *data, void *context);
+
+/// Allocate a linear BVH.
+CP_EXPORT cpLBVH* cpLBVHAlloc(void);
+/// Initialize a linear BVH.
+/// The tree is rebuilt from scratch every reindex by sorting the objects along a Morton curve, which takes O(n) time.
+/// This favors scenes where almost every object moves every step.
+CP_EXPORT cpSpatialIndex* cpLBVHInit(cpLBVH *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a linear BVH.
+CP_EXPORT cpSpatialIndex* cpLBVHNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a linear BVH that makes all of its allocations through @c allocator.
+/// The allocator must outlive the tree, and must be thread safe if a runner is set.
+CP_EXPORT cpSpatialIndex* cpLBVHNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
+
+/// Set a runner to split up the work of cpSpatialIndexReindexQuery() between threads.
+/// The bounding box function must be thread safe, but the query callback is always called from the calling thread.
+/// The results are the same with or without a runner. cpHastySpace sets this automatically.
+CP_EXPORT void cpLBVHSetRunner(cpSpatialIndex *index, cpLBVHRunnerFunc runner, void *context);
+
 //MARK: Single Axis Sweep
 
 typedef struct cpSweep1D cpSweep1D;
@@ -111,6 +199,9 @@ CP_EXPORT cpSweep1D* cpSweep1DAlloc(void);
 CP_EXPORT cpSpatialIndex* cpSweep1DInit(cpSweep1D *sweep, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a 1D sort and sweep broadphase.
 CP_EXPORT cpSpatialIndex* cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a 1D sort and sweep broadphase that makes all of its allocations through @c allocator.
+/// The allocator must outlive the index.
+CP_EXPORT cpSpatialIndex* cpSweep1DNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
 
 //MARK: Spatial Index Implementation
 
@@ -130,6 +221,10 @@ typedef void (*cpSpatialIndexReindexQueryImpl)(cpSpatialIndex *index, cpSpatialI
 typedef void (*cpSpatialIndexQueryImpl)(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data);
 typedef void (*cpSpatialIndexSegmentQueryImpl)(cpSpatialIndex *index, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data);
 
+typedef size_t (*cpSpatialIndexTrimImpl)(cpSpatialIndex *index, size_t keepBytes);
+typedef void (*cpSpatialIndexInsertBatchImpl)(cpSpatialIndex *index, void **objs, const cpHashValue *hashids, int count);
+typedef void (*cpSpatialIndexQueryBatchImpl)(cpSpatialIndex *index, void **objs, const cpBB *bbs, int count, cpSpatialIndexQueryFunc func, void *data);
+
 struct cpSpatialIndexClass {
 	cpSpatialIndexDestroyImpl destroy;
 	
@@ -146,6 +241,11 @@ struct cpSpatialIndexClass {
 	
 	cpSpatialIndexQueryImpl query;
 	cpSpatialIndexSegmentQueryImpl segmentQuery;
+	
+	// Optional, may be NULL.
+	cpSpatialIndexTrimImpl trim;
+	cpSpatialIndexInsertBatchImpl insertBatch;
+	cpSpatialIndexQueryBatchImpl queryBatch;
 };
 
 /// Destroy and free a spatial index.
@@ -185,6 +285,17 @@ static inline void cpSpatialIndexInsert(cpSpatialIndex *index, void *obj, cpHash
 	index->klass->insert(index, obj, hashid);
 }
 
+/// Add @c count objects to a spatial index at once, @c hashids holds the hash value for each object.
+/// Indexes that can build their structure in bulk do so, the others insert the objects one at a time.
+static inline void cpSpatialIndexInsertBatch(cpSpatialIndex *index, void **objs, const cpHashValue *hashids, int count)
+{
+	if(index->klass->insertBatch){
+		index->klass->insertBatch(index, objs, hashids, count);
+	} else {
+		for(int i=0; i<count; i++) index->klass->insert(index, objs[i], hashids[i]);
+	}
+}
+
 /// Remove an object from a spatial index.
 /// Most spatial indexes use hashed storage, so you must provide a hash value too.
 static inline void cpSpatialIndexRemove(cpSpatialIndex *index, void *obj, cpHashValue hashid)
@@ -210,12 +321,30 @@ static inline void cpSpatialIndexQuery(cpSpatialIndex *index, void *obj, cpBB bb
 	index->klass->query(index, obj, bb, func, data);
 }
 
+/// Perform @c count rectangle queries at once, @c bbs holds the rectangle for each object in @c objs.
+/// Indexes that can share the work between nearby queries do so, the others run the queries one at a time.
+static inline void cpSpatialIndexQueryBatch(cpSpatialIndex *index, void **objs, const cpBB *bbs, int count, cpSpatialIndexQueryFunc func, void *data)
+{
+	if(index->klass->queryBatch){
+		index->klass->queryBatch(index, objs, bbs, count, func, data);
+	} else {
+		for(int i=0; i<count; i++) index->klass->query(index, objs[i], bbs[i], func, data);
+	}
+}
+
 /// Perform a segment query against the spatial index, calling @c func for each potential match.
 static inline void cpSpatialIndexSegmentQuery(cpSpatialIndex *index, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
 	index->klass->segmentQuery(index, obj, a, b, t_exit, func, data);
 }
 
+/// Release pooled memory the spatial index is no longer using, keeping up to @c keepBytes of it for reuse.
+/// Returns the number of bytes freed.
+static inline size_t cpSpatialIndexTrim(cpSpatialIndex *index, size_t keepBytes)
+{
+	return (index->klass->trim ? index->klass->trim(index, keepBytes) : 0);
+}
+
 /// Simultaneously reindex and find all colliding objects.
 /// @c func will be called once for each potentially overlapping pair of objects found.
 /// If the spatial index was initialized with a static index, it will collide it's objects against that as well.
@@ -26,6 +26,15 @@
 #	include <android/log.h>
 #endif
 
+#ifdef _WIN32
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	include <windows.h>
+#else
+#	include <time.h>
+#endif
+
 #include "chipmunk/chipmunk_private.h"
 
 void
@@ -58,6 +67,23 @@ cpMessage(const char *condition, const char *file, int line, int isError, int is
 
 const char *cpVersionString = XSTR(CP_VERSION_MAJOR) "." XSTR(CP_VERSION_MINOR) "." XSTR(CP_VERSION_RELEASE);
 
+uint64_t
+cpTimeNanoseconds(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {0};
+	if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart/frequency.QuadPart)*1000000000ull + (uint64_t)(counter.QuadPart%frequency.QuadPart)*1000000000ull/(uint64_t)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 //MARK: Misc Functions
 
 cpFloat
@@ -241,6 +267,9 @@ QHullReduce(cpFloat tol, cpVect *verts, int count, cpVect a, cpVect pivot, cpVec
 		result[index++] = pivot;
 		
 		int right_count = QHullPartition(verts + left_count, count - left_count, pivot, b, tol);
+		// When nothing is right of the pivot, verts[left_count] is past the end of the vertexes.
+		if(right_count == 0) return index;
+		
 		return index + QHullReduce(tol, verts + left_count + 1, right_count - 1, pivot, verts[left_count], b, result + index);
 	}
 }
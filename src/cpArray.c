@@ -27,11 +27,18 @@
 cpArray *
 cpArrayNew(int size)
 {
-	cpArray *arr = (cpArray *)cpcalloc(1, sizeof(cpArray));
+	return cpArrayNewWithAllocator(size, NULL);
+}
+
+cpArray *
+cpArrayNewWithAllocator(int size, const cpAllocator *allocator)
+{
+	cpArray *arr = (cpArray *)cpAllocatorCalloc(allocator, 1, sizeof(cpArray));
 	
 	arr->num = 0;
 	arr->max = (size ? size : 4);
-	arr->arr = (void **)cpcalloc(arr->max, sizeof(void*));
+	arr->arr = (void **)cpAllocatorCalloc(allocator, arr->max, sizeof(void*));
+	arr->allocator = allocator;
 	
 	return arr;
 }
@@ -40,10 +47,12 @@ void
 cpArrayFree(cpArray *arr)
 {
 	if(arr){
-		cpfree(arr->arr);
+		const cpAllocator *allocator = arr->allocator;
+		
+		cpAllocatorFree(allocator, arr->arr);
 		arr->arr = NULL;
 		
-		cpfree(arr);
+		cpAllocatorFree(allocator, arr);
 	}
 }
 
@@ -52,7 +61,7 @@ cpArrayPush(cpArray *arr, void *object)
 {
 	if(arr->num == arr->max){
 		arr->max = 3*(arr->max + 1)/2;
-		arr->arr = (void **)cprealloc(arr->arr, arr->max*sizeof(void*));
+		arr->arr = (void **)cpAllocatorRealloc(arr->allocator, arr->arr, arr->max*sizeof(void*));
 	}
 	
 	arr->arr[arr->num] = object;
@@ -91,6 +100,12 @@ cpArrayFreeEach(cpArray *arr, void (freeFunc)(void*))
 	for(int i=0; i<arr->num; i++) freeFunc(arr->arr[i]);
 }
 
+void
+cpArrayFreeEachBuffer(cpArray *arr)
+{
+	for(int i=0; i<arr->num; i++) cpAllocatorFree(arr->allocator, arr->arr[i]);
+}
+
 cpBool
 cpArrayContains(cpArray *arr, void *ptr)
 {
@@ -28,6 +28,10 @@ static inline cpSpatialIndexClass *Klass();
 
 typedef struct Node Node;
 typedef struct Pair Pair;
+typedef struct LeafRef LeafRef;
+typedef struct PartitionLeaf PartitionLeaf;
+typedef struct BatchQuery BatchQuery;
+typedef struct BatchNode BatchNode;
 
 struct cpBBTree {
 	cpSpatialIndex spatialIndex;
@@ -37,10 +41,37 @@ struct cpBBTree {
 	Node *root;
 	
 	Node *pooledNodes;
-	Pair *pooledPairs;
 	cpArray *allocatedBuffers;
 	
 	cpTimestamp stamp;
+	
+	// Leaves are numbered so that pairs can refer to them compactly.
+	// A static tree uses the leaf ids of its dynamic tree.
+	LeafRef *leafRefs;
+	unsigned int *freeLeafIds;
+	int leafRefCount, freeLeafIdCount, leafRefMax;
+	
+	// Cached pairs of overlapping leaves. A static tree's pairs are stored in its dynamic tree.
+	Pair *pairs;
+	int pairCount, pairMax;
+	
+	// Leaves moved by the current reindex.
+	cpArray *movedLeaves;
+	
+	// Refit mode, see cpBBTreeSetRefitThreshold().
+	cpFloat refitThreshold;
+	cpFloat builtCost;
+	
+	// Scratch space for building the tree top down.
+	PartitionLeaf *buildLeaves;
+	int buildLeavesMax;
+	
+	// Scratch space for cpBBTreeQueryBatch(), a small tree built over the query boxes in Morton order.
+	BatchQuery *batchQueries;
+	BatchNode *batchNodes;
+	unsigned int *batchKeys, *batchTempKeys;
+	int *batchValues, *batchTempValues;
+	int batchMax;
 };
 
 struct Node {
@@ -54,8 +85,7 @@ struct Node {
 		
 		// Leaves
 		struct {
-			cpTimestamp stamp;
-			Pair *pairs;
+			unsigned int id;
 		} leaf;
 	} node;
 };
@@ -63,20 +93,39 @@ struct Node {
 // Can't use anonymous unions and still get good x-compiler compatability
 #define A node.children.a
 #define B node.children.b
-#define STAMP node.leaf.stamp
-#define PAIRS node.leaf.pairs
+#define LEAF_ID node.leaf.id
 
-typedef struct Thread {
-	Pair *prev;
-	Node *leaf;
-	Pair *next;
-} Thread;
+// Leaf data indexed by leaf id.
+// The stamp is the last time the leaf was inserted or moved. Pairs created before then are stale.
+struct LeafRef {
+	void *obj;
+	cpTimestamp stamp;
+};
 
 struct Pair {
-	Thread a, b;
+	unsigned int a, b;
+	cpTimestamp stamp;
 	cpCollisionID id;
 };
 
+// Leaves are copied into an array along with their bounding boxes while building.
+// Partitioning the array in place then doesn't need to chase pointers to the nodes.
+struct PartitionLeaf {
+	cpBB bb;
+	Node *node;
+};
+
+struct BatchQuery {
+	cpBB bb;
+	void *obj;
+};
+
+// Internal nodes store the indexes of their children in a and b. Leaves store -1 and the index of their query.
+struct BatchNode {
+	cpBB bb;
+	int a, b;
+};
+
 //MARK: Misc Functions
 
 static inline cpBB
@@ -126,100 +175,105 @@ IncrementStamp(cpBBTree *tree)
 	}
 }
 
-//MARK: Pair/Thread Functions
+//MARK: Leaf Id Functions
 
-static void
-PairRecycle(cpBBTree *tree, Pair *pair)
+static unsigned int
+LeafIdNew(cpBBTree *tree, void *obj)
 {
-	// Share the pool of the master tree.
-	// TODO: would be lovely to move the pairs stuff into an external data structure.
 	tree = GetMasterTree(tree);
 	
-	pair->a.next = tree->pooledPairs;
-	tree->pooledPairs = pair;
+	unsigned int id;
+	if(tree->freeLeafIdCount > 0){
+		id = tree->freeLeafIds[--tree->freeLeafIdCount];
+	} else {
+		if(tree->leafRefCount == tree->leafRefMax){
+			const cpAllocator *allocator = tree->spatialIndex.allocator;
+			tree->leafRefMax = (tree->leafRefMax ? 2*tree->leafRefMax : 64);
+			tree->leafRefs = (LeafRef *)cpAllocatorRealloc(allocator, tree->leafRefs, tree->leafRefMax*sizeof(LeafRef));
+			tree->freeLeafIds = (unsigned int *)cpAllocatorRealloc(allocator, tree->freeLeafIds, tree->leafRefMax*sizeof(unsigned int));
+		}
+		
+		id = tree->leafRefCount++;
+	}
+	
+	tree->leafRefs[id].obj = obj;
+	tree->leafRefs[id].stamp = tree->stamp;
+	return id;
 }
 
-static Pair *
-PairFromPool(cpBBTree *tree)
+static void
+LeafIdFree(cpBBTree *tree, unsigned int id)
 {
-	// Share the pool of the master tree.
-	// TODO: would be lovely to move the pairs stuff into an external data structure.
 	tree = GetMasterTree(tree);
 	
-	Pair *pair = tree->pooledPairs;
-	
-	if(pair){
-		tree->pooledPairs = pair->a.next;
-		return pair;
-	} else {
-		// Pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(Pair);
-		cpAssertHard(count, "Internal Error: Buffer size is too small.");
-		
-		Pair *buffer = (Pair *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(tree->allocatedBuffers, buffer);
-		
-		// push all but the first one, return the first instead
-		for(int i=1; i<count; i++) PairRecycle(tree, buffer + i);
-		return buffer;
-	}
+	// Any pairs still referring to the id are stale once the object is cleared.
+	// When the id is reused, the new leaf's stamp keeps them stale.
+	tree->leafRefs[id].obj = NULL;
+	tree->freeLeafIds[tree->freeLeafIdCount++] = id;
+}
+
+static inline cpTimestamp
+LeafStamp(cpBBTree *tree, Node *leaf)
+{
+	return GetMasterTree(tree)->leafRefs[leaf->LEAF_ID].stamp;
 }
 
 static inline void
-ThreadUnlink(Thread thread)
+LeafSetStamp(cpBBTree *tree, Node *leaf)
 {
-	Pair *next = thread.next;
-	Pair *prev = thread.prev;
-	
-	if(next){
-		if(next->a.leaf == thread.leaf) next->a.prev = prev; else next->b.prev = prev;
-	}
-	
-	if(prev){
-		if(prev->a.leaf == thread.leaf) prev->a.next = next; else prev->b.next = next;
-	} else {
-		thread.leaf->PAIRS = next;
-	}
+	cpBBTree *master = GetMasterTree(tree);
+	master->leafRefs[leaf->LEAF_ID].stamp = master->stamp;
 }
 
+//MARK: Pair Functions
+
+static inline cpBool
+PairIsStale(Pair pair, LeafRef *leafRefs)
+{
+	LeafRef a = leafRefs[pair.a], b = leafRefs[pair.b];
+	return (a.obj == NULL || b.obj == NULL || a.stamp > pair.stamp || b.stamp > pair.stamp);
+}
+
+// Remove stale pairs. When 'func' is not NULL, the remaining pairs are passed to it as well.
+// Pairs are never removed individually. Moving or removing a leaf just makes its pairs stale.
+// NOTE: Pairs are reported in the order they were cached, not in tree order like the old per leaf pair lists.
+// The space creates and solves arbiters in the order it gets the pairs, so simulations differ from older versions.
 static void
-PairsClear(Node *leaf, cpBBTree *tree)
+PairsFilter(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
 {
-	Pair *pair = leaf->PAIRS;
-	leaf->PAIRS = NULL;
+	Pair *pairs = tree->pairs;
+	LeafRef *leafRefs = tree->leafRefs;
 	
-	while(pair){
-		if(pair->a.leaf == leaf){
-			Pair *next = pair->a.next;
-			ThreadUnlink(pair->b);
-			PairRecycle(tree, pair);
-			pair = next;
-		} else {
-			Pair *next = pair->b.next;
-			ThreadUnlink(pair->a);
-			PairRecycle(tree, pair);
-			pair = next;
-		}
+	int count = 0;
+	for(int i=0; i<tree->pairCount; i++){
+		Pair pair = pairs[i];
+		if(PairIsStale(pair, leafRefs)) continue;
+		
+		if(func) pair.id = func(leafRefs[pair.a].obj, leafRefs[pair.b].obj, pair.id, data);
+		pairs[count++] = pair;
 	}
+	
+	tree->pairCount = count;
 }
 
 static void
 PairInsert(Node *a, Node *b, cpBBTree *tree)
 {
-	Pair *nextA = a->PAIRS, *nextB = b->PAIRS;
-	Pair *pair = PairFromPool(tree);
-	Pair temp = {{NULL, a, nextA},{NULL, b, nextB}, 0};
-	
-	a->PAIRS = b->PAIRS = pair;
-	*pair = temp;
+	// Share the pairs of the master tree.
+	tree = GetMasterTree(tree);
 	
-	if(nextA){
-		if(nextA->a.leaf == a) nextA->a.prev = pair; else nextA->b.prev = pair;
+	if(tree->pairCount == tree->pairMax){
+		// Clear out the stale pairs first, and only grow if that didn't make enough room.
+		PairsFilter(tree, NULL, NULL);
+		
+		if(tree->pairCount >= tree->pairMax/2){
+			tree->pairMax = (tree->pairMax ? 2*tree->pairMax : 64);
+			tree->pairs = (Pair *)cpAllocatorRealloc(tree->spatialIndex.allocator, tree->pairs, tree->pairMax*sizeof(Pair));
+		}
 	}
 	
-	if(nextB){
-		if(nextB->a.leaf == b) nextB->a.prev = pair; else nextB->b.prev = pair;
-	}
+	Pair pair = {a->LEAF_ID, b->LEAF_ID, tree->stamp, 0};
+	tree->pairs[tree->pairCount++] = pair;
 }
 
 
@@ -245,7 +299,7 @@ NodeFromPool(cpBBTree *tree)
 		int count = CP_BUFFER_BYTES/sizeof(Node);
 		cpAssertHard(count, "Internal Error: Buffer size is too small.");
 		
-		Node *buffer = (Node *)cpcalloc(1, CP_BUFFER_BYTES);
+		Node *buffer = (Node *)cpAllocatorCalloc(tree->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(tree->allocatedBuffers, buffer);
 		
 		// push all but the first one, return the first instead
@@ -415,67 +469,48 @@ SubtreeRemove(Node *subtree, Node *leaf, cpBBTree *tree)
 
 //MARK: Marking Functions
 
-typedef struct MarkContext {
-	cpBBTree *tree;
-	Node *staticRoot;
-	cpSpatialIndexQueryFunc func;
-	void *data;
-} MarkContext;
-
 static void
-MarkLeafQuery(Node *subtree, Node *leaf, cpBool left, MarkContext *context)
+MarkLeafQuery(Node *subtree, Node *leaf, cpBool left, cpBBTree *tree)
 {
 	if(cpBBIntersects(leaf->bb, subtree->bb)){
 		if(NodeIsLeaf(subtree)){
 			if(left){
-				PairInsert(leaf, subtree, context->tree);
+				PairInsert(leaf, subtree, tree);
 			} else {
-				if(subtree->STAMP < leaf->STAMP) PairInsert(subtree, leaf, context->tree);
-				context->func(leaf->obj, subtree->obj, 0, context->data);
+				// If both leaves moved, the pair is added when marking the other one.
+				if(LeafStamp(tree, subtree) < LeafStamp(tree, leaf)) PairInsert(subtree, leaf, tree);
 			}
 		} else {
-			MarkLeafQuery(subtree->A, leaf, left, context);
-			MarkLeafQuery(subtree->B, leaf, left, context);
+			MarkLeafQuery(subtree->A, leaf, left, tree);
+			MarkLeafQuery(subtree->B, leaf, left, tree);
 		}
 	}
 }
 
+// Add the pairs for a leaf that was inserted or moved in the current stamp.
 static void
-MarkLeaf(Node *leaf, MarkContext *context)
+MarkLeaf(Node *leaf, Node *staticRoot, cpBBTree *tree)
 {
-	cpBBTree *tree = context->tree;
-	if(leaf->STAMP == GetMasterTree(tree)->stamp){
-		Node *staticRoot = context->staticRoot;
-		if(staticRoot) MarkLeafQuery(staticRoot, leaf, cpFalse, context);
-		
-		for(Node *node = leaf; node->parent; node = node->parent){
-			if(node == node->parent->A){
-				MarkLeafQuery(node->parent->B, leaf, cpTrue, context);
-			} else {
-				MarkLeafQuery(node->parent->A, leaf, cpFalse, context);
-			}
-		}
-	} else {
-		Pair *pair = leaf->PAIRS;
-		while(pair){
-			if(leaf == pair->b.leaf){
-				pair->id = context->func(pair->a.leaf->obj, leaf->obj, pair->id, context->data);
-				pair = pair->b.next;
-			} else {
-				pair = pair->a.next;
-			}
+	if(staticRoot) MarkLeafQuery(staticRoot, leaf, cpFalse, tree);
+	
+	for(Node *node = leaf; node->parent; node = node->parent){
+		if(node == node->parent->A){
+			MarkLeafQuery(node->parent->B, leaf, cpTrue, tree);
+		} else {
+			MarkLeafQuery(node->parent->A, leaf, cpFalse, tree);
 		}
 	}
 }
 
+// Mark all the leaves that moved in the current stamp, in tree order.
 static void
-MarkSubtree(Node *subtree, MarkContext *context)
+MarkSubtree(Node *subtree, Node *staticRoot, cpBBTree *tree)
 {
 	if(NodeIsLeaf(subtree)){
-		MarkLeaf(subtree, context);
+		if(LeafStamp(tree, subtree) == tree->stamp) MarkLeaf(subtree, staticRoot, tree);
 	} else {
-		MarkSubtree(subtree->A, context);
-		MarkSubtree(subtree->B, context); // TODO: Force TCO here?
+		MarkSubtree(subtree->A, staticRoot, tree);
+		MarkSubtree(subtree->B, staticRoot, tree); // TODO: Force TCO here?
 	}
 }
 
@@ -489,8 +524,7 @@ LeafNew(cpBBTree *tree, void *obj, cpBB bb)
 	node->bb = GetBB(tree, obj);
 	
 	node->parent = NULL;
-	node->STAMP = 0;
-	node->PAIRS = NULL;
+	node->LEAF_ID = LeafIdNew(tree, obj);
 	
 	return node;
 }
@@ -504,11 +538,18 @@ LeafUpdate(Node *leaf, cpBBTree *tree)
 	if(!cpBBContainsBB(leaf->bb, bb)){
 		leaf->bb = GetBB(tree, leaf->obj);
 		
-		root = SubtreeRemove(root, leaf, tree);
-		tree->root = SubtreeInsert(root, leaf, tree);
+		if(tree->refitThreshold > 0.0f){
+			// Leave the leaf where it is and grow its ancestors to fit.
+			for(Node *node = leaf->parent; node && !cpBBContainsBB(node->bb, leaf->bb); node = node->parent){
+				node->bb = cpBBMerge(node->bb, leaf->bb);
+			}
+		} else {
+			root = SubtreeRemove(root, leaf, tree);
+			tree->root = SubtreeInsert(root, leaf, tree);
+		}
 		
-		PairsClear(leaf, tree);
-		leaf->STAMP = GetMasterTree(tree)->stamp;
+		// The old pairs become stale, they are cleared out in bulk by PairsFilter().
+		LeafSetStamp(tree, leaf);
 		
 		return cpTrue;
 	} else {
@@ -524,15 +565,9 @@ LeafAddPairs(Node *leaf, cpBBTree *tree)
 	cpSpatialIndex *dynamicIndex = tree->spatialIndex.dynamicIndex;
 	if(dynamicIndex){
 		Node *dynamicRoot = GetRootIfTree(dynamicIndex);
-		if(dynamicRoot){
-			cpBBTree *dynamicTree = GetTree(dynamicIndex);
-			MarkContext context = {dynamicTree, NULL, NULL, NULL};
-			MarkLeafQuery(dynamicRoot, leaf, cpTrue, &context);
-		}
+		if(dynamicRoot) MarkLeafQuery(dynamicRoot, leaf, cpTrue, GetTree(dynamicIndex));
 	} else {
-		Node *staticRoot = GetRootIfTree(tree->spatialIndex.staticIndex);
-		MarkContext context = {tree, staticRoot, VoidQueryFunc, NULL};
-		MarkLeaf(leaf, &context);
+		MarkLeaf(leaf, GetRootIfTree(tree->spatialIndex.staticIndex), tree);
 	}
 }
 
@@ -556,6 +591,12 @@ leafSetTrans(void *obj, cpBBTree *tree)
 	return LeafNew(tree, obj, tree->spatialIndex.bbfunc(obj));
 }
 
+static void
+LeafRenumber(Node *leaf, cpBBTree *staticTree)
+{
+	leaf->LEAF_ID = LeafIdNew(staticTree, leaf->obj);
+}
+
 cpSpatialIndex *
 cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 {
@@ -563,14 +604,37 @@ cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *static
 	
 	tree->velocityFunc = NULL;
 	
-	tree->leaves = cpHashSetNew(0, (cpHashSetEqlFunc)leafSetEql);
+	tree->leaves = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)leafSetEql, tree->spatialIndex.allocator);
 	tree->root = NULL;
 	
 	tree->pooledNodes = NULL;
-	tree->allocatedBuffers = cpArrayNew(0);
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, tree->spatialIndex.allocator);
 	
 	tree->stamp = 0;
 	
+	tree->leafRefs = NULL;
+	tree->freeLeafIds = NULL;
+	tree->leafRefCount = tree->freeLeafIdCount = tree->leafRefMax = 0;
+	
+	tree->pairs = NULL;
+	tree->pairCount = tree->pairMax = 0;
+	
+	tree->movedLeaves = cpArrayNewWithAllocator(0, tree->spatialIndex.allocator);
+	
+	tree->refitThreshold = 0.0f;
+	tree->builtCost = 0.0f;
+	
+	tree->buildLeaves = NULL;
+	tree->buildLeavesMax = 0;
+	
+	// Leaves already in the static tree were numbered by it. Renumber them using this tree's ids.
+	cpBBTree *staticTree = GetTree(staticIndex);
+	if(staticTree){
+		cpHashSetEach(staticTree->leaves, (cpHashSetIteratorFunc)LeafRenumber, staticTree);
+		staticTree->pairCount = 0;
+		IncrementStamp(tree);
+	}
+	
 	return (cpSpatialIndex *)tree;
 }
 
@@ -591,13 +655,37 @@ cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 	return cpBBTreeInit(cpBBTreeAlloc(), bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the tree's own memory uses it too.
+	cpBBTree *tree = (cpBBTree *)cpAllocatorCalloc(allocator, 1, sizeof(cpBBTree));
+	tree->spatialIndex.allocator = allocator;
+	
+	return cpBBTreeInit(tree, bbfunc, staticIndex);
+}
+
 static void
 cpBBTreeDestroy(cpBBTree *tree)
 {
 	cpHashSetFree(tree->leaves);
 	
-	if(tree->allocatedBuffers) cpArrayFreeEach(tree->allocatedBuffers, cpfree);
+	if(tree->allocatedBuffers) cpArrayFreeEachBuffer(tree->allocatedBuffers);
 	cpArrayFree(tree->allocatedBuffers);
+	
+	cpArrayFree(tree->movedLeaves);
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	cpAllocatorFree(allocator, tree->leafRefs);
+	cpAllocatorFree(allocator, tree->freeLeafIds);
+	cpAllocatorFree(allocator, tree->pairs);
+	cpAllocatorFree(allocator, tree->buildLeaves);
+	cpAllocatorFree(allocator, tree->batchQueries);
+	cpAllocatorFree(allocator, tree->batchNodes);
+	cpAllocatorFree(allocator, tree->batchKeys);
+	cpAllocatorFree(allocator, tree->batchTempKeys);
+	cpAllocatorFree(allocator, tree->batchValues);
+	cpAllocatorFree(allocator, tree->batchTempValues);
 }
 
 //MARK: Insert/Remove
@@ -610,7 +698,7 @@ cpBBTreeInsert(cpBBTree *tree, void *obj, cpHashValue hashid)
 	Node *root = tree->root;
 	tree->root = SubtreeInsert(root, leaf, tree);
 	
-	leaf->STAMP = GetMasterTree(tree)->stamp;
+	LeafSetStamp(tree, leaf);
 	LeafAddPairs(leaf, tree);
 	IncrementStamp(tree);
 }
@@ -621,7 +709,7 @@ cpBBTreeRemove(cpBBTree *tree, void *obj, cpHashValue hashid)
 	Node *leaf = (Node *)cpHashSetRemove(tree->leaves, hashid, obj);
 	
 	tree->root = SubtreeRemove(tree->root, leaf, tree);
-	PairsClear(leaf, tree);
+	LeafIdFree(tree, leaf->LEAF_ID);
 	NodeRecycle(tree, leaf);
 }
 
@@ -633,7 +721,49 @@ cpBBTreeContains(cpBBTree *tree, void *obj, cpHashValue hashid)
 
 //MARK: Reindex
 
-static void LeafUpdateWrap(Node *leaf, cpBBTree *tree) {LeafUpdate(leaf, tree);}
+static void
+LeafUpdateWrap(Node *leaf, cpBBTree *tree)
+{
+	if(LeafUpdate(leaf, tree)) cpArrayPush(tree->movedLeaves, leaf);
+}
+
+static void TreeRebuild(cpBBTree *tree);
+
+static inline cpFloat
+BBPerimeter(cpBB bb)
+{
+	return (bb.r - bb.l) + (bb.t - bb.b);
+}
+
+// Recalculate the BBs of the internal nodes from the leaves up.
+// Returns the sum of the internal node perimeters, the surface area heuristic cost of the tree.
+static cpFloat
+SubtreeRefit(Node *node)
+{
+	if(NodeIsLeaf(node)) return 0.0f;
+	
+	cpFloat cost = SubtreeRefit(node->A) + SubtreeRefit(node->B);
+	node->bb = cpBBMerge(node->A->bb, node->B->bb);
+	return cost + BBPerimeter(node->bb);
+}
+
+// Tree cost relative to the size of the root so that the whole scene growing or shrinking doesn't count.
+static cpFloat
+TreeCost(cpBBTree *tree)
+{
+	Node *root = tree->root;
+	if(!root || NodeIsLeaf(root)) return 0.0f;
+	
+	cpFloat cost = SubtreeRefit(root);
+	cpFloat perimeter = BBPerimeter(root->bb);
+	return (perimeter > 0.0f ? cost/perimeter : 0.0f);
+}
+
+static void
+TreeRefit(cpBBTree *tree)
+{
+	if(TreeCost(tree) > tree->refitThreshold*tree->builtCost) TreeRebuild(tree);
+}
 
 static void
 cpBBTreeReindexQuery(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
@@ -641,15 +771,30 @@ cpBBTreeReindexQuery(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
 	if(!tree->root) return;
 	
 	// LeafUpdate() may modify tree->root. Don't cache it.
+	cpArray *moved = tree->movedLeaves;
 	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)LeafUpdateWrap, tree);
+	if(tree->refitThreshold > 0.0f) TreeRefit(tree);
 	
-	cpSpatialIndex *staticIndex = tree->spatialIndex.staticIndex;
-	Node *staticRoot = (staticIndex && staticIndex->klass == Klass() ? ((cpBBTree *)staticIndex)->root : NULL);
-	
-	MarkContext context = {tree, staticRoot, func, data};
-	MarkSubtree(tree->root, &context);
-	if(staticIndex && !staticRoot) cpSpatialIndexCollideStatic((cpSpatialIndex *)tree, staticIndex, func, data);
+	if(GetMasterTree(tree) != tree){
+		// A static tree's pairs are kept by its dynamic tree, only update the pairs of the moved leaves.
+		for(int i=0; i<moved->num; i++) LeafAddPairs((Node *)moved->arr[i], tree);
+	} else {
+		cpSpatialIndex *staticIndex = tree->spatialIndex.staticIndex;
+		Node *staticRoot = GetRootIfTree(staticIndex);
+		
+		// Only the moved leaves need new pairs, the cached pairs of the others are still valid.
+		// Walking the tree is faster than the moved list once most of the leaves have moved.
+		if(2*moved->num > cpHashSetCount(tree->leaves)){
+			MarkSubtree(tree->root, staticRoot, tree);
+		} else {
+			for(int i=0; i<moved->num; i++) MarkLeaf((Node *)moved->arr[i], staticRoot, tree);
+		}
+		PairsFilter(tree, func, data);
+		
+		if(staticIndex && !staticRoot) cpSpatialIndexCollideStatic((cpSpatialIndex *)tree, staticIndex, func, data);
+	}
 	
+	moved->num = 0;
 	IncrementStamp(tree);
 }
 
@@ -684,6 +829,164 @@ cpBBTreeQuery(cpBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func,
 	if(tree->root) SubtreeQuery(tree->root, obj, bb, func, data);
 }
 
+// Sort the 32 bit Morton codes of the queries 8 bits at a time.
+#define BATCH_RADIX_BITS 8
+#define BATCH_RADIX_BUCKETS (1<<BATCH_RADIX_BITS)
+
+// Spread the bits of a 16 bit number out into the even bits.
+static inline unsigned int
+SpreadBits(unsigned int x)
+{
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+static inline unsigned int
+Quantize(cpFloat value, cpFloat origin, cpFloat scale)
+{
+	cpFloat q = (value - origin)*scale;
+	return (q > 0.0f ? (q < 65535.0f ? (unsigned int)q : 65535u) : 0u);
+}
+
+static void
+BatchReserve(cpBBTree *tree, int count)
+{
+	if(tree->batchMax >= count) return;
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->batchMax = count;
+	
+	cpAllocatorFree(allocator, tree->batchQueries);
+	cpAllocatorFree(allocator, tree->batchNodes);
+	cpAllocatorFree(allocator, tree->batchKeys);
+	cpAllocatorFree(allocator, tree->batchTempKeys);
+	cpAllocatorFree(allocator, tree->batchValues);
+	cpAllocatorFree(allocator, tree->batchTempValues);
+	
+	// Pairing up the nodes of each level carries an odd one up unchanged, which costs at most one extra node per level.
+	tree->batchQueries = (BatchQuery *)cpAllocatorCalloc(allocator, count, sizeof(BatchQuery));
+	tree->batchNodes = (BatchNode *)cpAllocatorCalloc(allocator, 2*count + 32, sizeof(BatchNode));
+	tree->batchKeys = (unsigned int *)cpAllocatorCalloc(allocator, count, sizeof(unsigned int));
+	tree->batchTempKeys = (unsigned int *)cpAllocatorCalloc(allocator, count, sizeof(unsigned int));
+	tree->batchValues = (int *)cpAllocatorCalloc(allocator, count, sizeof(int));
+	tree->batchTempValues = (int *)cpAllocatorCalloc(allocator, count, sizeof(int));
+}
+
+// Copy the queries into the scratch array sorted along a Morton curve through their centers.
+static void
+BatchSort(cpBBTree *tree, void **objs, const cpBB *bbs, int count)
+{
+	cpBB centers = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+	for(int i=0; i<count; i++) centers = cpBBExpand(centers, cpBBCenter(bbs[i]));
+	
+	cpFloat width = centers.r - centers.l, height = centers.t - centers.b;
+	cpFloat scaleX = (width > 0.0f ? 65535.0f/width : 0.0f);
+	cpFloat scaleY = (height > 0.0f ? 65535.0f/height : 0.0f);
+	
+	unsigned int *keys = tree->batchKeys, *tempKeys = tree->batchTempKeys;
+	int *values = tree->batchValues, *tempValues = tree->batchTempValues;
+	for(int i=0; i<count; i++){
+		cpVect center = cpBBCenter(bbs[i]);
+		keys[i] = SpreadBits(Quantize(center.x, centers.l, scaleX)) | (SpreadBits(Quantize(center.y, centers.b, scaleY)) << 1);
+		values[i] = i;
+	}
+	
+	for(int shift=0; shift<32; shift += BATCH_RADIX_BITS){
+		int buckets[BATCH_RADIX_BUCKETS] = {0};
+		for(int i=0; i<count; i++) buckets[(keys[i] >> shift) & (BATCH_RADIX_BUCKETS - 1)]++;
+		
+		int offset = 0;
+		for(int bucket=0; bucket<BATCH_RADIX_BUCKETS; bucket++){
+			int n = buckets[bucket];
+			buckets[bucket] = offset;
+			offset += n;
+		}
+		
+		for(int i=0; i<count; i++){
+			int dst = buckets[(keys[i] >> shift) & (BATCH_RADIX_BUCKETS - 1)]++;
+			tempKeys[dst] = keys[i];
+			tempValues[dst] = values[i];
+		}
+		
+		unsigned int *swapKeys = keys; keys = tempKeys; tempKeys = swapKeys;
+		int *swapValues = values; values = tempValues; tempValues = swapValues;
+	}
+	
+	for(int i=0; i<count; i++){
+		int j = values[i];
+		BatchQuery query = {bbs[j], objs[j]};
+		tree->batchQueries[i] = query;
+	}
+}
+
+// Build the query tree bottom up by pairing neighbors in Morton order one level at a time. Returns the root's index.
+static int
+BatchBuild(cpBBTree *tree, int count)
+{
+	BatchNode *nodes = tree->batchNodes;
+	for(int i=0; i<count; i++){
+		BatchNode leaf = {tree->batchQueries[i].bb, -1, i};
+		nodes[i] = leaf;
+	}
+	
+	int begin = 0, end = count;
+	while(end - begin > 1){
+		int next = end;
+		for(int i=begin; i<end; i += 2){
+			if(i + 1 < end){
+				BatchNode node = {cpBBMerge(nodes[i].bb, nodes[i + 1].bb), i, i + 1};
+				nodes[next++] = node;
+			} else {
+				nodes[next++] = nodes[i];
+			}
+		}
+		
+		begin = end;
+		end = next;
+	}
+	
+	return begin;
+}
+
+// Walk the tree and the query tree together, splitting whichever node is bigger.
+// Subtrees of queries that miss a node are skipped all at once instead of each query descending from the root.
+static void
+BatchCollide(cpBBTree *tree, Node *subtree, int batchIndex, cpSpatialIndexQueryFunc func, void *data)
+{
+	const BatchNode *batch = tree->batchNodes + batchIndex;
+	if(!cpBBIntersects(subtree->bb, batch->bb)) return;
+	
+	cpBool batchLeaf = (batch->a < 0);
+	if(NodeIsLeaf(subtree)){
+		if(batchLeaf){
+			func(tree->batchQueries[batch->b].obj, subtree->obj, 0, data);
+		} else {
+			BatchCollide(tree, subtree, batch->a, func, data);
+			BatchCollide(tree, subtree, batch->b, func, data);
+		}
+	} else if(batchLeaf || BBPerimeter(subtree->bb) > BBPerimeter(batch->bb)){
+		BatchCollide(tree, subtree->A, batchIndex, func, data);
+		BatchCollide(tree, subtree->B, batchIndex, func, data);
+	} else {
+		BatchCollide(tree, subtree, batch->a, func, data);
+		BatchCollide(tree, subtree, batch->b, func, data);
+	}
+}
+
+static void
+cpBBTreeQueryBatch(cpBBTree *tree, void **objs, const cpBB *bbs, int count, cpSpatialIndexQueryFunc func, void *data)
+{
+	if(!tree->root || count == 0) return;
+	
+	BatchReserve(tree, count);
+	BatchSort(tree, objs, bbs, count);
+	BatchCollide(tree, tree->root, BatchBuild(tree, count), func, data);
+}
+
 //MARK: Misc
 
 static int
@@ -706,6 +1009,116 @@ cpBBTreeEach(cpBBTree *tree, cpSpatialIndexIteratorFunc func, void *data)
 	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)each_helper, &context);
 }
 
+//MARK: Memory Trimming
+
+// Copy a subtree into nodes from the pool.
+// Old leaves are left with a forwarding pointer to their copy in 'parent'.
+static Node *
+SubtreeMove(cpBBTree *tree, Node *node, Node *parent)
+{
+	Node *copy = NodeFromPool(tree);
+	(*copy) = (*node);
+	copy->parent = parent;
+	
+	if(NodeIsLeaf(node)){
+		node->parent = copy;
+	} else {
+		copy->A = SubtreeMove(tree, node->A, copy);
+		copy->B = SubtreeMove(tree, node->B, copy);
+	}
+	
+	return copy;
+}
+
+static void *LeafForward(Node *leaf, void *unused){return leaf->parent;}
+
+static size_t
+cpBBTreeTrim(cpBBTree *tree, size_t keepBytes)
+{
+	cpArray *buffers = tree->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, tree->spatialIndex.allocator);
+	tree->pooledNodes = NULL;
+	
+	if(tree->root) tree->root = SubtreeMove(tree, tree->root, NULL);
+	size_t freed = cpHashSetTrim(tree->leaves, (cpHashSetRemapFunc)LeafForward, NULL, keepBytes);
+	
+	// Drop the stale pairs and shrink the pair array to fit the rest.
+	PairsFilter(tree, NULL, NULL);
+	size_t pairBytes = (tree->pairMax - tree->pairCount)*sizeof(Pair);
+	if(pairBytes > keepBytes){
+		const cpAllocator *allocator = tree->spatialIndex.allocator;
+		tree->pairMax = tree->pairCount;
+		
+		if(tree->pairCount > 0){
+			tree->pairs = (Pair *)cpAllocatorRealloc(allocator, tree->pairs, tree->pairMax*sizeof(Pair));
+		} else {
+			cpAllocatorFree(allocator, tree->pairs);
+			tree->pairs = NULL;
+		}
+		
+		freed += pairBytes;
+	}
+	
+	cpArray *moved = tree->movedLeaves;
+	size_t movedBytes = moved->max*sizeof(void *);
+	if(movedBytes > keepBytes){
+		cpArrayFree(moved);
+		tree->movedLeaves = cpArrayNewWithAllocator(0, tree->spatialIndex.allocator);
+		freed += movedBytes;
+	}
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		Node *buffer = (Node *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(tree->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(Node);
+			for(int j=0; j<count; j++) NodeRecycle(tree, buffer + j);
+		} else {
+			cpAllocatorFree(tree->spatialIndex.allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = tree->allocatedBuffers->num*CP_BUFFER_BYTES;
+	freed += (before > after ? before - after : 0);
+	
+	size_t scratchBytes = tree->buildLeavesMax*sizeof(PartitionLeaf);
+	if(scratchBytes > keepBytes){
+		cpAllocatorFree(tree->spatialIndex.allocator, tree->buildLeaves);
+		tree->buildLeaves = NULL;
+		tree->buildLeavesMax = 0;
+		freed += scratchBytes;
+	}
+	
+	size_t batchBytes = tree->batchMax*(sizeof(BatchQuery) + 2*sizeof(BatchNode) + 2*sizeof(unsigned int) + 2*sizeof(int));
+	if(batchBytes > keepBytes){
+		const cpAllocator *allocator = tree->spatialIndex.allocator;
+		cpAllocatorFree(allocator, tree->batchQueries);
+		cpAllocatorFree(allocator, tree->batchNodes);
+		cpAllocatorFree(allocator, tree->batchKeys);
+		cpAllocatorFree(allocator, tree->batchTempKeys);
+		cpAllocatorFree(allocator, tree->batchValues);
+		cpAllocatorFree(allocator, tree->batchTempValues);
+		
+		tree->batchQueries = NULL;
+		tree->batchNodes = NULL;
+		tree->batchKeys = tree->batchTempKeys = NULL;
+		tree->batchValues = tree->batchTempValues = NULL;
+		tree->batchMax = 0;
+		freed += batchBytes;
+	}
+	
+	return freed;
+}
+
+static void cpBBTreeInsertBatch(cpBBTree *tree, void **objs, const cpHashValue *hashids, int count);
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpBBTreeDestroy,
 	
@@ -722,6 +1135,10 @@ static cpSpatialIndexClass klass = {
 	
 	(cpSpatialIndexQueryImpl)cpBBTreeQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpBBTreeSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpBBTreeTrim,
+	(cpSpatialIndexInsertBatchImpl)cpBBTreeInsertBatch,
+	(cpSpatialIndexQueryBatchImpl)cpBBTreeQueryBatch,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -729,82 +1146,157 @@ static inline cpSpatialIndexClass *Klass(){return &klass;}
 
 //MARK: Tree Optimization
 
-static int
-cpfcompare(const cpFloat *a, const cpFloat *b){
-	return (*a < *b ? -1 : (*b < *a ? 1 : 0));
-}
-
 static void
-fillNodeArray(Node *node, Node ***cursor){
-	(**cursor) = node;
+fillLeafArray(Node *node, PartitionLeaf **cursor){
+	(*cursor)->bb = node->bb;
+	(*cursor)->node = node;
 	(*cursor)++;
 }
 
+// Returns the tree's scratch array with room for at least 'count' leaves.
+static PartitionLeaf *
+BuildLeaves(cpBBTree *tree, int count)
+{
+	if(tree->buildLeavesMax < count){
+		tree->buildLeavesMax = count;
+		
+		cpAllocatorFree(tree->spatialIndex.allocator, tree->buildLeaves);
+		tree->buildLeaves = (PartitionLeaf *)cpAllocatorCalloc(tree->spatialIndex.allocator, count, sizeof(PartitionLeaf));
+	}
+	
+	return tree->buildLeaves;
+}
+
+#define BIN_COUNT 16
+
+typedef struct Bin {
+	cpBB bb;
+	int count;
+} Bin;
+
+static inline cpFloat
+LeafCenter(const PartitionLeaf *leaf, int axis)
+{
+	return (axis == 0 ? leaf->bb.l + leaf->bb.r : leaf->bb.b + leaf->bb.t);
+}
+
+static inline int
+LeafBin(const PartitionLeaf *leaf, int axis, cpFloat min, cpFloat scale)
+{
+	int bin = (int)((LeafCenter(leaf, axis) - min)*scale);
+	return (bin < BIN_COUNT - 1 ? bin : BIN_COUNT - 1);
+}
+
+// Build the tree top down using a binned surface area heuristic.
+// In 2D the "surface area" of a box is its perimeter.
 static Node *
-partitionNodes(cpBBTree *tree, Node **nodes, int count)
+partitionNodes(cpBBTree *tree, PartitionLeaf *leaves, int count)
 {
 	if(count == 1){
-		return nodes[0];
+		return leaves[0].node;
 	} else if(count == 2) {
-		return NodeNew(tree, nodes[0], nodes[1]);
+		return NodeNew(tree, leaves[0].node, leaves[1].node);
 	}
 	
-	// Find the AABB for these nodes
-	cpBB bb = nodes[0]->bb;
-	for(int i=1; i<count; i++) bb = cpBBMerge(bb, nodes[i]->bb);
+	// Find the range of the leaf centers. (Doubled, but only relative positions matter.)
+	cpFloat mins[2] = {LeafCenter(leaves, 0), LeafCenter(leaves, 1)};
+	cpFloat maxs[2] = {mins[0], mins[1]};
+	for(int i=1; i<count; i++){
+		for(int axis=0; axis<2; axis++){
+			cpFloat c = LeafCenter(leaves + i, axis);
+			mins[axis] = cpfmin(mins[axis], c);
+			maxs[axis] = cpfmax(maxs[axis], c);
+		}
+	}
 	
-	// Split it on it's longest axis
-	cpBool splitWidth = (bb.r - bb.l > bb.t - bb.b);
+	int bestAxis = -1, bestBin = 0;
+	cpFloat bestCost = INFINITY, bestScale = 0.0f;
 	
-	// Sort the bounds and use the median as the splitting point
-	cpFloat *bounds = (cpFloat *)cpcalloc(count*2, sizeof(cpFloat));
-	if(splitWidth){
+	for(int axis=0; axis<2; axis++){
+		cpFloat extent = maxs[axis] - mins[axis];
+		if(extent <= 0.0f) continue;
+		
+		cpFloat scale = BIN_COUNT/extent;
+		Bin bins[BIN_COUNT];
+		for(int i=0; i<BIN_COUNT; i++) bins[i].count = 0;
+		
 		for(int i=0; i<count; i++){
-			bounds[2*i + 0] = nodes[i]->bb.l;
-			bounds[2*i + 1] = nodes[i]->bb.r;
+			Bin *bin = bins + LeafBin(leaves + i, axis, mins[axis], scale);
+			bin->bb = (bin->count ? cpBBMerge(bin->bb, leaves[i].bb) : leaves[i].bb);
+			bin->count++;
 		}
-	} else {
-		for(int i=0; i<count; i++){
-			bounds[2*i + 0] = nodes[i]->bb.b;
-			bounds[2*i + 1] = nodes[i]->bb.t;
+		
+		// Sweep from the right to find the cost of everything right of each split.
+		cpFloat rightCosts[BIN_COUNT];
+		cpBB bb = bins[BIN_COUNT - 1].bb;
+		int n = 0;
+		for(int i=BIN_COUNT - 1; i>0; i--){
+			if(bins[i].count){
+				bb = (n ? cpBBMerge(bb, bins[i].bb) : bins[i].bb);
+				n += bins[i].count;
+			}
+			
+			rightCosts[i] = (n ? n*BBPerimeter(bb) : INFINITY);
 		}
-	}
-	
-	qsort(bounds, count*2, sizeof(cpFloat), (int (*)(const void *, const void *))cpfcompare);
-	cpFloat split = (bounds[count - 1] + bounds[count])*0.5f; // use the medain as the split
-	cpfree(bounds);
-
-	// Generate the child BBs
-	cpBB a = bb, b = bb;
-	if(splitWidth) a.r = b.l = split; else a.t = b.b = split;
-	
-	// Partition the nodes
-	int right = count;
-	for(int left=0; left < right;){
-		Node *node = nodes[left];
-		if(cpBBMergedArea(node->bb, b) < cpBBMergedArea(node->bb, a)){
-//		if(cpBBProximity(node->bb, b) < cpBBProximity(node->bb, a)){
-			right--;
-			nodes[left] = nodes[right];
-			nodes[right] = node;
-		} else {
-			left++;
+		
+		// Then sweep from the left to find the cheapest split.
+		n = 0;
+		for(int i=0; i<BIN_COUNT - 1; i++){
+			if(bins[i].count){
+				bb = (n ? cpBBMerge(bb, bins[i].bb) : bins[i].bb);
+				n += bins[i].count;
+			}
+			
+			cpFloat cost = (n ? n*BBPerimeter(bb) + rightCosts[i + 1] : INFINITY);
+			if(cost < bestCost){
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+				bestScale = scale;
+			}
 		}
 	}
 	
-	if(right == count){
-		Node *node = NULL;
-		for(int i=0; i<count; i++) node = SubtreeInsert(node, nodes[i], tree);
-		return node;
+	int right = count/2;
+	if(bestAxis >= 0){
+		// Partition the nodes
+		right = count;
+		for(int left=0; left < right;){
+			if(LeafBin(leaves + left, bestAxis, mins[bestAxis], bestScale) > bestBin){
+				right--;
+				PartitionLeaf leaf = leaves[left];
+				leaves[left] = leaves[right];
+				leaves[right] = leaf;
+			} else {
+				left++;
+			}
+		}
 	}
+	// Otherwise all of the centers are in the same place, so just split the leaves in half.
 	
 	// Recurse and build the node!
 	return NodeNew(tree,
-		partitionNodes(tree, nodes, right),
-		partitionNodes(tree, nodes + right, count - right)
+		partitionNodes(tree, leaves, right),
+		partitionNodes(tree, leaves + right, count - right)
 	);
 }
 
+static void
+TreeRebuild(cpBBTree *tree)
+{
+	Node *root = tree->root;
+	if(!root) return;
+	
+	int count = cpHashSetCount(tree->leaves);
+	PartitionLeaf *leaves = BuildLeaves(tree, count);
+	PartitionLeaf *cursor = leaves;
+	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillLeafArray, &cursor);
+	
+	SubtreeRecycle(tree, root);
+	tree->root = partitionNodes(tree, leaves, count);
+	tree->builtCost = TreeCost(tree);
+}
+
 //static void
 //cpBBTreeOptimizeIncremental(cpBBTree *tree, int passes)
 //{
@@ -832,19 +1324,73 @@ cpBBTreeOptimize(cpSpatialIndex *index)
 		return;
 	}
 	
+	TreeRebuild((cpBBTree *)index);
+}
+
+void
+cpBBTreeSetRefitThreshold(cpSpatialIndex *index, cpFloat threshold)
+{
+	if(index->klass != &klass){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeSetRefitThreshold() call to non-tree spatial index.");
+		return;
+	}
+	
+	cpAssertHard(threshold == 0.0f || threshold >= 1.0f, "The refit threshold must be 0 or at least 1.");
+	
 	cpBBTree *tree = (cpBBTree *)index;
-	Node *root = tree->root;
-	if(!root) return;
+	tree->refitThreshold = threshold;
 	
-	int count = cpBBTreeCount(tree);
-	Node **nodes = (Node **)cpcalloc(count, sizeof(Node *));
-	Node **cursor = nodes;
+	// Rebuild on the next reindex.
+	tree->builtCost = 0.0f;
+}
+
+cpFloat
+cpBBTreeGetRefitThreshold(cpSpatialIndex *index)
+{
+	if(index->klass != &klass){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeGetRefitThreshold() call to non-tree spatial index.");
+		return 0.0f;
+	}
 	
-	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillNodeArray, &cursor);
+	return ((cpBBTree *)index)->refitThreshold;
+}
+
+static void
+cpBBTreeInsertBatch(cpBBTree *tree, void **objs, const cpHashValue *hashids, int count)
+{
+	int existing = cpHashSetCount(tree->leaves);
 	
-	SubtreeRecycle(tree, root);
-	tree->root = partitionNodes(tree, nodes, count);
-	cpfree(nodes);
+	// Insert the new leaves one at a time if the batch is small compared to the tree.
+	// Otherwise rebuild the whole tree top down, the same way cpBBTreeOptimize() does.
+	cpBool rebuild = (count >= existing);
+	PartitionLeaf *leaves = BuildLeaves(tree, existing + count);
+	PartitionLeaf *cursor = leaves;
+	
+	if(rebuild) cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillLeafArray, &cursor);
+	
+	// The new leaves all share the current stamp so the pairs between them are only added once.
+	// Building the tree reorders the array, so the stamp is also how the new leaves are found again.
+	cpTimestamp stamp = GetMasterTree(tree)->stamp;
+	for(int i=0; i<count; i++){
+		Node *leaf = (Node *)cpHashSetInsert(tree->leaves, hashids[i], objs[i], (cpHashSetTransFunc)leafSetTrans, tree);
+		LeafSetStamp(tree, leaf);
+		fillLeafArray(leaf, &cursor);
+	}
+	
+	int total = (int)(cursor - leaves);
+	if(rebuild){
+		if(tree->root) SubtreeRecycle(tree, tree->root);
+		tree->root = partitionNodes(tree, leaves, total);
+		tree->builtCost = TreeCost(tree);
+	} else {
+		for(int i=0; i<total; i++) tree->root = SubtreeInsert(tree->root, leaves[i].node, tree);
+	}
+	
+	for(int i=0; i<total; i++){
+		Node *leaf = leaves[i].node;
+		if(LeafStamp(tree, leaf) == stamp) LeafAddPairs(leaf, tree);
+	}
+	IncrementStamp(tree);
 }
 
 //MARK: Debug Draw
@@ -45,6 +45,10 @@ cpBodyInit(cpBody *body, cpFloat mass, cpFloat moment)
 	body->sleeping.next = NULL;
 	body->sleeping.idleTime = 0.0f;
 	
+	body->solver.stamp = 0;
+	body->solver.colors = 0;
+	body->solver.index = -1;
+	
 	body->p = cpvzero;
 	body->v = cpvzero;
 	body->f = cpvzero;
@@ -36,10 +36,8 @@
 #define PRINT_LOG 0
 #endif
 
-#define MAX_GJK_ITERATIONS 30
-#define MAX_EPA_ITERATIONS 30
-#define WARN_GJK_ITERATIONS 20
-#define WARN_EPA_ITERATIONS 20
+// Polys with fewer verts than this are always scanned. Walking from a hint only pays off for larger polys.
+#define HILL_CLIMB_MIN_VERTS 8
 
 static inline void
 cpCollisionInfoPushContact(struct cpCollisionInfo *info, cpVect p1, cpVect p2, cpHashValue hash)
@@ -77,6 +75,49 @@ PolySupportPointIndex(const int count, const struct cpSplittingPlane *planes, co
 	return index;
 }
 
+// Find the support point by walking uphill from the vertex at 'hint', usually last frame's or the last iteration's support point.
+// The dot products around a convex poly have a single maximum, so the walk only takes a few steps when the hint is close.
+// A negative hint means there is nothing cached, so the verts are scanned instead.
+static inline int
+PolySupportPointIndexHint(const int count, const struct cpSplittingPlane *planes, const cpVect n, const int hint)
+{
+	if(hint < 0 || hint >= count || count < HILL_CLIMB_MIN_VERTS) return PolySupportPointIndex(count, planes, n);
+	
+	int i = hint;
+	cpFloat d = cpvdot(planes[i].v0, n);
+	
+	int next = (i + 1 < count ? i + 1 : 0);
+	cpFloat d_next = cpvdot(planes[next].v0, n);
+	if(d_next > d){
+		do {
+			i = next, d = d_next;
+			next = (i + 1 < count ? i + 1 : 0);
+			d_next = cpvdot(planes[next].v0, n);
+		} while(d_next > d);
+	} else {
+		int prev = (i > 0 ? i - 1 : count - 1);
+		cpFloat d_prev = cpvdot(planes[prev].v0, n);
+		while(d_prev > d){
+			i = prev, d = d_prev;
+			prev = (i > 0 ? i - 1 : count - 1);
+			d_prev = cpvdot(planes[prev].v0, n);
+		}
+	}
+	
+	// Collinear verts or roundoff on the far side of the poly can stall the walk at a false maximum.
+	// The vertex halfway around is then higher, so fall back to a full scan.
+	int opposite = (i + count/2)%count;
+	if(cpvdot(planes[opposite].v0, n) > d) return PolySupportPointIndex(count, planes, n);
+	
+	// An edge perpendicular to n has two maximal verts. Pick the lower index like the scan does so the results match.
+	int before = (i > 0 ? i - 1 : count - 1);
+	int after = (i + 1 < count ? i + 1 : 0);
+	if(before < i && cpvdot(planes[before].v0, n) == d) return before;
+	if(after < i && cpvdot(planes[after].v0, n) == d) return after;
+	
+	return i;
+}
+
 struct SupportPoint {
 	cpVect p;
 	// Save an index of the point so it can be cheaply looked up as a starting point for the next frame.
@@ -90,16 +131,16 @@ SupportPointNew(cpVect p, cpCollisionID index)
 	return point;
 }
 
-typedef struct SupportPoint (*SupportPointFunc)(const cpShape *shape, const cpVect n);
+typedef struct SupportPoint (*SupportPointFunc)(const cpShape *shape, const cpVect n, const int hint);
 
 static inline struct SupportPoint
-CircleSupportPoint(const cpCircleShape *circle, const cpVect n)
+CircleSupportPoint(const cpCircleShape *circle, const cpVect n, const int hint)
 {
 	return SupportPointNew(circle->tc, 0);
 }
 
 static inline struct SupportPoint
-SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n)
+SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n, const int hint)
 {
 	if(cpvdot(seg->ta, n) > cpvdot(seg->tb, n)){
 		return SupportPointNew(seg->ta, 0);
@@ -109,10 +150,10 @@ SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n)
 }
 
 static inline struct SupportPoint
-PolySupportPoint(const cpPolyShape *poly, const cpVect n)
+PolySupportPoint(const cpPolyShape *poly, const cpVect n, const int hint)
 {
 	const struct cpSplittingPlane *planes = poly->planes;
-	int i = PolySupportPointIndex(poly->count, planes, n);
+	int i = PolySupportPointIndexHint(poly->count, planes, n, hint);
 	return SupportPointNew(planes[i].v0, i);
 }
 
@@ -136,14 +177,48 @@ MinkowskiPointNew(const struct SupportPoint a, const struct SupportPoint b)
 struct SupportContext {
 	const cpShape *shape1, *shape2;
 	SupportPointFunc func1, func2;
+	
+	// Indexes of the last support points, used as the starting point for the next search.
+	int hint1, hint2;
+	
+	// Collision being calculated. GJK and EPA read their budgets from it and flag it when they run out.
+	struct cpCollisionInfo *info;
 };
 
+// Set in a collision ID that holds a cached separating axis instead of GJK support indexes.
+#define SEPARATING_AXIS_FLAG ((cpCollisionID)0x80000000)
+
+// True if a collision ID holds GJK support indexes to warm start from.
+static inline cpBool
+HasSupportIndexes(const cpCollisionID id)
+{
+	return (id != 0 && !(id & SEPARATING_AXIS_FLAG));
+}
+
+// Support point index of a shape cached in a collision ID, or -1 if nothing is cached.
+// 'shift' is 24 for the first shape and 16 for the second.
+static inline int
+SupportHint(const cpCollisionID id, const int shift)
+{
+	return (HasSupportIndexes(id) ? (int)((id>>shift) & 0xFF) : -1);
+}
+
+static inline struct SupportContext
+SupportContextNew(const cpShape *shape1, const cpShape *shape2, SupportPointFunc func1, SupportPointFunc func2, struct cpCollisionInfo *info)
+{
+	struct SupportContext context = {shape1, shape2, func1, func2, SupportHint(info->id, 24), SupportHint(info->id, 16), info};
+	return context;
+}
+
 // Calculate the maximal point on the minkowski difference of two shapes along a particular axis.
 static inline struct MinkowskiPoint
-Support(const struct SupportContext *ctx, const cpVect n)
+Support(struct SupportContext *ctx, const cpVect n)
 {
-	struct SupportPoint a = ctx->func1(ctx->shape1, cpvneg(n));
-	struct SupportPoint b = ctx->func2(ctx->shape2, n);
+	struct SupportPoint a = ctx->func1(ctx->shape1, cpvneg(n), ctx->hint1);
+	struct SupportPoint b = ctx->func2(ctx->shape2, n, ctx->hint2);
+	ctx->hint1 = (int)a.index;
+	ctx->hint2 = (int)b.index;
+	
 	return MinkowskiPointNew(a, b);
 }
 
@@ -161,10 +236,10 @@ struct Edge {
 };
 
 static struct Edge
-SupportEdgeForPoly(const cpPolyShape *poly, const cpVect n)
+SupportEdgeForPoly(const cpPolyShape *poly, const cpVect n, const int hint)
 {
 	int count = poly->count;
-	int i1 = PolySupportPointIndex(poly->count, poly->planes, n);
+	int i1 = PolySupportPointIndexHint(poly->count, poly->planes, n, hint);
 	
 	// TODO: get rid of mod eventually, very expensive on ARM
 	int i0 = (i1 - 1 + count)%count;
@@ -265,48 +340,74 @@ ClosestDist(const cpVect v0,const cpVect v1)
 	return cpvlengthsq(LerpT(v0, v1, ClosestT(v0, v1)));
 }
 
-// Recursive implementation of the EPA loop.
-// Each recursion adds a point to the convex hull until it's known that we have the closest point on the surface.
+// The EPA hull starts as a triangle and gains at most one point per iteration.
+#define EPA_MAX_HULL (CP_MAX_EPA_ITERATIONS + 3)
+
+// Find the closest points on the surface of two overlapping shapes using the EPA algorithm.
+// EPA is called from GJK when two shapes overlap.
+// Each iteration adds a point to the convex hull until it's known that we have the closest point on the surface.
+// This is a moderately expensive step! Avoid it by adding radii to your shapes so their inner polygons won't overlap.
 static struct ClosestPoints
-EPARecurse(const struct SupportContext *ctx, const int count, const struct MinkowskiPoint *hull, const int iteration)
-{
-	int mini = 0;
-	cpFloat minDist = INFINITY;
-	
-	// TODO: precalculate this when building the hull and save a step.
-	// Find the closest segment hull[i] and hull[i + 1] to (0, 0)
-	for(int j=0, i=count-1; j<count; i=j, j++){
-		cpFloat d = ClosestDist(hull[i].ab, hull[j].ab);
-		if(d < minDist){
-			minDist = d;
-			mini = i;
-		}
-	}
-	
-	struct MinkowskiPoint v0 = hull[mini];
-	struct MinkowskiPoint v1 = hull[(mini + 1)%count];
-	cpAssertSoft(!cpveql(v0.ab, v1.ab), "Internal Error: EPA vertexes are the same (%d and %d)", mini, (mini + 1)%count);
+EPA(struct SupportContext *ctx, const struct MinkowskiPoint v0, const struct MinkowskiPoint v1, const struct MinkowskiPoint v2)
+{
+	const struct cpCollisionBudget *budget = ctx->info->budget;
 	
-	// Check if there is a point on the minkowski difference beyond this edge.
-	struct MinkowskiPoint p = Support(ctx, cpvperp(cpvsub(v1.ab, v0.ab)));
+	// The hull is rebuilt from one buffer into the other each iteration.
+	struct MinkowskiPoint buffers[2][EPA_MAX_HULL];
+	struct MinkowskiPoint *hull = buffers[0], *hull2 = buffers[1];
+	int count = 3;
+	hull[0] = v0, hull[1] = v1, hull[2] = v2;
 	
+	for(int iteration=1;; iteration++){
+		int mini = 0;
+		cpFloat minDist = INFINITY;
+		
+		// TODO: precalculate this when building the hull and save a step.
+		// Find the closest segment hull[i] and hull[i + 1] to (0, 0)
+		for(int j=0, i=count-1; j<count; i=j, j++){
+			cpFloat d = ClosestDist(hull[i].ab, hull[j].ab);
+			if(d < minDist){
+				minDist = d;
+				mini = i;
+			}
+		}
+		
+		struct MinkowskiPoint e0 = hull[mini];
+		struct MinkowskiPoint e1 = hull[(mini + 1)%count];
+		cpAssertSoft(!cpveql(e0.ab, e1.ab), "Internal Error: EPA vertexes are the same (%d and %d)", mini, (mini + 1)%count);
+		
+		// Check if there is a point on the minkowski difference beyond this edge.
+		cpVect n = cpvperp(cpvsub(e1.ab, e0.ab));
+		struct MinkowskiPoint p = Support(ctx, n);
+		
 #if DRAW_EPA
-	cpVect verts[count];
-	for(int i=0; i<count; i++) verts[i] = hull[i].ab;
-	
-	ChipmunkDebugDrawPolygon(count, verts, 0.0, RGBAColor(1, 1, 0, 1), RGBAColor(1, 1, 0, 0.25));
-	ChipmunkDebugDrawSegment(v0.ab, v1.ab, RGBAColor(1, 0, 0, 1));
-	
-	ChipmunkDebugDrawDot(5, p.ab, LAColor(1, 1));
+		cpVect verts[count];
+		for(int i=0; i<count; i++) verts[i] = hull[i].ab;
+		
+		ChipmunkDebugDrawPolygon(count, verts, 0.0, RGBAColor(1, 1, 0, 1), RGBAColor(1, 1, 0, 0.25));
+		ChipmunkDebugDrawSegment(e0.ab, e1.ab, RGBAColor(1, 0, 0, 1));
+		
+		ChipmunkDebugDrawDot(5, p.ab, LAColor(1, 1));
 #endif
-	
-	// The usual exit condition is a duplicated vertex.
-	// Much faster to check the ids than to check the signed area.
-	cpBool duplicate = (p.id == v0.id || p.id == v1.id);
-	
-	if(!duplicate && cpCheckPointGreater(v0.ab, v1.ab, p.ab) && iteration < MAX_EPA_ITERATIONS){
+		
+		// The usual exit condition is a duplicated vertex.
+		// Much faster to check the ids than to check the signed area.
+		cpBool duplicate = (p.id == e0.id || p.id == e1.id);
+		if(duplicate || !cpCheckPointGreater(e0.ab, e1.ab, p.ab)){
+			// Could not find a new point to insert, so we have found the closest edge of the minkowski difference.
+			return ClosestPointsNew(e0, e1);
+		}
+		
+		// Stop once p is within the tolerance of the edge, since the penetration is at most that much deeper.
+		cpFloat tolerance = budget->tolerance;
+		if(tolerance > 0.0f && cpvdot(cpvsub(p.ab, e0.ab), n) <= tolerance*cpvlength(n)) return ClosestPointsNew(e0, e1);
+		
+		if(iteration >= budget->epaIterations){
+			ctx->info->exhausted |= CP_EPA_EXHAUSTED;
+			return ClosestPointsNew(e0, e1);
+		}
+		
 		// Rebuild the convex hull by inserting p.
-		struct MinkowskiPoint *hull2 = (struct MinkowskiPoint *)alloca((count + 1)*sizeof(struct MinkowskiPoint));
 		int count2 = 1;
 		hull2[0] = p;
 		
@@ -323,40 +424,41 @@ EPARecurse(const struct SupportContext *ctx, const int count, const struct Minko
 			}
 		}
 		
-		return EPARecurse(ctx, count2, hull2, iteration + 1);
-	} else {
-		// Could not find a new point to insert, so we have found the closest edge of the minkowski difference.
-		cpAssertWarn(iteration < WARN_EPA_ITERATIONS, "High EPA iterations: %d", iteration);
-		return ClosestPointsNew(v0, v1);
+		struct MinkowskiPoint *tmp = hull;
+		hull = hull2, hull2 = tmp;
+		count = count2;
 	}
 }
 
-// Find the closest points on the surface of two overlapping shapes using the EPA algorithm.
-// EPA is called from GJK when two shapes overlap.
-// This is a moderately expensive step! Avoid it by adding radii to your shapes so their inner polygons won't overlap.
-static struct ClosestPoints
-EPA(const struct SupportContext *ctx, const struct MinkowskiPoint v0, const struct MinkowskiPoint v1, const struct MinkowskiPoint v2)
+//MARK: GJK Functions.
+
+// True if an iteration moved the closest point on the edge toward (0, 0) by no more than 'tolerance'.
+// The distances are squared, so a zero tolerance avoids the square roots.
+static inline cpBool
+GJKStalled(const cpFloat prevDistSq, const cpFloat distSq, const cpFloat tolerance)
 {
-	// TODO: allocate a NxM array here and do an in place convex hull reduction in EPARecurse?
-	struct MinkowskiPoint hull[3] = {v0, v1, v2};
-	return EPARecurse(ctx, 3, hull, 1);
+	return (tolerance > 0.0f ? cpfsqrt(prevDistSq) - cpfsqrt(distSq) <= tolerance : distSq >= prevDistSq);
 }
 
-//MARK: GJK Functions.
-
-// Recursive implementation of the GJK loop.
+// Iterate GJK starting with the edge v0, v1.
 static inline struct ClosestPoints
-GJKRecurse(const struct SupportContext *ctx, const struct MinkowskiPoint v0, const struct MinkowskiPoint v1, const int iteration)
+GJKIterate(struct SupportContext *ctx, struct MinkowskiPoint v0, struct MinkowskiPoint v1)
 {
-	if(iteration > MAX_GJK_ITERATIONS){
-		cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK iterations: %d", iteration);
-		return ClosestPointsNew(v0, v1);
-	}
+	const struct cpCollisionBudget *budget = ctx->info->budget;
+	cpFloat dist = ClosestDist(v0.ab, v1.ab);
 	
-	if(cpCheckPointGreater(v1.ab, v0.ab, cpvzero)){
-		// Origin is behind axis. Flip and try again.
-		return GJKRecurse(ctx, v1, v0, iteration);
-	} else {
+	for(int iteration=1;; iteration++){
+		if(iteration > budget->gjkIterations){
+			ctx->info->exhausted |= CP_GJK_EXHAUSTED;
+			return ClosestPointsNew(v0, v1);
+		}
+		
+		if(cpCheckPointGreater(v1.ab, v0.ab, cpvzero)){
+			// Origin is behind axis. Flip it.
+			struct MinkowskiPoint tmp = v0;
+			v0 = v1, v1 = tmp;
+		}
+		
 		cpFloat t = ClosestT(v0.ab, v1.ab);
 		cpVect n = (-1.0f < t && t < 1.0f ? cpvperp(cpvsub(v1.ab, v0.ab)) : cpvneg(LerpT(v0.ab, v1.ab, t)));
 		struct MinkowskiPoint p = Support(ctx, n);
@@ -371,23 +473,24 @@ GJKRecurse(const struct SupportContext *ctx, const struct MinkowskiPoint v0, con
 		
 		if(cpCheckPointGreater(p.ab, v0.ab, cpvzero) && cpCheckPointGreater(v1.ab, p.ab, cpvzero)){
 			// The triangle v0, p, v1 contains the origin. Use EPA to find the MSA.
-			cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK->EPA iterations: %d", iteration);
 			return EPA(ctx, v0, p, v1);
+		} else if(cpCheckAxis(v0.ab, v1.ab, p.ab, n)){
+			// The edge v0, v1 that we already have is the closest to (0, 0) since p was not closer.
+			return ClosestPointsNew(v0, v1);
+		}
+		
+		// p was closer to the origin than our existing edge.
+		// Need to figure out which existing point to drop.
+		cpFloat prevDist = dist;
+		cpFloat d0 = ClosestDist(v0.ab, p.ab), d1 = ClosestDist(p.ab, v1.ab);
+		if(d0 < d1){
+			v1 = p, dist = d0;
 		} else {
-			if(cpCheckAxis(v0.ab, v1.ab, p.ab, n)){
-				// The edge v0, v1 that we already have is the closest to (0, 0) since p was not closer.
-				cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK iterations: %d", iteration);
-				return ClosestPointsNew(v0, v1);
-			} else {
-				// p was closer to the origin than our existing edge.
-				// Need to figure out which existing point to drop.
-				if(ClosestDist(v0.ab, p.ab) < ClosestDist(p.ab, v1.ab)){
-					return GJKRecurse(ctx, v0, p, iteration + 1);
-				} else {
-					return GJKRecurse(ctx, p, v1, iteration + 1);
-				}
-			}
+			v0 = p, dist = d1;
 		}
+		
+		// Stop once the edge stops getting closer. Without a tolerance this only catches GJK cycling on round off.
+		if(GJKStalled(prevDist, dist, budget->tolerance)) return ClosestPointsNew(v0, v1);
 	}
 }
 
@@ -414,7 +517,7 @@ ShapePoint(const cpShape *shape, const int i)
 
 // Find the closest points between two shapes using the GJK algorithm.
 static struct ClosestPoints
-GJK(const struct SupportContext *ctx, cpCollisionID *id)
+GJK(struct SupportContext *ctx, cpCollisionID *id)
 {
 #if DRAW_GJK || DRAW_EPA
 	int count1 = 1;
@@ -455,7 +558,7 @@ GJK(const struct SupportContext *ctx, cpCollisionID *id)
 #endif
 	
 	struct MinkowskiPoint v0, v1;
-	if(*id){
+	if(HasSupportIndexes(*id)){
 		// Use the minkowski points from the last frame as a starting point using the cached indexes.
 		v0 = MinkowskiPointNew(ShapePoint(ctx->shape1, (*id>>24)&0xFF), ShapePoint(ctx->shape2, (*id>>16)&0xFF));
 		v1 = MinkowskiPointNew(ShapePoint(ctx->shape1, (*id>> 8)&0xFF), ShapePoint(ctx->shape2, (*id    )&0xFF));
@@ -466,11 +569,46 @@ GJK(const struct SupportContext *ctx, cpCollisionID *id)
 		v1 = Support(ctx, cpvneg(axis));
 	}
 	
-	struct ClosestPoints points = GJKRecurse(ctx, v0, v1, 1);
-	*id = points.id;
+	struct ClosestPoints points = GJKIterate(ctx, v0, v1);
+	// Indexes of polygons with 128 or more vertexes can collide with the separating axis flag. Don't cache those.
+	*id = (points.id & SEPARATING_AXIS_FLAG ? 0 : points.id);
 	return points;
 }
 
+//MARK: Separating Axis Cache
+
+// A collision ID normally holds the GJK support indexes from the last time the pair was tested.
+// When a pair was found to be apart, it holds the separating axis instead, flagged with SEPARATING_AXIS_FLAG.
+// The axis is stored as a pair of 15 bit fixed point values so the ID still fits in 32 bits.
+// If the axis stops separating the shapes, GJK has no indexes to warm start from and starts cold.
+
+static inline cpCollisionID
+CacheSeparatingAxis(cpVect n)
+{
+	cpCollisionID x = (cpCollisionID)(int)(n.x*16383.0f) & 0x7FFF;
+	cpCollisionID y = (cpCollisionID)(int)(n.y*16383.0f) & 0x7FFF;
+	return SEPARATING_AXIS_FLAG | x<<15 | y;
+}
+
+// Sign extend a 15 bit fixed point value.
+static inline int
+AxisComponent(cpCollisionID bits)
+{
+	int value = (int)(bits & 0x7FFF);
+	return (value & 0x4000 ? value - 0x8000 : value);
+}
+
+// Check if the shapes are still separated by more than 'r' along the cached axis.
+// Any axis gives a lower bound on the distance, so this never rejects a pair GJK would find touching.
+static inline cpBool
+CachedAxisSeparates(struct SupportContext *ctx, cpCollisionID id, cpFloat r)
+{
+	if(!(id & SEPARATING_AXIS_FLAG)) return cpFalse;
+	
+	cpVect n = cpvnormalize(cpv(AxisComponent(id>>15), AxisComponent(id)));
+	return cpvdot(Support(ctx, cpvneg(n)).ab, n) > r;
+}
+
 //MARK: Contact Clipping
 
 // Given two support edges, find contact point pairs on their surfaces.
@@ -517,6 +655,132 @@ ContactPoints(const struct Edge e1, const struct Edge e2, const struct ClosestPo
 	}
 }
 
+//MARK: Box Kernels
+
+// Center, face normals and half extents of a box shaped poly.
+struct BoxFrame {
+	cpVect c;
+	cpVect n0, n1;
+	cpFloat h0, h1;
+};
+
+static inline struct BoxFrame
+BoxFrameNew(const cpPolyShape *box)
+{
+	const struct cpSplittingPlane *planes = box->planes;
+	cpVect c = cpvlerp(planes[0].v0, planes[2].v0, 0.5f);
+	cpVect n0 = planes[0].n, n1 = planes[1].n;
+	
+	struct BoxFrame frame = {c, n0, n1, cpvdot(n0, cpvsub(planes[0].v0, c)), cpvdot(n1, cpvsub(planes[1].v0, c))};
+	return frame;
+}
+
+// Half width of a box projected onto an axis.
+static inline cpFloat
+BoxExtent(const struct BoxFrame *frame, const cpVect n)
+{
+	return frame->h0*cpfabs(cpvdot(n, frame->n0)) + frame->h1*cpfabs(cpvdot(n, frame->n1));
+}
+
+// The edge of face 'k' of a box, matching the edge SupportEdgeForPoly() would return.
+static inline struct Edge
+BoxFaceEdge(const cpPolyShape *box, const int k)
+{
+	const struct cpSplittingPlane *planes = box->planes;
+	cpHashValue hashid = box->shape.hashid;
+	int k0 = (k + 3)&3;
+	
+	struct Edge edge = {{planes[k0].v0, CP_HASH_PAIR(hashid, k0)}, {planes[k].v0, CP_HASH_PAIR(hashid, k)}, box->r, planes[k].n};
+	return edge;
+}
+
+// Separating axis test for two boxes. In 2D only the face normals need to be tested.
+// The contacts are clipped by ContactPoints() the same as the GJK path, so the contact hashes match.
+// Returns false if the boxes are apart but within their radii, which needs GJK to find the rounded contact.
+static cpBool
+BoxToBox(const cpPolyShape *box1, const cpPolyShape *box2, struct cpCollisionInfo *info)
+{
+	struct BoxFrame f1 = BoxFrameNew(box1);
+	struct BoxFrame f2 = BoxFrameNew(box2);
+	cpVect delta = cpvsub(f2.c, f1.c);
+	
+	const cpVect axes[] = {f1.n0, f1.n1, f2.n0, f2.n1};
+	
+	cpFloat maxSep = -INFINITY;
+	int best = 0;
+	cpBool flip = cpFalse;
+	
+	for(int i=0; i<4; i++){
+		cpVect n = axes[i];
+		cpFloat proj = cpvdot(n, delta);
+		cpFloat sep = cpfabs(proj) - BoxExtent(&f1, n) - BoxExtent(&f2, n);
+		
+		if(sep > maxSep){
+			maxSep = sep;
+			best = i;
+			flip = (proj < 0.0f);
+		}
+	}
+	
+	cpFloat mindist = box1->r + box2->r;
+	if(maxSep > mindist){
+		return cpTrue;
+	} else if(maxSep > 0.0f){
+		return cpFalse;
+	}
+	
+	// The normal points from box1 towards box2.
+	cpVect n = (flip ? cpvneg(axes[best]) : axes[best]);
+	struct ClosestPoints points = {cpvzero, cpvzero, n, maxSep, info->id};
+	
+	if(best < 2){
+		ContactPoints(BoxFaceEdge(box1, best + (flip ? 2 : 0)), SupportEdgeForPoly(box2, cpvneg(n), -1), points, info);
+	} else {
+		ContactPoints(SupportEdgeForPoly(box1, n, -1), BoxFaceEdge(box2, best - 2 + (flip ? 0 : 2)), points, info);
+	}
+	
+	return cpTrue;
+}
+
+// Closest point test for a circle against a box, done in the box's frame.
+static void
+CircleToBox(const cpCircleShape *circle, const cpPolyShape *box, struct cpCollisionInfo *info)
+{
+	struct BoxFrame f = BoxFrameNew(box);
+	cpVect center = circle->tc;
+	cpVect delta = cpvsub(center, f.c);
+	
+	cpFloat x = cpvdot(delta, f.n0);
+	cpFloat y = cpvdot(delta, f.n1);
+	cpFloat cx = cpfclamp(x, -f.h0, f.h0);
+	cpFloat cy = cpfclamp(y, -f.h1, f.h1);
+	
+	cpVect n, closest;
+	if(cx != x || cy != y){
+		// The center is outside of the box, so the closest point is on its surface.
+		closest = cpvadd(f.c, cpvadd(cpvmult(f.n0, cx), cpvmult(f.n1, cy)));
+		
+		cpFloat mindist = circle->r + box->r;
+		cpVect d = cpvsub(closest, center);
+		cpFloat distsq = cpvlengthsq(d);
+		if(distsq > mindist*mindist) return;
+		
+		n = cpvmult(d, 1.0f/cpfsqrt(distsq));
+	} else {
+		// The center is inside of the box. Push it out through the nearest face.
+		cpFloat sx = f.h0 - cpfabs(x);
+		cpFloat sy = f.h1 - cpfabs(y);
+		cpVect face = (sx < sy ? cpvmult(f.n0, x < 0.0f ? -1.0f : 1.0f) : cpvmult(f.n1, y < 0.0f ? -1.0f : 1.0f));
+		
+		n = cpvneg(face);
+		closest = cpvadd(center, cpvmult(face, sx < sy ? sx : sy));
+	}
+	
+	// Same contact points as CircleToPoly().
+	info->n = n;
+	cpCollisionInfoPushContact(info, cpvadd(center, cpvmult(n, circle->r)), cpvadd(closest, cpvmult(n, box->r)), 0);
+}
+
 //MARK: Collision Functions
 
 typedef void (*CollisionFunc)(const cpShape *a, const cpShape *b, struct cpCollisionInfo *info);
@@ -571,7 +835,9 @@ CircleToSegment(const cpCircleShape *circle, const cpSegmentShape *segment, stru
 static void
 SegmentToSegment(const cpSegmentShape *seg1, const cpSegmentShape *seg2, struct cpCollisionInfo *info)
 {
-	struct SupportContext context = {(cpShape *)seg1, (cpShape *)seg2, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)SegmentSupportPoint};
+	struct SupportContext context = SupportContextNew((cpShape *)seg1, (cpShape *)seg2, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)SegmentSupportPoint, info);
+	if(CachedAxisSeparates(&context, info->id, seg1->r + seg2->r)) return;
+	
 	struct ClosestPoints points = GJK(&context, &info->id);
 	
 #if DRAW_CLOSEST
@@ -600,13 +866,19 @@ SegmentToSegment(const cpSegmentShape *seg1, const cpSegmentShape *seg2, struct
 		)
 	){
 		ContactPoints(SupportEdgeForSegment(seg1, n), SupportEdgeForSegment(seg2, cpvneg(n)), points, info);
+	} else if(points.d > seg1->r + seg2->r){
+		info->id = CacheSeparatingAxis(n);
 	}
 }
 
 static void
 PolyToPoly(const cpPolyShape *poly1, const cpPolyShape *poly2, struct cpCollisionInfo *info)
 {
-	struct SupportContext context = {(cpShape *)poly1, (cpShape *)poly2, (SupportPointFunc)PolySupportPoint, (SupportPointFunc)PolySupportPoint};
+	if(poly1->box && poly2->box && BoxToBox(poly1, poly2, info)) return;
+	
+	struct SupportContext context = SupportContextNew((cpShape *)poly1, (cpShape *)poly2, (SupportPointFunc)PolySupportPoint, (SupportPointFunc)PolySupportPoint, info);
+	if(CachedAxisSeparates(&context, info->id, poly1->r + poly2->r)) return;
+	
 	struct ClosestPoints points = GJK(&context, &info->id);
 	
 #if DRAW_CLOSEST
@@ -622,14 +894,18 @@ PolyToPoly(const cpPolyShape *poly1, const cpPolyShape *poly2, struct cpCollisio
 	
 	// If the closest points are nearer than the sum of the radii...
 	if(points.d - poly1->r - poly2->r <= 0.0){
-		ContactPoints(SupportEdgeForPoly(poly1, points.n), SupportEdgeForPoly(poly2, cpvneg(points.n)), points, info);
+		ContactPoints(SupportEdgeForPoly(poly1, points.n, SupportHint(info->id, 24)), SupportEdgeForPoly(poly2, cpvneg(points.n), SupportHint(info->id, 16)), points, info);
+	} else {
+		info->id = CacheSeparatingAxis(points.n);
 	}
 }
 
 static void
 SegmentToPoly(const cpSegmentShape *seg, const cpPolyShape *poly, struct cpCollisionInfo *info)
 {
-	struct SupportContext context = {(cpShape *)seg, (cpShape *)poly, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)PolySupportPoint};
+	struct SupportContext context = SupportContextNew((cpShape *)seg, (cpShape *)poly, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)PolySupportPoint, info);
+	if(CachedAxisSeparates(&context, info->id, seg->r + poly->r)) return;
+	
 	struct ClosestPoints points = GJK(&context, &info->id);
 	
 #if DRAW_CLOSEST
@@ -654,14 +930,23 @@ SegmentToPoly(const cpSegmentShape *seg, const cpPolyShape *poly, struct cpColli
 			(!cpveql(points.a, seg->tb) || cpvdot(n, cpvrotate(seg->b_tangent, rot)) <= 0.0)
 		)
 	){
-		ContactPoints(SupportEdgeForSegment(seg, n), SupportEdgeForPoly(poly, cpvneg(n)), points, info);
+		ContactPoints(SupportEdgeForSegment(seg, n), SupportEdgeForPoly(poly, cpvneg(n), SupportHint(info->id, 16)), points, info);
+	} else if(points.d - seg->r - poly->r > 0.0){
+		info->id = CacheSeparatingAxis(n);
 	}
 }
 
 static void
 CircleToPoly(const cpCircleShape *circle, const cpPolyShape *poly, struct cpCollisionInfo *info)
 {
-	struct SupportContext context = {(cpShape *)circle, (cpShape *)poly, (SupportPointFunc)CircleSupportPoint, (SupportPointFunc)PolySupportPoint};
+	if(poly->box){
+		CircleToBox(circle, poly, info);
+		return;
+	}
+	
+	struct SupportContext context = SupportContextNew((cpShape *)circle, (cpShape *)poly, (SupportPointFunc)CircleSupportPoint, (SupportPointFunc)PolySupportPoint, info);
+	if(CachedAxisSeparates(&context, info->id, circle->r + poly->r)) return;
+	
 	struct ClosestPoints points = GJK(&context, &info->id);
 	
 #if DRAW_CLOSEST
@@ -675,6 +960,8 @@ CircleToPoly(const cpCircleShape *circle, const cpPolyShape *poly, struct cpColl
 	if(points.d <= circle->r + poly->r){
 		cpVect n = info->n = points.n;
 		cpCollisionInfoPushContact(info, cpvadd(points.a, cpvmult(n, circle->r)), cpvadd(points.b, cpvmult(n, poly->r)), 0);
+	} else {
+		info->id = CacheSeparatingAxis(points.n);
 	}
 }
 
@@ -698,10 +985,13 @@ static const CollisionFunc BuiltinCollisionFuncs[9] = {
 };
 static const CollisionFunc *CollisionFuncs = BuiltinCollisionFuncs;
 
+// Budget used by collisions outside of a space step, such as cpShapesCollide().
+static const struct cpCollisionBudget DefaultBudget = {30, 30, 0.0f};
+
 struct cpCollisionInfo
-cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts)
+cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts, const struct cpCollisionBudget *budget)
 {
-	struct cpCollisionInfo info = {a, b, id, cpvzero, 0, contacts};
+	struct cpCollisionInfo info = {a, b, id, cpvzero, 0, contacts, (budget ? budget : &DefaultBudget), 0};
 	
 	// Make sure the shape types are in order.
 	if(a->klass->type > b->klass->type){
@@ -724,3 +1014,98 @@ cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact
 	
 	return info;
 }
+
+//MARK: Batched Collisions
+
+// Collide a block of pairs with 'func'. Each case in cpCollideBatch() passes a known function so it can be inlined.
+static inline int
+CollideBlock(CollisionFunc func, struct cpCollisionPair *pairs, const int *indexes, int count, struct cpContact *contacts, const struct cpCollisionBudget *budget)
+{
+	int used = 0;
+	
+	for(int i=0; i<count; i++){
+		struct cpCollisionPair *pair = pairs + indexes[i];
+		const cpShape *a = pair->a, *b = pair->b;
+		
+		// Make sure the shape types are in order.
+		if(a->klass->type > b->klass->type){
+			const cpShape *tmp = a;
+			a = b, b = tmp;
+		}
+		
+		struct cpCollisionInfo info = {a, b, pair->id, cpvzero, 0, contacts + used, budget, 0};
+		func(a, b, &info);
+		
+		pair->info = info;
+		used += info.count;
+	}
+	
+	return used;
+}
+
+// Circles are gathered into arrays first so the distance tests for the whole block run as one tight loop.
+// The contacts are exactly the same as CircleToCircle().
+static int
+CircleToCircleBlock(struct cpCollisionPair *pairs, const int *indexes, int count, struct cpContact *contacts, const struct cpCollisionBudget *budget)
+{
+	cpFloat dx[CP_COLLIDE_BATCH_SIZE], dy[CP_COLLIDE_BATCH_SIZE], mindist[CP_COLLIDE_BATCH_SIZE];
+	int hit[CP_COLLIDE_BATCH_SIZE];
+	
+	for(int i=0; i<count; i++){
+		const struct cpCollisionPair *pair = pairs + indexes[i];
+		const cpCircleShape *c1 = (const cpCircleShape *)pair->a;
+		const cpCircleShape *c2 = (const cpCircleShape *)pair->b;
+		
+		dx[i] = c2->tc.x - c1->tc.x;
+		dy[i] = c2->tc.y - c1->tc.y;
+		mindist[i] = c1->r + c2->r;
+	}
+	
+	for(int i=0; i<count; i++){
+		hit[i] = (dx[i]*dx[i] + dy[i]*dy[i] < mindist[i]*mindist[i]);
+	}
+	
+	int used = 0;
+	for(int i=0; i<count; i++){
+		struct cpCollisionPair *pair = pairs + indexes[i];
+		struct cpCollisionInfo info = {pair->a, pair->b, pair->id, cpvzero, 0, contacts + used, budget, 0};
+		
+		if(hit[i]){
+			const cpCircleShape *c1 = (const cpCircleShape *)pair->a;
+			const cpCircleShape *c2 = (const cpCircleShape *)pair->b;
+			
+			cpVect delta = cpv(dx[i], dy[i]);
+			cpFloat dist = cpfsqrt(cpvlengthsq(delta));
+			cpVect n = info.n = (dist ? cpvmult(delta, 1.0f/dist) : cpv(1.0f, 0.0f));
+			cpCollisionInfoPushContact(&info, cpvadd(c1->tc, cpvmult(n, c1->r)), cpvadd(c2->tc, cpvmult(n, -c2->r)), 0);
+		}
+		
+		pair->info = info;
+		used += info.count;
+	}
+	
+	return used;
+}
+
+int
+cpCollideBatch(struct cpCollisionPair *pairs, const int *indexes, int count, struct cpContact *contacts, const struct cpCollisionBudget *budget)
+{
+	cpAssertSoft(count <= CP_COLLIDE_BATCH_SIZE, "Internal Error: Collision batch is too large.");
+	
+	switch(pairs[indexes[0]].type){
+		case CP_CIRCLE_SHAPE + CP_CIRCLE_SHAPE*CP_NUM_SHAPES:
+			return CircleToCircleBlock(pairs, indexes, count, contacts, budget);
+		case CP_CIRCLE_SHAPE + CP_SEGMENT_SHAPE*CP_NUM_SHAPES:
+			return CollideBlock((CollisionFunc)CircleToSegment, pairs, indexes, count, contacts, budget);
+		case CP_SEGMENT_SHAPE + CP_SEGMENT_SHAPE*CP_NUM_SHAPES:
+			return CollideBlock((CollisionFunc)SegmentToSegment, pairs, indexes, count, contacts, budget);
+		case CP_CIRCLE_SHAPE + CP_POLY_SHAPE*CP_NUM_SHAPES:
+			return CollideBlock((CollisionFunc)CircleToPoly, pairs, indexes, count, contacts, budget);
+		case CP_SEGMENT_SHAPE + CP_POLY_SHAPE*CP_NUM_SHAPES:
+			return CollideBlock((CollisionFunc)SegmentToPoly, pairs, indexes, count, contacts, budget);
+		case CP_POLY_SHAPE + CP_POLY_SHAPE*CP_NUM_SHAPES:
+			return CollideBlock((CollisionFunc)PolyToPoly, pairs, indexes, count, contacts, budget);
+		default:
+			return CollideBlock(CollisionFuncs[pairs[indexes[0]].type], pairs, indexes, count, contacts, budget);
+	}
+}
@@ -0,0 +1,783 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chipmunk/chipmunk_private.h"
+
+// A bounding box tree stored as a flat array of nodes in depth first order.
+// An internal node's first child always immediately follows it, and every node stores the index
+// of the node after its subtree. This lets queries walk the tree front to back without recursion.
+// Rather than updating the tree incrementally, leaves are refit in place every reindex
+// and the whole tree is rebuilt top down when it degrades or objects are added or removed.
+
+static inline cpSpatialIndexClass *Klass();
+
+typedef struct Leaf Leaf;
+typedef struct FlatNode FlatNode;
+typedef struct BuildLeaf BuildLeaf;
+
+// Rebuild once refitting has made the tree this much more expensive than when it was built.
+#define REBUILD_COST_FACTOR 1.5f
+
+// Segment queries keep a small stack to visit the nearest child first.
+// Subtrees that would overflow it are finished in depth first order instead.
+#define SEGMENT_STACK_SIZE 32
+
+#define BIN_COUNT 16
+
+struct cpFlatBBTree {
+	cpSpatialIndex spatialIndex;
+	
+	cpHashSet *leaves;
+	cpArray *pooledLeaves;
+	cpArray *allocatedBuffers;
+	
+	// Leaves inserted since the last build. Queries check them one by one.
+	cpArray *pending;
+	// Number of leaves removed from the tree since the last build.
+	int removed;
+	
+	// Nodes in depth first order. The root is nodes[0].
+	FlatNode *nodes;
+	int *parents;
+	int nodeCount, nodeMax;
+	
+	// Leaf objects in depth first order and the node each belongs to.
+	// Objects removed since the last build are set to NULL.
+	void **objs;
+	int *leafNodes;
+	int leafCount, leafMax;
+	
+	cpFloat builtCost;
+	
+	// Scratch space for building the tree.
+	BuildLeaf *buildLeaves;
+	int buildLeavesMax;
+};
+
+struct FlatNode {
+	cpBB bb;
+	// Index of the first node after this node's subtree.
+	int skip;
+	// Index into the tree's objs array, or -1 for internal nodes.
+	int leaf;
+};
+
+struct Leaf {
+	void *obj;
+	// Index of the leaf's node, or -1 if it hasn't been built into the tree yet.
+	int node;
+	// Only used while the leaf is pending.
+	cpBB bb;
+};
+
+struct BuildLeaf {
+	cpBB bb;
+	Leaf *leaf;
+};
+
+static inline cpFloat
+BBPerimeter(cpBB bb)
+{
+	return (bb.r - bb.l) + (bb.t - bb.b);
+}
+
+// Number of pending or removed leaves that are allowed to build up before rebuilding the tree.
+static inline int
+FlushThreshold(cpFlatBBTree *tree)
+{
+	return 8 + tree->leafCount/8;
+}
+
+//MARK: Leaf Functions
+
+static int leafSetEql(void *obj, Leaf *leaf){return (obj == leaf->obj);}
+
+static Leaf *
+LeafFromPool(cpFlatBBTree *tree)
+{
+	if(tree->pooledLeaves->num == 0){
+		// leaf pool is exhausted, make more
+		int count = CP_BUFFER_BYTES/sizeof(Leaf);
+		cpAssertHard(count, "Internal Error: Buffer size is too small.");
+		
+		Leaf *buffer = (Leaf *)cpAllocatorCalloc(tree->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
+		cpArrayPush(tree->allocatedBuffers, buffer);
+		
+		for(int i=0; i<count; i++) cpArrayPush(tree->pooledLeaves, buffer + i);
+	}
+	
+	return (Leaf *)cpArrayPop(tree->pooledLeaves);
+}
+
+static void *
+leafSetTrans(void *obj, cpFlatBBTree *tree)
+{
+	Leaf *leaf = LeafFromPool(tree);
+	leaf->obj = obj;
+	leaf->node = -1;
+	leaf->bb = tree->spatialIndex.bbfunc(obj);
+	
+	return leaf;
+}
+
+//MARK: Building
+
+static void
+ResizeNodes(cpFlatBBTree *tree, int max)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->nodeMax = max;
+	tree->nodes = (FlatNode *)cpAllocatorRealloc(allocator, tree->nodes, max*sizeof(FlatNode));
+	tree->parents = (int *)cpAllocatorRealloc(allocator, tree->parents, max*sizeof(int));
+}
+
+static void
+ResizeLeaves(cpFlatBBTree *tree, int max)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->leafMax = max;
+	tree->objs = (void **)cpAllocatorRealloc(allocator, tree->objs, max*sizeof(void *));
+	tree->leafNodes = (int *)cpAllocatorRealloc(allocator, tree->leafNodes, max*sizeof(int));
+}
+
+typedef struct BuildContext {
+	cpFlatBBTree *tree;
+	BuildLeaf *cursor;
+} BuildContext;
+
+static void
+fillBuildLeaves(Leaf *leaf, BuildContext *context)
+{
+	// Leaves already in the tree keep the bounding box from the last time they were reindexed.
+	context->cursor->bb = (leaf->node < 0 ? leaf->bb : context->tree->nodes[leaf->node].bb);
+	context->cursor->leaf = leaf;
+	context->cursor++;
+}
+
+static inline cpFloat
+LeafCenter(const BuildLeaf *leaf, int axis)
+{
+	return (axis == 0 ? leaf->bb.l + leaf->bb.r : leaf->bb.b + leaf->bb.t);
+}
+
+static inline int
+LeafBin(const BuildLeaf *leaf, int axis, cpFloat min, cpFloat scale)
+{
+	int bin = (int)((LeafCenter(leaf, axis) - min)*scale);
+	return (bin < BIN_COUNT - 1 ? bin : BIN_COUNT - 1);
+}
+
+// Partition the leaves in place using a binned surface area heuristic and return the size of the first half.
+static int
+PartitionLeaves(BuildLeaf *leaves, int count)
+{
+	cpFloat mins[2] = {LeafCenter(leaves, 0), LeafCenter(leaves, 1)};
+	cpFloat maxs[2] = {mins[0], mins[1]};
+	for(int i=1; i<count; i++){
+		for(int axis=0; axis<2; axis++){
+			cpFloat c = LeafCenter(leaves + i, axis);
+			mins[axis] = cpfmin(mins[axis], c);
+			maxs[axis] = cpfmax(maxs[axis], c);
+		}
+	}
+	
+	int bestAxis = -1, bestBin = 0;
+	cpFloat bestCost = INFINITY, bestScale = 0.0f;
+	
+	for(int axis=0; axis<2; axis++){
+		cpFloat extent = maxs[axis] - mins[axis];
+		if(extent <= 0.0f) continue;
+		
+		cpFloat scale = BIN_COUNT/extent;
+		cpBB bins[BIN_COUNT];
+		int counts[BIN_COUNT] = {0};
+		
+		for(int i=0; i<count; i++){
+			int bin = LeafBin(leaves + i, axis, mins[axis], scale);
+			bins[bin] = (counts[bin] ? cpBBMerge(bins[bin], leaves[i].bb) : leaves[i].bb);
+			counts[bin]++;
+		}
+		
+		cpFloat rightCosts[BIN_COUNT];
+		cpBB bb = bins[BIN_COUNT - 1];
+		int n = 0;
+		for(int i=BIN_COUNT - 1; i>0; i--){
+			if(counts[i]){
+				bb = (n ? cpBBMerge(bb, bins[i]) : bins[i]);
+				n += counts[i];
+			}
+			
+			rightCosts[i] = (n ? n*BBPerimeter(bb) : INFINITY);
+		}
+		
+		n = 0;
+		for(int i=0; i<BIN_COUNT - 1; i++){
+			if(counts[i]){
+				bb = (n ? cpBBMerge(bb, bins[i]) : bins[i]);
+				n += counts[i];
+			}
+			
+			cpFloat cost = (n ? n*BBPerimeter(bb) + rightCosts[i + 1] : INFINITY);
+			if(cost < bestCost){
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+				bestScale = scale;
+			}
+		}
+	}
+	
+	// All of the centers are in the same place, just split the leaves in half.
+	if(bestAxis < 0) return count/2;
+	
+	int right = count;
+	for(int left=0; left < right;){
+		if(LeafBin(leaves + left, bestAxis, mins[bestAxis], bestScale) > bestBin){
+			right--;
+			BuildLeaf leaf = leaves[left];
+			leaves[left] = leaves[right];
+			leaves[right] = leaf;
+		} else {
+			left++;
+		}
+	}
+	
+	return right;
+}
+
+static int
+BuildSubtree(cpFlatBBTree *tree, BuildLeaf *leaves, int count, int parent)
+{
+	int index = tree->nodeCount++;
+	tree->parents[index] = parent;
+	
+	if(count == 1){
+		int leafIndex = tree->leafCount++;
+		tree->objs[leafIndex] = leaves[0].leaf->obj;
+		tree->leafNodes[leafIndex] = index;
+		leaves[0].leaf->node = index;
+		
+		tree->nodes[index].bb = leaves[0].bb;
+		tree->nodes[index].leaf = leafIndex;
+	} else {
+		int split = PartitionLeaves(leaves, count);
+		BuildSubtree(tree, leaves, split, index);
+		int second = BuildSubtree(tree, leaves + split, count - split, index);
+		
+		tree->nodes[index].bb = cpBBMerge(tree->nodes[index + 1].bb, tree->nodes[second].bb);
+		tree->nodes[index].leaf = -1;
+	}
+	
+	tree->nodes[index].skip = tree->nodeCount;
+	return index;
+}
+
+// Sum of the internal node perimeters relative to the root's.
+static cpFloat
+TreeCost(cpFlatBBTree *tree)
+{
+	FlatNode *nodes = tree->nodes;
+	if(tree->nodeCount < 2) return 0.0f;
+	
+	cpFloat cost = 0.0f;
+	for(int i=0; i<tree->nodeCount; i++){
+		if(nodes[i].leaf < 0) cost += BBPerimeter(nodes[i].bb);
+	}
+	
+	cpFloat perimeter = BBPerimeter(nodes[0].bb);
+	return (perimeter > 0.0f ? cost/perimeter : 0.0f);
+}
+
+static void
+Rebuild(cpFlatBBTree *tree)
+{
+	int count = cpHashSetCount(tree->leaves);
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	
+	if(tree->nodeMax < 2*count - 1) ResizeNodes(tree, 2*count - 1);
+	if(tree->leafMax < count) ResizeLeaves(tree, count);
+	if(tree->buildLeavesMax < count){
+		tree->buildLeavesMax = count;
+		
+		cpAllocatorFree(allocator, tree->buildLeaves);
+		tree->buildLeaves = (BuildLeaf *)cpAllocatorCalloc(allocator, count, sizeof(BuildLeaf));
+	}
+	
+	BuildContext context = {tree, tree->buildLeaves};
+	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillBuildLeaves, &context);
+	
+	tree->nodeCount = 0;
+	tree->leafCount = 0;
+	if(count > 0) BuildSubtree(tree, tree->buildLeaves, count, -1);
+	
+	tree->pending->num = 0;
+	tree->removed = 0;
+	tree->builtCost = TreeCost(tree);
+}
+
+// Update the bounding boxes of the internal nodes from the leaves up. Returns the new cost of the tree.
+static cpFloat
+Refit(cpFlatBBTree *tree)
+{
+	FlatNode *nodes = tree->nodes;
+	cpSpatialIndexBBFunc bbfunc = tree->spatialIndex.bbfunc;
+	
+	for(int i=0; i<tree->leafCount; i++){
+		void *obj = tree->objs[i];
+		if(obj) nodes[tree->leafNodes[i]].bb = bbfunc(obj);
+	}
+	
+	// Children always come after their parents, so walking backwards visits them first.
+	cpFloat cost = 0.0f;
+	for(int i=tree->nodeCount - 1; i>=0; i--){
+		FlatNode *node = nodes + i;
+		if(node->leaf < 0){
+			node->bb = cpBBMerge(nodes[i + 1].bb, nodes[nodes[i + 1].skip].bb);
+			cost += BBPerimeter(node->bb);
+		}
+	}
+	
+	cpFloat perimeter = (tree->nodeCount > 0 ? BBPerimeter(nodes[0].bb) : 0.0f);
+	return (perimeter > 0.0f ? cost/perimeter : 0.0f);
+}
+
+//MARK: Memory Management Functions
+
+cpFlatBBTree *
+cpFlatBBTreeAlloc(void)
+{
+	return (cpFlatBBTree *)cpcalloc(1, sizeof(cpFlatBBTree));
+}
+
+cpSpatialIndex *
+cpFlatBBTreeInit(cpFlatBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)tree, Klass(), bbfunc, staticIndex);
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->leaves = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)leafSetEql, allocator);
+	tree->pooledLeaves = cpArrayNewWithAllocator(0, allocator);
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	
+	tree->pending = cpArrayNewWithAllocator(0, allocator);
+	tree->removed = 0;
+	
+	tree->nodes = NULL;
+	tree->parents = NULL;
+	tree->nodeCount = tree->nodeMax = 0;
+	
+	tree->objs = NULL;
+	tree->leafNodes = NULL;
+	tree->leafCount = tree->leafMax = 0;
+	
+	tree->builtCost = 0.0f;
+	
+	tree->buildLeaves = NULL;
+	tree->buildLeavesMax = 0;
+	
+	return (cpSpatialIndex *)tree;
+}
+
+cpSpatialIndex *
+cpFlatBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpFlatBBTreeInit(cpFlatBBTreeAlloc(), bbfunc, staticIndex);
+}
+
+cpSpatialIndex *
+cpFlatBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the tree's own arrays use it too.
+	cpFlatBBTree *tree = (cpFlatBBTree *)cpAllocatorCalloc(allocator, 1, sizeof(cpFlatBBTree));
+	tree->spatialIndex.allocator = allocator;
+	
+	return cpFlatBBTreeInit(tree, bbfunc, staticIndex);
+}
+
+static void
+cpFlatBBTreeDestroy(cpFlatBBTree *tree)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	
+	cpHashSetFree(tree->leaves);
+	cpArrayFree(tree->pooledLeaves);
+	cpArrayFree(tree->pending);
+	
+	if(tree->allocatedBuffers) cpArrayFreeEachBuffer(tree->allocatedBuffers);
+	cpArrayFree(tree->allocatedBuffers);
+	
+	cpAllocatorFree(allocator, tree->nodes);
+	cpAllocatorFree(allocator, tree->parents);
+	cpAllocatorFree(allocator, tree->objs);
+	cpAllocatorFree(allocator, tree->leafNodes);
+	cpAllocatorFree(allocator, tree->buildLeaves);
+}
+
+//MARK: Misc
+
+static int
+cpFlatBBTreeCount(cpFlatBBTree *tree)
+{
+	return cpHashSetCount(tree->leaves);
+}
+
+typedef struct eachContext {
+	cpSpatialIndexIteratorFunc func;
+	void *data;
+} eachContext;
+
+static void each_helper(Leaf *leaf, eachContext *context){context->func(leaf->obj, context->data);}
+
+static void
+cpFlatBBTreeEach(cpFlatBBTree *tree, cpSpatialIndexIteratorFunc func, void *data)
+{
+	eachContext context = {func, data};
+	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)each_helper, &context);
+}
+
+static cpBool
+cpFlatBBTreeContains(cpFlatBBTree *tree, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(tree->leaves, hashid, obj) != NULL);
+}
+
+//MARK: Basic Operations
+
+static void
+cpFlatBBTreeInsert(cpFlatBBTree *tree, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetInsert(tree->leaves, hashid, obj, (cpHashSetTransFunc)leafSetTrans, tree);
+	cpArrayPush(tree->pending, leaf);
+	
+	if(tree->pending->num > FlushThreshold(tree)) Rebuild(tree);
+}
+
+static void
+cpFlatBBTreeInsertBatch(cpFlatBBTree *tree, void **objs, const cpHashValue *hashids, int count)
+{
+	for(int i=0; i<count; i++){
+		Leaf *leaf = (Leaf *)cpHashSetInsert(tree->leaves, hashids[i], objs[i], (cpHashSetTransFunc)leafSetTrans, tree);
+		cpArrayPush(tree->pending, leaf);
+	}
+	
+	Rebuild(tree);
+}
+
+static void
+cpFlatBBTreeRemove(cpFlatBBTree *tree, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetRemove(tree->leaves, hashid, obj);
+	if(!leaf) return;
+	
+	if(leaf->node < 0){
+		cpArrayDeleteObj(tree->pending, leaf);
+	} else {
+		tree->objs[tree->nodes[leaf->node].leaf] = NULL;
+		tree->removed++;
+	}
+	
+	cpArrayPush(tree->pooledLeaves, leaf);
+	if(tree->removed > FlushThreshold(tree)) Rebuild(tree);
+}
+
+//MARK: Reindexing Functions
+
+static void
+leafUpdateBB(Leaf *leaf, cpFlatBBTree *tree)
+{
+	cpBB bb = tree->spatialIndex.bbfunc(leaf->obj);
+	if(leaf->node < 0){
+		leaf->bb = bb;
+	} else {
+		tree->nodes[leaf->node].bb = bb;
+	}
+}
+
+static void
+cpFlatBBTreeReindexObject(cpFlatBBTree *tree, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetFind(tree->leaves, hashid, obj);
+	if(!leaf) return;
+	
+	cpBB bb = tree->spatialIndex.bbfunc(obj);
+	if(leaf->node < 0){
+		leaf->bb = bb;
+	} else {
+		FlatNode *nodes = tree->nodes;
+		nodes[leaf->node].bb = bb;
+		
+		for(int i = tree->parents[leaf->node]; i >= 0; i = tree->parents[i]){
+			nodes[i].bb = cpBBMerge(nodes[i + 1].bb, nodes[nodes[i + 1].skip].bb);
+		}
+	}
+}
+
+static void
+cpFlatBBTreeReindex(cpFlatBBTree *tree)
+{
+	if(tree->pending->num > 0 || tree->removed > 0){
+		// Objects were added or removed. Build the tree from scratch with their current bounding boxes.
+		cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)leafUpdateBB, tree);
+		Rebuild(tree);
+	} else if(Refit(tree) > REBUILD_COST_FACTOR*tree->builtCost){
+		Rebuild(tree);
+	}
+}
+
+//MARK: Query Functions
+
+static void
+cpFlatBBTreeQuery(cpFlatBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	FlatNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	for(int i=0, count=tree->nodeCount; i<count;){
+		FlatNode *node = nodes + i;
+		
+		if(cpBBIntersects(bb, node->bb)){
+			if(node->leaf >= 0 && objs[node->leaf]) func(obj, objs[node->leaf], 0, data);
+			i++;
+		} else {
+			i = node->skip;
+		}
+	}
+	
+	cpArray *pending = tree->pending;
+	for(int i=0; i<pending->num; i++){
+		Leaf *leaf = (Leaf *)pending->arr[i];
+		if(cpBBIntersects(bb, leaf->bb)) func(obj, leaf->obj, 0, data);
+	}
+}
+
+// Query the nodes from 'start' up to 'end' in depth first order.
+static cpFloat
+SkipSegmentQuery(cpFlatBBTree *tree, int start, int end, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	FlatNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	for(int i=start; i<end;){
+		FlatNode *node = nodes + i;
+		
+		if(cpBBSegmentQuery(node->bb, a, b) < t_exit){
+			if(node->leaf >= 0 && objs[node->leaf]) t_exit = cpfmin(t_exit, func(obj, objs[node->leaf], data));
+			i++;
+		} else {
+			i = node->skip;
+		}
+	}
+	
+	return t_exit;
+}
+
+typedef struct SegmentStackEntry {
+	int node;
+	cpFloat t;
+} SegmentStackEntry;
+
+static void
+cpFlatBBTreeSegmentQuery(cpFlatBBTree *tree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	FlatNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	SegmentStackEntry stack[SEGMENT_STACK_SIZE];
+	int depth = 0;
+	
+	if(tree->nodeCount > 0){
+		SegmentStackEntry root = {0, cpBBSegmentQuery(nodes[0].bb, a, b)};
+		stack[depth++] = root;
+	}
+	
+	while(depth > 0){
+		SegmentStackEntry entry = stack[--depth];
+		if(entry.t >= t_exit) continue;
+		
+		FlatNode *node = nodes + entry.node;
+		if(node->leaf >= 0){
+			if(objs[node->leaf]) t_exit = cpfmin(t_exit, func(obj, objs[node->leaf], data));
+		} else if(depth + 2 > SEGMENT_STACK_SIZE){
+			t_exit = SkipSegmentQuery(tree, entry.node, node->skip, obj, a, b, t_exit, func, data);
+		} else {
+			int child_a = entry.node + 1;
+			int child_b = nodes[child_a].skip;
+			SegmentStackEntry near = {child_a, cpBBSegmentQuery(nodes[child_a].bb, a, b)};
+			SegmentStackEntry far = {child_b, cpBBSegmentQuery(nodes[child_b].bb, a, b)};
+			
+			if(far.t < near.t){
+				SegmentStackEntry tmp = near;
+				near = far;
+				far = tmp;
+			}
+			
+			// Push the far child first so the near one is visited first.
+			if(far.t < t_exit) stack[depth++] = far;
+			if(near.t < t_exit) stack[depth++] = near;
+		}
+	}
+	
+	cpArray *pending = tree->pending;
+	for(int i=0; i<pending->num; i++){
+		Leaf *leaf = (Leaf *)pending->arr[i];
+		if(cpBBSegmentQuery(leaf->bb, a, b) < t_exit) t_exit = cpfmin(t_exit, func(obj, leaf->obj, data));
+	}
+}
+
+//MARK: Reindex/Query
+
+static void
+cpFlatBBTreeReindexQuery(cpFlatBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpFlatBBTreeReindex(tree);
+	
+	FlatNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	int count = tree->nodeCount;
+	
+	// The tree was just rebuilt or refit, so there are no pending or removed leaves.
+	// Every leaf only needs to be tested against the nodes after it to find each pair once.
+	for(int leaf=0; leaf<tree->leafCount; leaf++){
+		int start = tree->leafNodes[leaf];
+		void *obj = objs[leaf];
+		cpBB bb = nodes[start].bb;
+		
+		for(int i=start + 1; i<count;){
+			FlatNode *node = nodes + i;
+			
+			if(cpBBIntersects(bb, node->bb)){
+				if(node->leaf >= 0) func(obj, objs[node->leaf], 0, data);
+				i++;
+			} else {
+				i = node->skip;
+			}
+		}
+	}
+	
+	// Reindex query is also responsible for colliding against the static index.
+	cpSpatialIndexCollideStatic((cpSpatialIndex *)tree, tree->spatialIndex.staticIndex, func, data);
+}
+
+//MARK: Memory Trimming
+
+static void *
+leafMove(Leaf *leaf, cpFlatBBTree *tree)
+{
+	Leaf *copy = LeafFromPool(tree);
+	(*copy) = (*leaf);
+	
+	return copy;
+}
+
+static size_t
+cpFlatBBTreeTrim(cpFlatBBTree *tree, size_t keepBytes)
+{
+	// Once the tree is built, the only references to the leaves are from the leaf set.
+	if(tree->pending->num > 0 || tree->removed > 0) Rebuild(tree);
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	size_t freed = 0;
+	
+	size_t nodeBytes = sizeof(FlatNode) + sizeof(int);
+	int nodeMax = tree->nodeCount + (int)(keepBytes/nodeBytes);
+	if(nodeMax < tree->nodeMax){
+		freed += (tree->nodeMax - nodeMax)*nodeBytes;
+		if(nodeMax > 0){
+			ResizeNodes(tree, nodeMax);
+		} else {
+			cpAllocatorFree(allocator, tree->nodes);
+			cpAllocatorFree(allocator, tree->parents);
+			tree->nodes = NULL;
+			tree->parents = NULL;
+			tree->nodeMax = 0;
+		}
+	}
+	
+	size_t leafBytes = sizeof(void *) + sizeof(int);
+	int leafMax = tree->leafCount + (int)(keepBytes/leafBytes);
+	if(leafMax < tree->leafMax){
+		freed += (tree->leafMax - leafMax)*leafBytes;
+		if(leafMax > 0){
+			ResizeLeaves(tree, leafMax);
+		} else {
+			cpAllocatorFree(allocator, tree->objs);
+			cpAllocatorFree(allocator, tree->leafNodes);
+			tree->objs = NULL;
+			tree->leafNodes = NULL;
+			tree->leafMax = 0;
+		}
+	}
+	
+	freed += tree->buildLeavesMax*sizeof(BuildLeaf);
+	cpAllocatorFree(allocator, tree->buildLeaves);
+	tree->buildLeaves = NULL;
+	tree->buildLeavesMax = 0;
+	
+	cpArray *buffers = tree->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	tree->pooledLeaves->num = 0;
+	
+	freed += cpHashSetTrim(tree->leaves, (cpHashSetRemapFunc)leafMove, tree, keepBytes);
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		Leaf *buffer = (Leaf *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(tree->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(Leaf);
+			for(int j=0; j<count; j++) cpArrayPush(tree->pooledLeaves, buffer + j);
+		} else {
+			cpAllocatorFree(allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = tree->allocatedBuffers->num*CP_BUFFER_BYTES;
+	return freed + (before > after ? before - after : 0);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpFlatBBTreeDestroy,
+	
+	(cpSpatialIndexCountImpl)cpFlatBBTreeCount,
+	(cpSpatialIndexEachImpl)cpFlatBBTreeEach,
+	(cpSpatialIndexContainsImpl)cpFlatBBTreeContains,
+	
+	(cpSpatialIndexInsertImpl)cpFlatBBTreeInsert,
+	(cpSpatialIndexRemoveImpl)cpFlatBBTreeRemove,
+	
+	(cpSpatialIndexReindexImpl)cpFlatBBTreeReindex,
+	(cpSpatialIndexReindexObjectImpl)cpFlatBBTreeReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpFlatBBTreeReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpFlatBBTreeQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpFlatBBTreeSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpFlatBBTreeTrim,
+	(cpSpatialIndexInsertBatchImpl)cpFlatBBTreeInsertBatch,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -38,25 +38,33 @@ struct cpHashSet {
 	cpHashSetBin *pooledBins;
 	
 	cpArray *allocatedBuffers;
+	const cpAllocator *allocator;
 };
 
 void
 cpHashSetFree(cpHashSet *set)
 {
 	if(set){
-		cpfree(set->table);
+		const cpAllocator *allocator = set->allocator;
+		cpAllocatorFree(allocator, set->table);
 		
-		cpArrayFreeEach(set->allocatedBuffers, cpfree);
+		cpArrayFreeEachBuffer(set->allocatedBuffers);
 		cpArrayFree(set->allocatedBuffers);
 		
-		cpfree(set);
+		cpAllocatorFree(allocator, set);
 	}
 }
 
 cpHashSet *
 cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
 {
-	cpHashSet *set = (cpHashSet *)cpcalloc(1, sizeof(cpHashSet));
+	return cpHashSetNewWithAllocator(size, eqlFunc, NULL);
+}
+
+cpHashSet *
+cpHashSetNewWithAllocator(int size, cpHashSetEqlFunc eqlFunc, const cpAllocator *allocator)
+{
+	cpHashSet *set = (cpHashSet *)cpAllocatorCalloc(allocator, 1, sizeof(cpHashSet));
 	
 	set->size = next_prime(size);
 	set->entries = 0;
@@ -64,10 +72,11 @@ cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
 	set->eql = eqlFunc;
 	set->default_value = NULL;
 	
-	set->table = (cpHashSetBin **)cpcalloc(set->size, sizeof(cpHashSetBin *));
+	set->table = (cpHashSetBin **)cpAllocatorCalloc(allocator, set->size, sizeof(cpHashSetBin *));
 	set->pooledBins = NULL;
 	
-	set->allocatedBuffers = cpArrayNew(0);
+	set->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	set->allocator = allocator;
 	
 	return set;
 }
@@ -85,12 +94,10 @@ setIsFull(cpHashSet *set)
 }
 
 static void
-cpHashSetResize(cpHashSet *set)
+cpHashSetResize(cpHashSet *set, unsigned int newSize)
 {
-	// Get the next approximate doubled prime.
-	unsigned int newSize = next_prime(set->size + 1);
 	// Allocate a new table.
-	cpHashSetBin **newTable = (cpHashSetBin **)cpcalloc(newSize, sizeof(cpHashSetBin *));
+	cpHashSetBin **newTable = (cpHashSetBin **)cpAllocatorCalloc(set->allocator, newSize, sizeof(cpHashSetBin *));
 	
 	// Iterate over the chains.
 	for(unsigned int i=0; i<set->size; i++){
@@ -107,7 +114,7 @@ cpHashSetResize(cpHashSet *set)
 		}
 	}
 	
-	cpfree(set->table);
+	cpAllocatorFree(set->allocator, set->table);
 	
 	set->table = newTable;
 	set->size = newSize;
@@ -134,7 +141,7 @@ getUnusedBin(cpHashSet *set)
 		int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
 		cpAssertHard(count, "Internal Error: Buffer size is too small.");
 		
-		cpHashSetBin *buffer = (cpHashSetBin *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpHashSetBin *buffer = (cpHashSetBin *)cpAllocatorCalloc(set->allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(set->allocatedBuffers, buffer);
 		
 		// push all but the first one, return it instead
@@ -169,7 +176,8 @@ cpHashSetInsert(cpHashSet *set, cpHashValue hash, const void *ptr, cpHashSetTran
 		set->table[idx] = bin;
 		
 		set->entries++;
-		if(setIsFull(set)) cpHashSetResize(set);
+		// Grow to the next approximate doubled prime.
+		if(setIsFull(set)) cpHashSetResize(set, next_prime(set->size + 1));
 	}
 	
 	return bin->elt;
@@ -251,3 +259,51 @@ cpHashSetFilter(cpHashSet *set, cpHashSetFilterFunc func, void *data)
 		}
 	}
 }
+
+size_t
+cpHashSetTrim(cpHashSet *set, cpHashSetRemapFunc remap, void *data, size_t keepBytes)
+{
+	cpArray *buffers = set->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES + set->size*sizeof(cpHashSetBin *);
+	
+	set->allocatedBuffers = cpArrayNewWithAllocator(0, set->allocator);
+	set->pooledBins = NULL;
+	
+	// Copy the live bins into fresh buffers, keeping the chains in the same order.
+	for(unsigned int i=0; i<set->size; i++){
+		cpHashSetBin **prev_ptr = &set->table[i];
+		for(cpHashSetBin *bin = set->table[i]; bin; bin = bin->next){
+			cpHashSetBin *copy = getUnusedBin(set);
+			copy->hash = bin->hash;
+			copy->elt = (remap ? remap(bin->elt, data) : bin->elt);
+			
+			(*prev_ptr) = copy;
+			prev_ptr = &copy->next;
+		}
+		
+		(*prev_ptr) = NULL;
+	}
+	
+	// Shrink the table if it's mostly empty.
+	unsigned int newSize = next_prime(2*set->entries + 1);
+	if(newSize < set->size/2) cpHashSetResize(set, newSize);
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		cpHashSetBin *buffer = (cpHashSetBin *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(set->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
+			for(int j=0; j<count; j++) recycleBin(set, buffer + j);
+		} else {
+			cpAllocatorFree(set->allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = set->allocatedBuffers->num*CP_BUFFER_BYTES + set->size*sizeof(cpHashSetBin *);
+	return (before > after ? before - after : 0);
+}
@@ -1,6 +1,11 @@
 // Copyright 2013 Howling Moon Software. All rights reserved.
 // See http://chipmunk2d.net/legal.php for more information.
 
+// Needed for sched_getaffinity() and CPU_COUNT().
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -8,7 +13,11 @@
 
 //#include <sys/param.h >
 #ifndef _WIN32
+#ifdef __APPLE__
 #include <sys/sysctl.h>
+#endif
+#include <sched.h>
+#include <unistd.h>
 #include <pthread.h>
 #else
 #ifndef WIN32_LEAN_AND_MEAN
@@ -374,16 +383,474 @@ cpArbiterApplyImpulse_NEON(cpArbiter *arb)
 
 #endif
 
+//MARK: Solver Bodies
+
+// Dense copy of the velocity state of a body used by the colored and island solvers.
+// Exactly one 64 byte cache line when using doubles, instead of chasing pointers into scattered cpBody structs.
+struct cpSolverBody {
+	cpVect v;
+	cpFloat w;
+	
+	cpVect v_bias;
+	cpFloat w_bias;
+	
+	cpFloat m_inv, i_inv;
+};
+
+static inline void
+SolverBodyLoad(struct cpSolverBody *solver_body, cpBody *body)
+{
+	solver_body->v = body->v;
+	solver_body->w = body->w;
+	solver_body->v_bias = body->v_bias;
+	solver_body->w_bias = body->w_bias;
+	solver_body->m_inv = body->m_inv;
+	solver_body->i_inv = body->i_inv;
+}
+
+// Static and kinematic bodies are shared by the batches and islands that are solved at the same time.
+// Impulses can't change them since their inverse mass and moment are zero, so they are only ever read while solving.
+// Matches body_is_immovable() for cpBody.
+static inline cpBool
+SolverBodyIsDynamic(const struct cpSolverBody *solver_body)
+{
+	return (solver_body->m_inv != 0.0f || solver_body->i_inv != 0.0f);
+}
+
+static inline void
+SolverBodyLoadVelocity(struct cpSolverBody *solver_body, cpBody *body)
+{
+	if(!SolverBodyIsDynamic(solver_body)) return;
+	
+	solver_body->v = body->v;
+	solver_body->w = body->w;
+	solver_body->v_bias = body->v_bias;
+	solver_body->w_bias = body->w_bias;
+}
+
+static inline void
+SolverBodyStore(struct cpSolverBody *solver_body, cpBody *body)
+{
+	if(!SolverBodyIsDynamic(solver_body)) return;
+	
+	body->v = solver_body->v;
+	body->w = solver_body->w;
+	body->v_bias = solver_body->v_bias;
+	body->w_bias = solver_body->w_bias;
+}
+
+// Same as cpArbiterApplyImpulse(), but using solver bodies.
+static void
+SolverArbiterApplyImpulse(cpArbiter *arb, struct cpSolverBody *a, struct cpSolverBody *b)
+{
+	// Only dynamic bodies are written to, see SolverBodyIsDynamic().
+	cpBool dynamic_a = SolverBodyIsDynamic(a), dynamic_b = SolverBodyIsDynamic(b);
+	
+	cpVect n = arb->n;
+	cpVect surface_vr = arb->surface_vr;
+	cpFloat friction = arb->u;
+
+	for(int i=0; i<arb->count; i++){
+		struct cpContact *con = &arb->contacts[i];
+		cpFloat nMass = con->nMass;
+		cpVect r1 = con->r1;
+		cpVect r2 = con->r2;
+		
+		cpVect vb1 = cpvadd(a->v_bias, cpvmult(cpvperp(r1), a->w_bias));
+		cpVect vb2 = cpvadd(b->v_bias, cpvmult(cpvperp(r2), b->w_bias));
+		cpVect v1_sum = cpvadd(a->v, cpvmult(cpvperp(r1), a->w));
+		cpVect v2_sum = cpvadd(b->v, cpvmult(cpvperp(r2), b->w));
+		cpVect vr = cpvadd(cpvsub(v2_sum, v1_sum), surface_vr);
+		
+		cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
+		cpFloat vrn = cpvdot(vr, n);
+		cpFloat vrt = cpvdot(vr, cpvperp(n));
+		
+		cpFloat jbn = (con->bias - vbn)*nMass;
+		cpFloat jbnOld = con->jBias;
+		con->jBias = cpfmax(jbnOld + jbn, 0.0f);
+		
+		cpFloat jn = -(con->bounce + vrn)*nMass;
+		cpFloat jnOld = con->jnAcc;
+		con->jnAcc = cpfmax(jnOld + jn, 0.0f);
+		
+		cpFloat jtMax = friction*con->jnAcc;
+		cpFloat jt = -vrt*con->tMass;
+		cpFloat jtOld = con->jtAcc;
+		con->jtAcc = cpfclamp(jtOld + jt, -jtMax, jtMax);
+		
+		cpVect jb = cpvmult(n, con->jBias - jbnOld);
+		cpVect j = cpvrotate(n, cpv(con->jnAcc - jnOld, con->jtAcc - jtOld));
+		
+		if(dynamic_a){
+			a->v_bias = cpvadd(a->v_bias, cpvmult(cpvneg(jb), a->m_inv));
+			a->w_bias += a->i_inv*cpvcross(r1, cpvneg(jb));
+			a->v = cpvadd(a->v, cpvmult(cpvneg(j), a->m_inv));
+			a->w += a->i_inv*cpvcross(r1, cpvneg(j));
+		}
+		
+		if(dynamic_b){
+			b->v_bias = cpvadd(b->v_bias, cpvmult(jb, b->m_inv));
+			b->w_bias += b->i_inv*cpvcross(r2, jb);
+			b->v = cpvadd(b->v, cpvmult(j, b->m_inv));
+			b->w += b->i_inv*cpvcross(r2, j);
+		}
+	}
+}
+
+// Constraints only know how to work with cpBody, so their bodies are synced around each impulse.
+// Static and kinematic bodies are skipped by the sync and by the constraint impulse functions, see body_is_immovable().
+static inline void
+SolverConstraintApplyImpulse(cpConstraint *constraint, struct cpSolverBody *bodies, cpFloat dt)
+{
+	cpBody *a = constraint->a, *b = constraint->b;
+	struct cpSolverBody *solver_a = bodies + a->solver.index;
+	struct cpSolverBody *solver_b = bodies + b->solver.index;
+	
+	SolverBodyStore(solver_a, a);
+	SolverBodyStore(solver_b, b);
+	constraint->klass->applyImpulse(constraint, dt);
+	SolverBodyLoadVelocity(solver_a, a);
+	SolverBodyLoadVelocity(solver_b, b);
+}
+
+//MARK: SIMD Contact Solver
+
+// Arbiters from a colored batch are packed CONTACT_GROUP_WIDTH at a time into structure of arrays groups.
+// The lanes of a group never share a dynamic body, so the group's velocities can be gathered once,
+// the contacts solved one slot at a time across all lanes, and the velocities scattered back.
+// The math mirrors cpArbiterApplyImpulse() operation for operation.
+
+#if defined(__AVX__)
+	// Also enabled when targeting AVX2.
+	#include <immintrin.h>
+	
+	#if CP_USE_DOUBLES
+		typedef __m256d cpSIMDFloat;
+		#define CONTACT_GROUP_WIDTH 4
+		#define simd_load _mm256_loadu_pd
+		#define simd_store _mm256_storeu_pd
+		#define simd_set1 _mm256_set1_pd
+		#define simd_add _mm256_add_pd
+		#define simd_sub _mm256_sub_pd
+		#define simd_mul _mm256_mul_pd
+		#define simd_min _mm256_min_pd
+		#define simd_max _mm256_max_pd
+		#define simd_neg(__a) _mm256_xor_pd(__a, _mm256_set1_pd(-0.0))
+		#define simd_mask(__a) _mm256_cmp_pd(__a, _mm256_setzero_pd(), _CMP_GT_OQ)
+		#define simd_select(__mask, __a, __b) _mm256_blendv_pd(__b, __a, __mask)
+	#else
+		typedef __m256 cpSIMDFloat;
+		#define CONTACT_GROUP_WIDTH 8
+		#define simd_load _mm256_loadu_ps
+		#define simd_store _mm256_storeu_ps
+		#define simd_set1 _mm256_set1_ps
+		#define simd_add _mm256_add_ps
+		#define simd_sub _mm256_sub_ps
+		#define simd_mul _mm256_mul_ps
+		#define simd_min _mm256_min_ps
+		#define simd_max _mm256_max_ps
+		#define simd_neg(__a) _mm256_xor_ps(__a, _mm256_set1_ps(-0.0f))
+		#define simd_mask(__a) _mm256_cmp_ps(__a, _mm256_setzero_ps(), _CMP_GT_OQ)
+		#define simd_select(__mask, __a, __b) _mm256_blendv_ps(__b, __a, __mask)
+	#endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	
+	#if CP_USE_DOUBLES
+		typedef __m128d cpSIMDFloat;
+		#define CONTACT_GROUP_WIDTH 2
+		#define simd_load _mm_loadu_pd
+		#define simd_store _mm_storeu_pd
+		#define simd_set1 _mm_set1_pd
+		#define simd_add _mm_add_pd
+		#define simd_sub _mm_sub_pd
+		#define simd_mul _mm_mul_pd
+		#define simd_min _mm_min_pd
+		#define simd_max _mm_max_pd
+		#define simd_neg(__a) _mm_xor_pd(__a, _mm_set1_pd(-0.0))
+		#define simd_mask(__a) _mm_cmpgt_pd(__a, _mm_setzero_pd())
+		#define simd_select(__mask, __a, __b) _mm_or_pd(_mm_and_pd(__mask, __a), _mm_andnot_pd(__mask, __b))
+	#else
+		typedef __m128 cpSIMDFloat;
+		#define CONTACT_GROUP_WIDTH 4
+		#define simd_load _mm_loadu_ps
+		#define simd_store _mm_storeu_ps
+		#define simd_set1 _mm_set1_ps
+		#define simd_add _mm_add_ps
+		#define simd_sub _mm_sub_ps
+		#define simd_mul _mm_mul_ps
+		#define simd_min _mm_min_ps
+		#define simd_max _mm_max_ps
+		#define simd_neg(__a) _mm_xor_ps(__a, _mm_set1_ps(-0.0f))
+		#define simd_mask(__a) _mm_cmpgt_ps(__a, _mm_setzero_ps())
+		#define simd_select(__mask, __a, __b) _mm_or_ps(_mm_and_ps(__mask, __a), _mm_andnot_ps(__mask, __b))
+	#endif
+#else
+	// Portable single lane fallback.
+	typedef cpFloat cpSIMDFloat;
+	#define CONTACT_GROUP_WIDTH 1
+	#define simd_load(__p) (*(__p))
+	#define simd_store(__p, __a) (*(__p) = (__a))
+	#define simd_set1(__a) ((cpFloat)(__a))
+	#define simd_add(__a, __b) ((__a) + (__b))
+	#define simd_sub(__a, __b) ((__a) - (__b))
+	#define simd_mul(__a, __b) ((__a)*(__b))
+	#define simd_min cpfmin
+	#define simd_max cpfmax
+	#define simd_neg(__a) (-(__a))
+	#define simd_mask(__a) (__a)
+	#define simd_select(__mask, __a, __b) ((__mask) > 0.0f ? (__a) : (__b))
+#endif
+
+struct ContactGroupSlot {
+	// 1 for the lanes that have a contact in this slot, 0 otherwise.
+	cpFloat active[CONTACT_GROUP_WIDTH];
+	
+	cpFloat r1x[CONTACT_GROUP_WIDTH], r1y[CONTACT_GROUP_WIDTH];
+	cpFloat r2x[CONTACT_GROUP_WIDTH], r2y[CONTACT_GROUP_WIDTH];
+	cpFloat nMass[CONTACT_GROUP_WIDTH], tMass[CONTACT_GROUP_WIDTH];
+	cpFloat bounce[CONTACT_GROUP_WIDTH], bias[CONTACT_GROUP_WIDTH];
+	cpFloat jnAcc[CONTACT_GROUP_WIDTH], jtAcc[CONTACT_GROUP_WIDTH], jBias[CONTACT_GROUP_WIDTH];
+};
+
+struct ContactGroup {
+	struct ContactGroupSlot slots[CP_MAX_CONTACTS_PER_ARBITER];
+	
+	cpFloat nx[CONTACT_GROUP_WIDTH], ny[CONTACT_GROUP_WIDTH];
+	cpFloat surface_vrx[CONTACT_GROUP_WIDTH], surface_vry[CONTACT_GROUP_WIDTH];
+	cpFloat friction[CONTACT_GROUP_WIDTH];
+	
+	// Arbiters packed into the group, 'count' long, and the solver body indexes of their bodies (a then b).
+	cpArbiter **arbiters;
+	const int *bodies;
+	int count;
+	
+	// Number of slots used by at least one lane.
+	int slots_used;
+	
+	// Solver body indexes for each lane.
+	int a[CONTACT_GROUP_WIDTH], b[CONTACT_GROUP_WIDTH];
+};
+
+// Unused lanes point at 'empty_body', a solver body that is all zeros and never written back.
+static void
+ContactGroupPack(struct ContactGroup *group, int empty_body)
+{
+	cpArbiter **arbiters = group->arbiters;
+	int count = group->count;
+	group->slots_used = 0;
+	
+	for(int lane=0; lane<CONTACT_GROUP_WIDTH; lane++){
+		cpArbiter *arb = (lane < count ? arbiters[lane] : NULL);
+		int contacts = (arb ? arb->count : 0);
+		if(contacts > group->slots_used) group->slots_used = contacts;
+		
+		group->a[lane] = (arb ? group->bodies[2*lane + 0] : empty_body);
+		group->b[lane] = (arb ? group->bodies[2*lane + 1] : empty_body);
+		group->nx[lane] = (arb ? arb->n.x : 0.0f);
+		group->ny[lane] = (arb ? arb->n.y : 0.0f);
+		group->surface_vrx[lane] = (arb ? arb->surface_vr.x : 0.0f);
+		group->surface_vry[lane] = (arb ? arb->surface_vr.y : 0.0f);
+		group->friction[lane] = (arb ? arb->u : 0.0f);
+		
+		for(int i=0; i<CP_MAX_CONTACTS_PER_ARBITER; i++){
+			struct ContactGroupSlot *slot = group->slots + i;
+			
+			if(i < contacts){
+				struct cpContact *con = arb->contacts + i;
+				slot->active[lane] = 1.0f;
+				slot->r1x[lane] = con->r1.x; slot->r1y[lane] = con->r1.y;
+				slot->r2x[lane] = con->r2.x; slot->r2y[lane] = con->r2.y;
+				slot->nMass[lane] = con->nMass; slot->tMass[lane] = con->tMass;
+				slot->bounce[lane] = con->bounce; slot->bias[lane] = con->bias;
+				slot->jnAcc[lane] = con->jnAcc; slot->jtAcc[lane] = con->jtAcc; slot->jBias[lane] = con->jBias;
+			} else {
+				slot->active[lane] = 0.0f;
+				slot->r1x[lane] = slot->r1y[lane] = slot->r2x[lane] = slot->r2y[lane] = 0.0f;
+				slot->nMass[lane] = slot->tMass[lane] = slot->bounce[lane] = slot->bias[lane] = 0.0f;
+				slot->jnAcc[lane] = slot->jtAcc[lane] = slot->jBias[lane] = 0.0f;
+			}
+		}
+	}
+}
+
+// Copy the accumulated impulses back to the arbiters' contacts.
+static void
+ContactGroupUnpack(struct ContactGroup *group)
+{
+	for(int lane=0; lane<group->count; lane++){
+		cpArbiter *arb = group->arbiters[lane];
+		
+		for(int i=0; i<arb->count; i++){
+			struct ContactGroupSlot *slot = group->slots + i;
+			struct cpContact *con = arb->contacts + i;
+			con->jnAcc = slot->jnAcc[lane];
+			con->jtAcc = slot->jtAcc[lane];
+			con->jBias = slot->jBias[lane];
+		}
+	}
+}
+
+#define GATHER(__dst, __indexes, __field) {for(int lane=0; lane<CONTACT_GROUP_WIDTH; lane++) __dst[lane] = bodies[__indexes[lane]].__field;}
+// Only dynamic bodies are written back, see SolverBodyIsDynamic().
+#define SCATTER(__indexes, __field, __src) {for(int lane=0; lane<count; lane++) if(SolverBodyIsDynamic(bodies + __indexes[lane])) bodies[__indexes[lane]].__field = __src[lane];}
+
+static void
+ContactGroupApplyImpulse(struct ContactGroup *group, struct cpSolverBody *bodies)
+{
+	cpFloat tmp[12][CONTACT_GROUP_WIDTH];
+	
+	GATHER(tmp[0], group->a, v.x); GATHER(tmp[1], group->a, v.y); GATHER(tmp[2], group->a, w);
+	GATHER(tmp[3], group->a, v_bias.x); GATHER(tmp[4], group->a, v_bias.y); GATHER(tmp[5], group->a, w_bias);
+	GATHER(tmp[6], group->b, v.x); GATHER(tmp[7], group->b, v.y); GATHER(tmp[8], group->b, w);
+	GATHER(tmp[9], group->b, v_bias.x); GATHER(tmp[10], group->b, v_bias.y); GATHER(tmp[11], group->b, w_bias);
+	
+	cpSIMDFloat a_vx = simd_load(tmp[0]), a_vy = simd_load(tmp[1]), a_w = simd_load(tmp[2]);
+	cpSIMDFloat a_vbx = simd_load(tmp[3]), a_vby = simd_load(tmp[4]), a_wb = simd_load(tmp[5]);
+	cpSIMDFloat b_vx = simd_load(tmp[6]), b_vy = simd_load(tmp[7]), b_w = simd_load(tmp[8]);
+	cpSIMDFloat b_vbx = simd_load(tmp[9]), b_vby = simd_load(tmp[10]), b_wb = simd_load(tmp[11]);
+	
+	GATHER(tmp[0], group->a, m_inv); GATHER(tmp[1], group->a, i_inv);
+	GATHER(tmp[2], group->b, m_inv); GATHER(tmp[3], group->b, i_inv);
+	cpSIMDFloat a_m_inv = simd_load(tmp[0]), a_i_inv = simd_load(tmp[1]);
+	cpSIMDFloat b_m_inv = simd_load(tmp[2]), b_i_inv = simd_load(tmp[3]);
+	
+	cpSIMDFloat nx = simd_load(group->nx), ny = simd_load(group->ny);
+	cpSIMDFloat surface_vrx = simd_load(group->surface_vrx), surface_vry = simd_load(group->surface_vry);
+	cpSIMDFloat friction = simd_load(group->friction);
+	cpSIMDFloat zero = simd_set1(0.0f);
+	
+	for(int i=0; i<group->slots_used; i++){
+		struct ContactGroupSlot *slot = group->slots + i;
+		cpSIMDFloat mask = simd_mask(simd_load(slot->active));
+		cpSIMDFloat nMass = simd_load(slot->nMass);
+		cpSIMDFloat r1x = simd_load(slot->r1x), r1y = simd_load(slot->r1y);
+		cpSIMDFloat r2x = simd_load(slot->r2x), r2y = simd_load(slot->r2y);
+		
+		cpSIMDFloat vb1x = simd_add(a_vbx, simd_mul(simd_neg(r1y), a_wb));
+		cpSIMDFloat vb1y = simd_add(a_vby, simd_mul(r1x, a_wb));
+		cpSIMDFloat vb2x = simd_add(b_vbx, simd_mul(simd_neg(r2y), b_wb));
+		cpSIMDFloat vb2y = simd_add(b_vby, simd_mul(r2x, b_wb));
+		
+		cpSIMDFloat v1x = simd_add(a_vx, simd_mul(simd_neg(r1y), a_w));
+		cpSIMDFloat v1y = simd_add(a_vy, simd_mul(r1x, a_w));
+		cpSIMDFloat v2x = simd_add(b_vx, simd_mul(simd_neg(r2y), b_w));
+		cpSIMDFloat v2y = simd_add(b_vy, simd_mul(r2x, b_w));
+		cpSIMDFloat vrx = simd_add(simd_sub(v2x, v1x), surface_vrx);
+		cpSIMDFloat vry = simd_add(simd_sub(v2y, v1y), surface_vry);
+		
+		cpSIMDFloat vbn = simd_add(simd_mul(simd_sub(vb2x, vb1x), nx), simd_mul(simd_sub(vb2y, vb1y), ny));
+		cpSIMDFloat vrn = simd_add(simd_mul(vrx, nx), simd_mul(vry, ny));
+		cpSIMDFloat vrt = simd_add(simd_mul(vrx, simd_neg(ny)), simd_mul(vry, nx));
+		
+		cpSIMDFloat jbn = simd_mul(simd_sub(simd_load(slot->bias), vbn), nMass);
+		cpSIMDFloat jbnOld = simd_load(slot->jBias);
+		cpSIMDFloat jBias = simd_max(simd_add(jbnOld, jbn), zero);
+		
+		cpSIMDFloat jn = simd_mul(simd_neg(simd_add(simd_load(slot->bounce), vrn)), nMass);
+		cpSIMDFloat jnOld = simd_load(slot->jnAcc);
+		cpSIMDFloat jnAcc = simd_max(simd_add(jnOld, jn), zero);
+		
+		cpSIMDFloat jtMax = simd_mul(friction, jnAcc);
+		cpSIMDFloat jt = simd_mul(simd_neg(vrt), simd_load(slot->tMass));
+		cpSIMDFloat jtOld = simd_load(slot->jtAcc);
+		cpSIMDFloat jtAcc = simd_min(simd_max(simd_add(jtOld, jt), simd_neg(jtMax)), jtMax);
+		
+		simd_store(slot->jBias, jBias);
+		simd_store(slot->jnAcc, jnAcc);
+		simd_store(slot->jtAcc, jtAcc);
+		
+		// Bias impulse.
+		cpSIMDFloat djb = simd_sub(jBias, jbnOld);
+		cpSIMDFloat jx = simd_mul(nx, djb), jy = simd_mul(ny, djb);
+		cpSIMDFloat njx = simd_neg(jx), njy = simd_neg(jy);
+		a_vbx = simd_select(mask, simd_add(a_vbx, simd_mul(njx, a_m_inv)), a_vbx);
+		a_vby = simd_select(mask, simd_add(a_vby, simd_mul(njy, a_m_inv)), a_vby);
+		a_wb = simd_select(mask, simd_add(a_wb, simd_mul(a_i_inv, simd_sub(simd_mul(r1x, njy), simd_mul(r1y, njx)))), a_wb);
+		b_vbx = simd_select(mask, simd_add(b_vbx, simd_mul(jx, b_m_inv)), b_vbx);
+		b_vby = simd_select(mask, simd_add(b_vby, simd_mul(jy, b_m_inv)), b_vby);
+		b_wb = simd_select(mask, simd_add(b_wb, simd_mul(b_i_inv, simd_sub(simd_mul(r2x, jy), simd_mul(r2y, jx)))), b_wb);
+		
+		// Normal and friction impulse, n rotated by (jn, jt).
+		cpSIMDFloat djn = simd_sub(jnAcc, jnOld), djt = simd_sub(jtAcc, jtOld);
+		jx = simd_sub(simd_mul(nx, djn), simd_mul(ny, djt));
+		jy = simd_add(simd_mul(nx, djt), simd_mul(ny, djn));
+		njx = simd_neg(jx), njy = simd_neg(jy);
+		a_vx = simd_select(mask, simd_add(a_vx, simd_mul(njx, a_m_inv)), a_vx);
+		a_vy = simd_select(mask, simd_add(a_vy, simd_mul(njy, a_m_inv)), a_vy);
+		a_w = simd_select(mask, simd_add(a_w, simd_mul(a_i_inv, simd_sub(simd_mul(r1x, njy), simd_mul(r1y, njx)))), a_w);
+		b_vx = simd_select(mask, simd_add(b_vx, simd_mul(jx, b_m_inv)), b_vx);
+		b_vy = simd_select(mask, simd_add(b_vy, simd_mul(jy, b_m_inv)), b_vy);
+		b_w = simd_select(mask, simd_add(b_w, simd_mul(b_i_inv, simd_sub(simd_mul(r2x, jy), simd_mul(r2y, jx)))), b_w);
+	}
+	
+	simd_store(tmp[0], a_vx); simd_store(tmp[1], a_vy); simd_store(tmp[2], a_w);
+	simd_store(tmp[3], a_vbx); simd_store(tmp[4], a_vby); simd_store(tmp[5], a_wb);
+	simd_store(tmp[6], b_vx); simd_store(tmp[7], b_vy); simd_store(tmp[8], b_w);
+	simd_store(tmp[9], b_vbx); simd_store(tmp[10], b_vby); simd_store(tmp[11], b_wb);
+	
+	int count = group->count;
+	SCATTER(group->a, v.x, tmp[0]); SCATTER(group->a, v.y, tmp[1]); SCATTER(group->a, w, tmp[2]);
+	SCATTER(group->a, v_bias.x, tmp[3]); SCATTER(group->a, v_bias.y, tmp[4]); SCATTER(group->a, w_bias, tmp[5]);
+	SCATTER(group->b, v.x, tmp[6]); SCATTER(group->b, v.y, tmp[7]); SCATTER(group->b, w, tmp[8]);
+	SCATTER(group->b, v_bias.x, tmp[9]); SCATTER(group->b, v_bias.y, tmp[10]); SCATTER(group->b, w_bias, tmp[11]);
+}
+
+//MARK: Atomics
+
+#ifdef _WIN32
+	typedef volatile LONG cpAtomicInt;
+	
+	static inline long AtomicLoad(cpAtomicInt *p){return InterlockedCompareExchange(p, 0, 0);}
+	static inline void AtomicStore(cpAtomicInt *p, long value){InterlockedExchange(p, value);}
+	static inline long AtomicAdd(cpAtomicInt *p, long value){return InterlockedExchangeAdd(p, value) + value;}
+	
+	#define CPU_RELAX() YieldProcessor()
+	#define THREAD_YIELD() SwitchToThread()
+#else
+	typedef volatile long cpAtomicInt;
+	
+	static inline long AtomicLoad(cpAtomicInt *p){return __atomic_load_n(p, __ATOMIC_SEQ_CST);}
+	static inline void AtomicStore(cpAtomicInt *p, long value){__atomic_store_n(p, value, __ATOMIC_SEQ_CST);}
+	static inline long AtomicAdd(cpAtomicInt *p, long value){return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);}
+	
+	#if defined(__i386__) || defined(__x86_64__)
+		#define CPU_RELAX() __builtin_ia32_pause()
+	#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+		#define CPU_RELAX() __asm__ __volatile__("yield")
+	#else
+		#define CPU_RELAX()
+	#endif
+	
+	#define THREAD_YIELD() sched_yield()
+#endif
+
 //MARK: PThreads
 
-// Right now using more than 2 threads probably wont help your performance any.
-// If you are using a ridiculous number of iterations it could help though.
-#define MAX_THREADS 2
+// How many times to poll before blocking when spin waiting is enabled.
+// Somewhere in the range of 50us to 1ms depending on the CPU.
+#define SPIN_COUNT (1<<14)
+
+// How many times to poll a barrier before yielding the CPU.
+#define BARRIER_SPIN_COUNT (1<<10)
+
+// Maximum number of colors used by the colored solver. Anything that can't be colored is solved serially.
+#define MAX_COLORS 24
+
+// Islands with at least this many arbiters and constraints, and making up at least 1/LARGE_ISLAND_FRACTION
+// of the step's total, are split up with the colored solver instead of being solved as a single task.
+// Neither depends on the thread count so the results don't either.
+#define LARGE_ISLAND_MIN_COUNT 64
+#define LARGE_ISLAND_FRACTION 16
 
 struct ThreadContext {
 	pthread_t thread;
 	cpHastySpace *space;
 	unsigned long thread_num;
+	
+	// Work generation last run by this thread.
+	long generation;
 };
 
 typedef	void (*cpHastySpaceWorkFunction)(cpSpace *space, unsigned long worker, unsigned long worker_count);
@@ -394,19 +861,97 @@ struct cpHastySpace {
 	// Number of worker threads (including the main thread)
 	unsigned long num_threads;
 	
-	// Number of worker threads currently executing. (also including the main thread)
-	unsigned long num_working;
+	// Number of worker threads currently executing. (not including the main thread)
+	cpAtomicInt num_working;
+	
+	// Incremented each time new work is published to the worker threads.
+	cpAtomicInt generation;
+	
+	// Number of worker threads blocked on cond_work, and whether the main thread is blocked on cond_resume.
+	// Threads that are spinning don't need to be signaled, which avoids taking the mutex.
+	cpAtomicInt num_parked, main_parked;
+	
+	// Spin for a while before blocking when waiting for work or for the workers to finish.
+	cpAtomicInt spin_wait;
 	
 	// Number of constraints (plus contacts) that must exist per step to start the worker threads.
 	unsigned long constraint_count_threshold;
 	
+	// Number of collision pairs (or dynamic shapes) that must exist per step to split the collision detection up.
+	unsigned long collision_count_threshold;
+	
+	cpHastySolverMode solver_mode;
+	
+	// Arbiters and constraints sorted by color for the colored solver.
+	// Color i is arbiters[arbiter_batches[i], arbiter_batches[i + 1]) and likewise for the constraints.
+	// The batch at index num_colors holds everything that couldn't be colored.
+	cpArray *colored_arbiters, *colored_constraints;
+	int arbiter_batches[MAX_COLORS + 2], constraint_batches[MAX_COLORS + 2];
+	int num_colors;
+	
+	// Color of each arbiter followed by each constraint, used while sorting.
+	unsigned char *item_colors;
+	int item_colors_max;
+	
+	// Solve the colored arbiters using the SIMD contact groups.
+	cpBool simd_contacts;
+	
+	// Solver bodies for the colored and island solvers, 64 byte aligned inside solver_bodies_buffer.
+	// solver_body_sources[i] is the body copied into solver_bodies[i]. The extra entry at the end is an all zero body.
+	struct cpSolverBody *solver_bodies;
+	void *solver_bodies_buffer;
+	int solver_bodies_max;
+	cpArray *solver_body_sources;
+	
+	// Solver body indexes of the bodies of colored_arbiters and island_arbiters, two per arbiter.
+	int *colored_arbiter_bodies, *island_arbiter_bodies;
+	int colored_arbiter_bodies_max, island_arbiter_bodies_max;
+	
+	// Contact groups for the colored batches. Color i is contact_groups[group_batches[i], group_batches[i + 1]).
+	// 'grouped' is set when the groups are valid for the current step.
+	struct ContactGroup *contact_groups;
+	int contact_groups_max;
+	int group_batches[MAX_COLORS + 1];
+	cpBool grouped;
+	
+	// Island solver data. Bodies are numbered by their index in space->dynamicBodies.
+	// Island i is island_arbiters[island_arbiter_starts[i], island_arbiter_starts[i + 1]) and likewise for the constraints.
+	// The per-body and per-island arrays point into body_island_data and island_data respectively.
+	int *island_parents, *island_ids;
+	int *island_arbiter_starts, *island_constraint_starts, *small_islands;
+	int num_small_islands;
+	int *item_islands;
+	int *body_island_data, *island_data;
+	int item_islands_max, body_island_data_max, island_data_max;
+	cpArray *island_arbiters, *island_constraints;
+	
+	// Arbiters and constraints from the large islands, which are passed to the colored solver.
+	cpArray *large_arbiters, *large_constraints;
+	
+	// Next small island for a worker to claim.
+	cpAtomicInt next_island;
+	
+	// Barrier used to keep the threads in step between batches.
+	cpAtomicInt barrier_count, barrier_generation;
+	
+	// Dynamic shapes gathered each step so their bounding boxes can be updated in parallel.
+	cpArray *dynamicShapes;
+	
+	// Per worker contact buffers for the narrowphase. (num_threads long)
+	struct cpContactArray *contacts;
+	
 	pthread_mutex_t mutex;
 	pthread_cond_t cond_work, cond_resume;
 	
 	// Work function to invoke.
 	cpHastySpaceWorkFunction work;
 	
-	struct ThreadContext workers[MAX_THREADS - 1];
+	// Work passed in by an LBVH dynamic index, see LBVHRunner().
+	cpLBVHWorkFunc lbvh_work;
+	void *lbvh_data;
+	
+	// Worker threads. (num_threads - 1 long)
+	struct ThreadContext *workers;
 };
 
 static void *
@@ -416,22 +961,41 @@ WorkerThreadLoop(struct ThreadContext *context)
 	
 	unsigned long thread = context->thread_num;
 	unsigned long num_threads = hasty->num_threads;
+	long generation = context->generation;
 	
 	for(;;){
-		pthread_mutex_lock(&hasty->mutex); {
-			if(--hasty->num_working == 0){
-				pthread_cond_signal(&hasty->cond_resume);
-			}
-			
-			pthread_cond_wait(&hasty->cond_work, &hasty->mutex);
-		} pthread_mutex_unlock(&hasty->mutex);
+		// Wait for the main thread to publish new work.
+		if(AtomicLoad(&hasty->spin_wait)){
+			for(int i=0; i<SPIN_COUNT && AtomicLoad(&hasty->generation) == generation; i++) CPU_RELAX();
+		}
+		
+		if(AtomicLoad(&hasty->generation) == generation){
+			pthread_mutex_lock(&hasty->mutex); {
+				// Publishing the parked count before checking the generation again
+				// guarantees that either this thread sees the new work or RunWorkers() sees it parked.
+				AtomicAdd(&hasty->num_parked, 1);
+				while(AtomicLoad(&hasty->generation) == generation){
+					pthread_cond_wait(&hasty->cond_work, &hasty->mutex);
+				}
+				AtomicAdd(&hasty->num_parked, -1);
+			} pthread_mutex_unlock(&hasty->mutex);
+		}
+		
+		generation = AtomicLoad(&hasty->generation);
 		
 		cpHastySpaceWorkFunction func = hasty->work;
 		if(func){
-			hasty->work(&hasty->space, thread, num_threads);
+			func(&hasty->space, thread, num_threads);
 		} else {
 			break;
 		}
+		
+		// The last worker to finish wakes up the main thread if it stopped spinning.
+		if(AtomicAdd(&hasty->num_working, -1) == 0 && AtomicLoad(&hasty->main_parked)){
+			pthread_mutex_lock(&hasty->mutex); {
+				pthread_cond_signal(&hasty->cond_resume);
+			} pthread_mutex_unlock(&hasty->mutex);
+		}
 	}
 	
 	return NULL;
@@ -440,23 +1004,37 @@ WorkerThreadLoop(struct ThreadContext *context)
 static void
 RunWorkers(cpHastySpace *hasty, cpHastySpaceWorkFunction func)
 {
-	hasty->num_working = hasty->num_threads - 1;
-	hasty->work = func;
+	unsigned long num_threads = hasty->num_threads;
 	
-	if(hasty->num_working > 0){
-		pthread_mutex_lock(&hasty->mutex); {
-			pthread_cond_broadcast(&hasty->cond_work);
-		} pthread_mutex_unlock(&hasty->mutex);
+	if(num_threads > 1){
+		hasty->work = func;
+		AtomicStore(&hasty->num_working, num_threads - 1);
+		AtomicAdd(&hasty->generation, 1);
 		
-		func((cpSpace *)hasty, 0, hasty->num_threads);
-			
-		pthread_mutex_lock(&hasty->mutex); {
-			if(hasty->num_working > 0){
-				pthread_cond_wait(&hasty->cond_resume, &hasty->mutex);
-			}
-		} pthread_mutex_unlock(&hasty->mutex);
+		// Only parked workers need to be woken up. Spinning ones will notice the new generation on their own.
+		if(AtomicLoad(&hasty->num_parked) > 0){
+			pthread_mutex_lock(&hasty->mutex); {
+				pthread_cond_broadcast(&hasty->cond_work);
+			} pthread_mutex_unlock(&hasty->mutex);
+		}
+		
+		func((cpSpace *)hasty, 0, num_threads);
+		
+		if(AtomicLoad(&hasty->spin_wait)){
+			for(int i=0; i<SPIN_COUNT && AtomicLoad(&hasty->num_working) > 0; i++) CPU_RELAX();
+		}
+		
+		if(AtomicLoad(&hasty->num_working) > 0){
+			pthread_mutex_lock(&hasty->mutex); {
+				AtomicStore(&hasty->main_parked, cpTrue);
+				while(AtomicLoad(&hasty->num_working) > 0){
+					pthread_cond_wait(&hasty->cond_resume, &hasty->mutex);
+				}
+				AtomicStore(&hasty->main_parked, cpFalse);
+			} pthread_mutex_unlock(&hasty->mutex);
+		}
 	} else {
-		func((cpSpace *)hasty, 0, hasty->num_threads);
+		func((cpSpace *)hasty, 0, num_threads);
 	}
 	
 	hasty->work = NULL;
@@ -488,14 +1066,627 @@ Solver(cpSpace *space, unsigned long worker, unsigned long worker_count)
 	}
 }
 
+static inline void
+WorkRange(int count, unsigned long worker, unsigned long worker_count, int *begin, int *end)
+{
+	*begin = (int)(count*worker/worker_count);
+	*end = (int)(count*(worker + 1)/worker_count);
+}
+
+static void
+UpdateBBs(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpArray *shapes = ((cpHastySpace *)space)->dynamicShapes;
+	
+	int begin, end;
+	WorkRange(shapes->num, worker, worker_count, &begin, &end);
+	
+	for(int i=begin; i<end; i++) cpShapeCacheBB((cpShape *)shapes->arr[i]);
+}
+
+static void
+Narrowphase(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	struct cpContactArray *contacts = ((cpHastySpace *)space)->contacts + worker;
+	contacts->num = 0;
+	
+	int begin, end;
+	WorkRange(space->collisionPairs.num, worker, worker_count, &begin, &end);
+	cpSpaceCollidePairs(space, begin, end, contacts);
+}
+
+static void
+LBVHWork(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	hasty->lbvh_work(hasty->lbvh_data, worker, worker_count);
+}
+
+static void
+LBVHRunner(cpLBVHWorkFunc func, void *data, cpHastySpace *hasty)
+{
+	hasty->lbvh_work = func;
+	hasty->lbvh_data = data;
+	RunWorkers(hasty, LBVHWork);
+}
+
+static void
+GatherShape(cpShape *shape, cpArray *shapes)
+{
+	cpArrayPush(shapes, shape);
+}
+
+//MARK: Colored Solver
+
+// Block until all 'worker_count' threads reach the barrier.
+static void
+BarrierWait(cpHastySpace *hasty, unsigned long worker_count)
+{
+	long generation = AtomicLoad(&hasty->barrier_generation);
+	
+	if(AtomicAdd(&hasty->barrier_count, 1) == (long)worker_count){
+		// Last thread to arrive resets the count and releases the others.
+		AtomicStore(&hasty->barrier_count, 0);
+		AtomicAdd(&hasty->barrier_generation, 1);
+	} else {
+		for(int i=0; AtomicLoad(&hasty->barrier_generation) == generation; i++){
+			if(i < BARRIER_SPIN_COUNT){
+				CPU_RELAX();
+			} else {
+				THREAD_YIELD();
+			}
+		}
+	}
+}
+
+// Only dynamic bodies can conflict. The solver never writes to static and kinematic bodies, see SolverBodyIsDynamic().
+// The colors are reset by PrepareSolverBodies().
+static inline uint64_t
+BodyColors(cpBody *body)
+{
+	return (body_is_immovable(body) ? 0 : body->solver.colors);
+}
+
+// Greedily pick the lowest color not already used by either body.
+static inline int
+ColorItem(cpBody *a, cpBody *b)
+{
+	uint64_t used = BodyColors(a) | BodyColors(b);
+	
+	for(int color=0; color<MAX_COLORS; color++){
+		uint64_t bit = (uint64_t)1 << color;
+		if((used & bit) == 0){
+			if(!body_is_immovable(a)) a->solver.colors |= bit;
+			if(!body_is_immovable(b)) b->solver.colors |= bit;
+			return color;
+		}
+	}
+	
+	return MAX_COLORS;
+}
+
+static void
+SortByColor(cpArray *items, cpArray *sorted, const unsigned char *colors, int *batches, int num_colors)
+{
+	if(sorted->max < items->num){
+		sorted->max = items->num;
+		sorted->arr = (void **)cpAllocatorRealloc(sorted->allocator, sorted->arr, sorted->max*sizeof(void *));
+	}
+	sorted->num = items->num;
+	
+	// Counting sort. Stable, so the order within a batch is deterministic.
+	memset(batches, 0, (num_colors + 2)*sizeof(int));
+	for(int i=0; i<items->num; i++) batches[colors[i] + 1]++;
+	for(int i=0; i<=num_colors; i++) batches[i + 1] += batches[i];
+	
+	int cursor[MAX_COLORS + 1];
+	memcpy(cursor, batches, (num_colors + 1)*sizeof(int));
+	for(int i=0; i<items->num; i++) sorted->arr[cursor[colors[i]]++] = items->arr[i];
+}
+
+static void *
+GrowBuffer(const cpAllocator *allocator, void *buffer, int *max, int count, size_t size)
+{
+	if(*max < count){
+		*max = count;
+		buffer = cpAllocatorRealloc(allocator, buffer, count*size);
+	}
+	
+	return buffer;
+}
+
+// Fill in the solver body indexes for a list of arbiters.
+static int *
+ArbiterBodyIndexes(const cpAllocator *allocator, cpArray *arbiters, int *indexes, int *max)
+{
+	indexes = (int *)GrowBuffer(allocator, indexes, max, 2*arbiters->num, sizeof(int));
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		indexes[2*i + 0] = arb->body_a->solver.index;
+		indexes[2*i + 1] = arb->body_b->solver.index;
+	}
+	
+	return indexes;
+}
+
+static void
+ColorConstraints(cpHastySpace *hasty, cpArray *arbiters, cpArray *constraints)
+{
+	int count = arbiters->num + constraints->num;
+	hasty->item_colors = (unsigned char *)GrowBuffer(cpSpaceAllocator((cpSpace *)hasty), hasty->item_colors, &hasty->item_colors_max, count, sizeof(unsigned char));
+	
+	unsigned char *arbiter_colors = hasty->item_colors;
+	unsigned char *constraint_colors = hasty->item_colors + arbiters->num;
+	int num_colors = 0;
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		int color = ColorItem(arb->body_a, arb->body_b);
+		if(color < MAX_COLORS && color >= num_colors) num_colors = color + 1;
+		arbiter_colors[i] = (unsigned char)color;
+	}
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		int color = ColorItem(constraint->a, constraint->b);
+		if(color < MAX_COLORS && color >= num_colors) num_colors = color + 1;
+		constraint_colors[i] = (unsigned char)color;
+	}
+	
+	// Move the overflow batch down to sit right after the last used color.
+	for(int i=0; i<count; i++){
+		if(hasty->item_colors[i] == MAX_COLORS) hasty->item_colors[i] = (unsigned char)num_colors;
+	}
+	
+	hasty->num_colors = num_colors;
+	SortByColor(arbiters, hasty->colored_arbiters, arbiter_colors, hasty->arbiter_batches, num_colors);
+	SortByColor(constraints, hasty->colored_constraints, constraint_colors, hasty->constraint_batches, num_colors);
+	hasty->colored_arbiter_bodies = ArbiterBodyIndexes(cpSpaceAllocator((cpSpace *)hasty), hasty->colored_arbiters, hasty->colored_arbiter_bodies, &hasty->colored_arbiter_bodies_max);
+	
+	// Split the colored arbiters into contact groups. They are packed by the workers in ColoredSolver().
+	hasty->grouped = hasty->simd_contacts;
+	if(hasty->grouped){
+		int num_groups = 0;
+		for(int color=0; color<num_colors; color++){
+			num_groups += (hasty->arbiter_batches[color + 1] - hasty->arbiter_batches[color] + CONTACT_GROUP_WIDTH - 1)/CONTACT_GROUP_WIDTH;
+		}
+		
+		hasty->contact_groups = (struct ContactGroup *)GrowBuffer(cpSpaceAllocator((cpSpace *)hasty), hasty->contact_groups, &hasty->contact_groups_max, num_groups, sizeof(struct ContactGroup));
+		
+		struct ContactGroup *group = hasty->contact_groups;
+		cpArbiter **colored_arbiters = (cpArbiter **)hasty->colored_arbiters->arr;
+		for(int color=0; color<num_colors; color++){
+			hasty->group_batches[color] = (int)(group - hasty->contact_groups);
+			
+			for(int i=hasty->arbiter_batches[color]; i<hasty->arbiter_batches[color + 1]; i+=CONTACT_GROUP_WIDTH, group++){
+				group->arbiters = colored_arbiters + i;
+				group->bodies = hasty->colored_arbiter_bodies + 2*i;
+				int remaining = hasty->arbiter_batches[color + 1] - i;
+				group->count = (remaining < CONTACT_GROUP_WIDTH ? remaining : CONTACT_GROUP_WIDTH);
+			}
+		}
+		hasty->group_batches[num_colors] = num_groups;
+	}
+}
+
+// The overflow batch has conflicts, so it's never grouped.
+static inline cpBool
+BatchIsGrouped(cpHastySpace *hasty, int batch)
+{
+	return (hasty->grouped && batch < hasty->num_colors);
+}
+
+// Solve the items in [begin, end) of a batch. Arbiters (or contact groups) are numbered before constraints.
+static void
+SolveBatch(cpHastySpace *hasty, int batch, int begin, int end, cpFloat dt)
+{
+	cpArbiter **arbiters = (cpArbiter **)hasty->colored_arbiters->arr + hasty->arbiter_batches[batch];
+	cpConstraint **constraints = (cpConstraint **)hasty->colored_constraints->arr + hasty->constraint_batches[batch];
+	int arbiter_count = hasty->arbiter_batches[batch + 1] - hasty->arbiter_batches[batch];
+	
+	struct cpSolverBody *bodies = hasty->solver_bodies;
+	
+	if(BatchIsGrouped(hasty, batch)){
+		struct ContactGroup *groups = hasty->contact_groups + hasty->group_batches[batch];
+		int group_count = hasty->group_batches[batch + 1] - hasty->group_batches[batch];
+		
+		for(int i=begin; i<end; i++){
+			if(i < group_count){
+				ContactGroupApplyImpulse(groups + i, bodies);
+			} else {
+				SolverConstraintApplyImpulse(constraints[i - group_count], bodies, dt);
+			}
+		}
+		
+		return;
+	}
+	
+	const int *indexes = hasty->colored_arbiter_bodies + 2*hasty->arbiter_batches[batch];
+	for(int i=begin; i<end; i++){
+		if(i < arbiter_count){
+			SolverArbiterApplyImpulse(arbiters[i], bodies + indexes[2*i + 0], bodies + indexes[2*i + 1]);
+		} else {
+			SolverConstraintApplyImpulse(constraints[i - arbiter_count], bodies, dt);
+		}
+	}
+}
+
+static inline int
+BatchCount(cpHastySpace *hasty, int batch)
+{
+	int constraint_count = hasty->constraint_batches[batch + 1] - hasty->constraint_batches[batch];
+	
+	if(BatchIsGrouped(hasty, batch)){
+		return (hasty->group_batches[batch + 1] - hasty->group_batches[batch]) + constraint_count;
+	} else {
+		return (hasty->arbiter_batches[batch + 1] - hasty->arbiter_batches[batch]) + constraint_count;
+	}
+}
+
+// Number a body used by the step and reset its colors.
+static inline void
+SolverBodyRegister(cpArray *sources, cpBody *body, cpTimestamp stamp)
+{
+	body->solver.stamp = stamp;
+	body->solver.colors = 0;
+	body->solver.index = sources->num;
+	cpArrayPush(sources, body);
+}
+
+// Number a static or kinematic body the first time an arbiter or constraint uses it.
+static inline void
+SolverBodyRegisterOnce(cpArray *sources, cpBody *body, cpTimestamp stamp)
+{
+	if(body->solver.stamp != stamp) SolverBodyRegister(sources, body, stamp);
+}
+
+// Assign solver body indexes to every body the solver will touch. Dynamic bodies come first, in order.
+static void
+PrepareSolverBodies(cpHastySpace *hasty)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpArray *bodies = space->dynamicBodies;
+	cpArray *arbiters = space->arbiters;
+	cpArray *constraints = space->constraints;
+	cpTimestamp stamp = space->stamp;
+	
+	cpArray *sources = hasty->solver_body_sources;
+	sources->num = 0;
+	
+	for(int i=0; i<bodies->num; i++) SolverBodyRegister(sources, (cpBody *)bodies->arr[i], stamp);
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		SolverBodyRegisterOnce(sources, arb->body_a, stamp);
+		SolverBodyRegisterOnce(sources, arb->body_b, stamp);
+	}
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		SolverBodyRegisterOnce(sources, constraint->a, stamp);
+		SolverBodyRegisterOnce(sources, constraint->b, stamp);
+	}
+	
+	// Stamps are per space, so clear them again.
+	// Otherwise a body moved to another space could look like it was already numbered for a step with the same stamp.
+	for(int i=0; i<sources->num; i++) ((cpBody *)sources->arr[i])->solver.stamp = 0;
+	
+	// One extra body for the empty contact group lanes.
+	int count = sources->num + 1;
+	if(hasty->solver_bodies_max < count){
+		hasty->solver_bodies_max = count;
+		
+		const cpAllocator *allocator = cpSpaceAllocator((cpSpace *)hasty);
+		cpAllocatorFree(allocator, hasty->solver_bodies_buffer);
+		hasty->solver_bodies_buffer = cpAllocatorCalloc(allocator, count*sizeof(struct cpSolverBody) + 63, 1);
+		hasty->solver_bodies = (struct cpSolverBody *)(((uintptr_t)hasty->solver_bodies_buffer + 63) & ~(uintptr_t)63);
+	}
+	
+	memset(hasty->solver_bodies + sources->num, 0, sizeof(struct cpSolverBody));
+}
+
+// Copy the bodies into the solver bodies and pack the contact groups.
+static void
+SolverSetup(cpHastySpace *hasty, unsigned long worker, unsigned long worker_count)
+{
+	cpArray *sources = hasty->solver_body_sources;
+	
+	int begin, end;
+	WorkRange(sources->num, worker, worker_count, &begin, &end);
+	for(int i=begin; i<end; i++) SolverBodyLoad(hasty->solver_bodies + i, (cpBody *)sources->arr[i]);
+	
+	if(hasty->grouped){
+		WorkRange(hasty->group_batches[hasty->num_colors], worker, worker_count, &begin, &end);
+		for(int i=begin; i<end; i++) ContactGroupPack(hasty->contact_groups + i, sources->num);
+	}
+	
+	if(worker_count > 1) BarrierWait(hasty, worker_count);
+}
+
+// Copy the solver bodies and contact groups back once everything is solved.
+static void
+SolverFinish(cpHastySpace *hasty, unsigned long worker, unsigned long worker_count)
+{
+	cpArray *sources = hasty->solver_body_sources;
+	if(worker_count > 1) BarrierWait(hasty, worker_count);
+	
+	int begin, end;
+	if(hasty->grouped){
+		WorkRange(hasty->group_batches[hasty->num_colors], worker, worker_count, &begin, &end);
+		for(int i=begin; i<end; i++) ContactGroupUnpack(hasty->contact_groups + i);
+	}
+	
+	WorkRange(sources->num, worker, worker_count, &begin, &end);
+	for(int i=begin; i<end; i++) SolverBodyStore(hasty->solver_bodies + i, (cpBody *)sources->arr[i]);
+}
+
+static void
+ColoredIterations(cpHastySpace *hasty, unsigned long worker, unsigned long worker_count)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpFloat dt = space->curr_dt;
+	int num_colors = hasty->num_colors;
+	int overflow = BatchCount(hasty, num_colors);
+	
+	for(int i=0; i<space->iterations; i++){
+		// Nothing in a color shares a dynamic body, so the threads can split each one up freely.
+		for(int color=0; color<num_colors; color++){
+			int begin, end;
+			WorkRange(BatchCount(hasty, color), worker, worker_count, &begin, &end);
+			SolveBatch(hasty, color, begin, end, dt);
+			
+			if(worker_count > 1) BarrierWait(hasty, worker_count);
+		}
+		
+		if(overflow > 0){
+			if(worker == 0) SolveBatch(hasty, num_colors, 0, overflow, dt);
+			if(worker_count > 1) BarrierWait(hasty, worker_count);
+		}
+	}
+}
+
+static void
+ColoredSolver(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	
+	SolverSetup(hasty, worker, worker_count);
+	ColoredIterations(hasty, worker, worker_count);
+	SolverFinish(hasty, worker, worker_count);
+}
+
+//MARK: Island Solver
+
+static inline int
+IslandFind(int *parents, int i)
+{
+	while(parents[i] != i){
+		// Path halving.
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+	
+	return i;
+}
+
+// Index of a body in the island data, or -1 if it's not a dynamic body.
+// Dynamic bodies have the first 'count' solver body indexes.
+static inline int
+IslandBodyIndex(cpBody *body, int count)
+{
+	int index = body->solver.index;
+	return (!body_is_immovable(body) && index < count ? index : -1);
+}
+
+static inline void
+IslandUnion(int *parents, cpBody *a, cpBody *b, int count)
+{
+	int ia = IslandBodyIndex(a, count), ib = IslandBodyIndex(b, count);
+	if(ia < 0 || ib < 0) return;
+	
+	int ra = IslandFind(parents, ia), rb = IslandFind(parents, ib);
+	
+	// Always keep the lower index as the root so the islands don't depend on the pair order.
+	if(ra < rb){
+		parents[rb] = ra;
+	} else if(rb < ra){
+		parents[ra] = rb;
+	}
+}
+
+static inline int
+IslandOf(cpHastySpace *hasty, cpBody *a, cpBody *b, int count, int num_islands)
+{
+	int i = IslandBodyIndex(a, count);
+	if(i < 0) i = IslandBodyIndex(b, count);
+	
+	// Constraints with no dynamic bodies at all go in an extra island of their own.
+	return (i >= 0 ? hasty->island_ids[IslandFind(hasty->island_parents, i)] : num_islands);
+}
+
+static void
+SortByIsland(cpArray *items, cpArray *sorted, const int *islands, int *starts, int num_islands)
+{
+	if(sorted->max < items->num){
+		sorted->max = items->num;
+		sorted->arr = (void **)cpAllocatorRealloc(sorted->allocator, sorted->arr, sorted->max*sizeof(void *));
+	}
+	sorted->num = items->num;
+	
+	// Counting sort. Stable, so each island keeps the order of the space's arrays.
+	memset(starts, 0, (num_islands + 1)*sizeof(int));
+	for(int i=0; i<items->num; i++) starts[islands[i] + 1]++;
+	for(int i=0; i<num_islands; i++) starts[i + 1] += starts[i];
+	
+	// Use the starts as cursors. Afterwards each one has moved to the start of the next island, so shift them back.
+	for(int i=0; i<items->num; i++) sorted->arr[starts[islands[i]]++] = items->arr[i];
+	for(int i=num_islands; i>0; i--) starts[i] = starts[i - 1];
+	starts[0] = 0;
+}
+
+static void
+BuildIslands(cpHastySpace *hasty)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpArray *bodies = space->dynamicBodies;
+	cpArray *arbiters = space->arbiters;
+	cpArray *constraints = space->constraints;
+	int body_count = bodies->num;
+	
+	hasty->body_island_data = (int *)GrowBuffer(cpSpaceAllocator((cpSpace *)hasty), hasty->body_island_data, &hasty->body_island_data_max, 2*bodies->num, sizeof(int));
+	int *parents = hasty->island_parents = hasty->body_island_data;
+	hasty->island_ids = hasty->body_island_data + bodies->num;
+	
+	// The bodies were already numbered by PrepareSolverBodies().
+	for(int i=0; i<body_count; i++) parents[i] = i;
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		IslandUnion(parents, arb->body_a, arb->body_b, body_count);
+	}
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		IslandUnion(parents, constraint->a, constraint->b, body_count);
+	}
+	
+	// Number the islands in the order their first body appears.
+	int num_islands = 0;
+	for(int i=0; i<bodies->num; i++){
+		if(parents[i] == i) hasty->island_ids[i] = num_islands++;
+	}
+	
+	// Bucket the arbiters and constraints by island, including the extra island for constraints without dynamic bodies.
+	int count = arbiters->num + constraints->num;
+	hasty->item_islands = (int *)GrowBuffer(cpSpaceAllocator((cpSpace *)hasty), hasty->item_islands, &hasty->item_islands_max, count, sizeof(int));
+	int *arbiter_islands = hasty->item_islands;
+	int *constraint_islands = hasty->item_islands + arbiters->num;
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		arbiter_islands[i] = IslandOf(hasty, arb->body_a, arb->body_b, body_count, num_islands);
+	}
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		constraint_islands[i] = IslandOf(hasty, constraint->a, constraint->b, body_count, num_islands);
+	}
+	
+	num_islands++;
+	hasty->island_data = (int *)GrowBuffer(cpSpaceAllocator((cpSpace *)hasty), hasty->island_data, &hasty->island_data_max, 3*(num_islands + 1), sizeof(int));
+	hasty->island_arbiter_starts = hasty->island_data;
+	hasty->island_constraint_starts = hasty->island_data + (num_islands + 1);
+	hasty->small_islands = hasty->island_data + 2*(num_islands + 1);
+	
+	int *arbiter_starts = hasty->island_arbiter_starts;
+	int *constraint_starts = hasty->island_constraint_starts;
+	SortByIsland(arbiters, hasty->island_arbiters, arbiter_islands, arbiter_starts, num_islands);
+	SortByIsland(constraints, hasty->island_constraints, constraint_islands, constraint_starts, num_islands);
+	hasty->island_arbiter_bodies = ArbiterBodyIndexes(cpSpaceAllocator((cpSpace *)hasty), hasty->island_arbiters, hasty->island_arbiter_bodies, &hasty->island_arbiter_bodies_max);
+	
+	// Split off the large islands to be solved by the colored solver.
+	cpArray *large_arbiters = hasty->large_arbiters;
+	cpArray *large_constraints = hasty->large_constraints;
+	large_arbiters->num = large_constraints->num = 0;
+	hasty->num_small_islands = 0;
+	
+	for(int i=0; i<num_islands; i++){
+		int arbiter_count = arbiter_starts[i + 1] - arbiter_starts[i];
+		int constraint_count = constraint_starts[i + 1] - constraint_starts[i];
+		int island_count = arbiter_count + constraint_count;
+		
+		if(island_count >= LARGE_ISLAND_MIN_COUNT && island_count*LARGE_ISLAND_FRACTION >= count){
+			for(int j=arbiter_starts[i]; j<arbiter_starts[i + 1]; j++) cpArrayPush(large_arbiters, hasty->island_arbiters->arr[j]);
+			for(int j=constraint_starts[i]; j<constraint_starts[i + 1]; j++) cpArrayPush(large_constraints, hasty->island_constraints->arr[j]);
+		} else if(island_count > 0){
+			hasty->small_islands[hasty->num_small_islands++] = i;
+		}
+	}
+	
+	ColorConstraints(hasty, large_arbiters, large_constraints);
+}
+
+static void
+SolveIsland(cpHastySpace *hasty, int island, cpFloat dt)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpArbiter **arbiters = (cpArbiter **)hasty->island_arbiters->arr;
+	cpConstraint **constraints = (cpConstraint **)hasty->island_constraints->arr;
+	const int *indexes = hasty->island_arbiter_bodies;
+	struct cpSolverBody *bodies = hasty->solver_bodies;
+	int arbiter_begin = hasty->island_arbiter_starts[island], arbiter_end = hasty->island_arbiter_starts[island + 1];
+	int constraint_begin = hasty->island_constraint_starts[island], constraint_end = hasty->island_constraint_starts[island + 1];
+	
+	// Same order as cpSpaceStep() would solve them in.
+	for(int i=0; i<space->iterations; i++){
+		for(int j=arbiter_begin; j<arbiter_end; j++){
+			SolverArbiterApplyImpulse(arbiters[j], bodies + indexes[2*j + 0], bodies + indexes[2*j + 1]);
+		}
+		
+		for(int j=constraint_begin; j<constraint_end; j++){
+			SolverConstraintApplyImpulse(constraints[j], bodies, dt);
+		}
+	}
+}
+
+static void
+IslandSolver(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	cpFloat dt = space->curr_dt;
+	
+	SolverSetup(hasty, worker, worker_count);
+	
+	// All of the threads split up the large islands in lockstep first.
+	ColoredIterations(hasty, worker, worker_count);
+	
+	// The small islands don't share any bodies with anything else, so they can be claimed in any order.
+	for(;;){
+		long i = AtomicAdd(&hasty->next_island, 1) - 1;
+		if(i >= hasty->num_small_islands) break;
+		
+		SolveIsland(hasty, hasty->small_islands[i], dt);
+	}
+	
+	SolverFinish(hasty, worker, worker_count);
+}
+
+
 //MARK: Thread Management Functions
 
+// Number of processors available to this process.
+static unsigned long
+ProcessorCount(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#elif defined(__APPLE__)
+	int count = 1;
+	size_t size = sizeof(count);
+	sysctlbyname("hw.ncpu", &count, &size, NULL, 0);
+	return (count > 0 ? count : 1);
+#else
+	#if defined(__linux__) && defined(CPU_COUNT)
+		// Respect the affinity mask so containers and taskset limits are honored.
+		cpu_set_t set;
+		if(sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) return CPU_COUNT(&set);
+	#endif
+	
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0 ? count : 1);
+#endif
+}
+
 static void
 HaltThreads(cpHastySpace *hasty)
 {
 	pthread_mutex_t *mutex = &hasty->mutex;
 	pthread_mutex_lock(mutex); {
 		hasty->work = NULL; // NULL work function means break and exit
+		AtomicAdd(&hasty->generation, 1);
 		pthread_cond_broadcast(&hasty->cond_work);
 	} pthread_mutex_unlock(mutex);
 	
@@ -514,32 +1705,30 @@ cpHastySpaceSetThreads(cpSpace *space, unsigned long threads)
 #endif	
 	
 	cpHastySpace *hasty = (cpHastySpace *)space;
+	const cpAllocator *allocator = cpSpaceAllocator(space);
 	HaltThreads(hasty);
 	
-#ifdef __APPLE__
-	if(threads == 0){
-		size_t size = sizeof(threads);
-		sysctlbyname("hw.ncpu", &threads, &size, NULL, 0);
+	unsigned long processors = ProcessorCount();
+	if(threads == 0 || threads > processors) threads = processors;
+	
+	if(hasty->contacts){
+		for(unsigned long i=0; i<hasty->num_threads; i++) cpAllocatorFree(allocator, hasty->contacts[i].arr);
+		cpAllocatorFree(allocator, hasty->contacts);
 	}
-#else
-	if(threads == 0) threads = 1;
-#endif
+	cpAllocatorFree(allocator, hasty->workers);
 	
-	hasty->num_threads = (threads < MAX_THREADS ? threads : MAX_THREADS);
-	hasty->num_working = hasty->num_threads - 1;
+	hasty->num_threads = threads;
+	hasty->contacts = (struct cpContactArray *)cpAllocatorCalloc(allocator, threads, sizeof(struct cpContactArray));
+	hasty->workers = (threads > 1 ? (struct ThreadContext *)cpAllocatorCalloc(allocator, threads - 1, sizeof(struct ThreadContext)) : NULL);
 	
-	// Create the worker threads and wait for them to signal ready.
-	if(hasty->num_working > 0){
-		pthread_mutex_lock(&hasty->mutex);
-		for(unsigned long i=0; i<(hasty->num_threads-1); i++){
-			hasty->workers[i].space = hasty;
-			hasty->workers[i].thread_num = i + 1;
-			
-			pthread_create(&hasty->workers[i].thread, NULL, (void*(*)(void*))WorkerThreadLoop, &hasty->workers[i]);
-		}
+	// Workers start out waiting for the next generation of work.
+	long generation = AtomicLoad(&hasty->generation);
+	for(unsigned long i=0; i<(threads-1); i++){
+		hasty->workers[i].space = hasty;
+		hasty->workers[i].thread_num = i + 1;
+		hasty->workers[i].generation = generation;
 		
-		pthread_cond_wait(&hasty->cond_resume, &hasty->mutex);
-		pthread_mutex_unlock(&hasty->mutex);
+		pthread_create(&hasty->workers[i].thread, NULL, (void*(*)(void*))WorkerThreadLoop, &hasty->workers[i]);
 	}
 }
 
@@ -549,13 +1738,56 @@ cpHastySpaceGetThreads(cpSpace *space)
 	return ((cpHastySpace *)space)->num_threads;
 }
 
+void
+cpHastySpaceSetSpinWait(cpSpace *space, cpBool spin)
+{
+	AtomicStore(&((cpHastySpace *)space)->spin_wait, spin);
+}
+
+cpBool
+cpHastySpaceGetSpinWait(cpSpace *space)
+{
+	return (cpBool)AtomicLoad(&((cpHastySpace *)space)->spin_wait);
+}
+
+void
+cpHastySpaceSetSIMDContacts(cpSpace *space, cpBool enabled)
+{
+	((cpHastySpace *)space)->simd_contacts = enabled;
+}
+
+cpBool
+cpHastySpaceGetSIMDContacts(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->simd_contacts;
+}
+
+void
+cpHastySpaceSetSolverMode(cpSpace *space, cpHastySolverMode mode)
+{
+	((cpHastySpace *)space)->solver_mode = mode;
+}
+
+cpHastySolverMode
+cpHastySpaceGetSolverMode(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->solver_mode;
+}
+
 //MARK: Overriden cpSpace Functions.
 
 cpSpace *
 cpHastySpaceNew(void)
 {
-	cpHastySpace *hasty = (cpHastySpace *)cpcalloc(1, sizeof(cpHastySpace));
-	cpSpaceInit((cpSpace *)hasty);
+	return cpHastySpaceNewWithAllocator(NULL);
+}
+
+cpSpace *
+cpHastySpaceNewWithAllocator(const cpAllocator *allocator)
+{
+	cpHastySpace *hasty = (cpHastySpace *)cpAllocatorCalloc(allocator, 1, sizeof(cpHastySpace));
+	cpSpaceInitWithAllocator((cpSpace *)hasty, allocator);
+	allocator = cpSpaceAllocator((cpSpace *)hasty);
 	
 	pthread_mutex_init(&hasty->mutex, NULL);
 	pthread_cond_init(&hasty->cond_work, NULL);
@@ -563,6 +1795,18 @@ cpHastySpaceNew(void)
 	
 	// TODO magic number, should test this more thoroughly.
 	hasty->constraint_count_threshold = 50;
+	hasty->collision_count_threshold = 256;
+	
+	hasty->dynamicShapes = cpArrayNewWithAllocator(0, allocator);
+	
+	hasty->solver_mode = CP_HASTY_SOLVER_DEFAULT;
+	hasty->colored_arbiters = cpArrayNewWithAllocator(0, allocator);
+	hasty->colored_constraints = cpArrayNewWithAllocator(0, allocator);
+	hasty->solver_body_sources = cpArrayNewWithAllocator(0, allocator);
+	hasty->island_arbiters = cpArrayNewWithAllocator(0, allocator);
+	hasty->island_constraints = cpArrayNewWithAllocator(0, allocator);
+	hasty->large_arbiters = cpArrayNewWithAllocator(0, allocator);
+	hasty->large_constraints = cpArrayNewWithAllocator(0, allocator);
 	
 	// Default to 1 thread for determinism.
 	hasty->num_threads = 1;
@@ -575,6 +1819,7 @@ void
 cpHastySpaceFree(cpSpace *space)
 {
 	cpHastySpace *hasty = (cpHastySpace *)space;
+	const cpAllocator *allocator = cpSpaceAllocator(space);
 	
 	HaltThreads(hasty);
 	
@@ -582,6 +1827,27 @@ cpHastySpaceFree(cpSpace *space)
 	pthread_cond_destroy(&hasty->cond_work);
 	pthread_cond_destroy(&hasty->cond_resume);
 	
+	cpArrayFree(hasty->dynamicShapes);
+	cpArrayFree(hasty->colored_arbiters);
+	cpArrayFree(hasty->colored_constraints);
+	cpAllocatorFree(allocator, hasty->item_colors);
+	cpAllocatorFree(allocator, hasty->contact_groups);
+	cpAllocatorFree(allocator, hasty->solver_bodies_buffer);
+	cpArrayFree(hasty->solver_body_sources);
+	cpAllocatorFree(allocator, hasty->colored_arbiter_bodies);
+	cpAllocatorFree(allocator, hasty->island_arbiter_bodies);
+	
+	cpArrayFree(hasty->island_arbiters);
+	cpArrayFree(hasty->island_constraints);
+	cpArrayFree(hasty->large_arbiters);
+	cpArrayFree(hasty->large_constraints);
+	cpAllocatorFree(allocator, hasty->item_islands);
+	cpAllocatorFree(allocator, hasty->body_island_data);
+	cpAllocatorFree(allocator, hasty->island_data);
+	for(unsigned long i=0; i<hasty->num_threads; i++) cpAllocatorFree(allocator, hasty->contacts[i].arr);
+	cpAllocatorFree(allocator, hasty->contacts);
+	cpAllocatorFree(allocator, hasty->workers);
+	
 	cpSpaceFree(space);
 }
 
@@ -593,9 +1859,16 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 	
 	space->stamp++;
 	
+	// Switch spatial indexes before anything can be holding on to the current ones.
+	cpSpaceAdaptBroadphase(space);
+	
+	cpSpaceStepStats *stats = &space->stepStats;
+	uint64_t start = cpSpaceStepStatsBegin(space), lap = start;
+	
 	cpFloat prev_dt = space->curr_dt;
 	space->curr_dt = dt;
-		
+	
+	cpHastySpace *hasty = (cpHastySpace *)space;
 	cpArray *bodies = space->dynamicBodies;
 	cpArray *constraints = space->constraints;
 	cpArray *arbiters = space->arbiters;
@@ -618,19 +1891,53 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			cpBody *body = (cpBody *)bodies->arr[i];
 			body->position_func(body, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->integratePositionsTime, lap);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
-		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
-		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceCollideShapes, space);
+		
+		cpArray *shapes = hasty->dynamicShapes;
+		shapes->num = 0;
+		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)GatherShape, shapes);
+		if((unsigned long)shapes->num > hasty->collision_count_threshold){
+			RunWorkers(hasty, UpdateBBs);
+		} else {
+			UpdateBBs(space, 0, 1);
+		}
+		lap = cpSpaceStepStatsLap(space, &stats->updateBBTime, lap);
+		
+		uint64_t broadphaseStart = cpSpaceBroadphaseSampleBegin(space);
+		
+		// The narrowphase is always deferred, even when single threaded, so the results don't depend on the thread count.
+		cpSpaceBeginDeferredCollisions(space);
+		
+		// Let an LBVH split up rebuilding the tree and finding the pairs between the threads.
+		if(cpSpatialIndexIsLBVH(space->dynamicShapes)){
+			cpLBVHSetRunner(space->dynamicShapes, (hasty->num_threads > 1 ? (cpLBVHRunnerFunc)LBVHRunner : NULL), hasty);
+		}
+		
+		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceDeferCollideShapes, space);
+		cpSpaceBucketCollisionPairs(space);
+		
+		if((unsigned long)space->collisionPairs.num > hasty->collision_count_threshold){
+			RunWorkers(hasty, Narrowphase);
+		} else {
+			Narrowphase(space, 0, 1);
+		}
+		
+		cpSpaceMergeCollisionPairs(space);
+		cpSpaceBroadphaseSampleEnd(space, broadphaseStart);
+		lap = cpSpaceStepStatsLap(space, &stats->collideTime, lap);
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
 	cpSpaceProcessComponents(space, dt);
+	lap = cpSpaceStepStatsLap(space, &stats->componentsTime, lap);
 	
 	cpSpaceLock(space); {
 		// Clear out old cached arbiters and call separate callbacks
 		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
+		lap = cpSpaceStepStatsLap(space, &stats->arbiterFilterTime, lap);
 
 		// Prestep the arbiters and constraints.
 		cpFloat slop = space->collisionSlop;
@@ -647,6 +1954,7 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			
 			constraint->klass->preStep(constraint, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->preStepTime, lap);
 	
 		// Integrate velocities.
 		cpFloat damping = cpfpow(space->damping, dt);
@@ -655,6 +1963,7 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			cpBody *body = (cpBody *)bodies->arr[i];
 			body->velocity_func(body, gravity, damping, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->integrateVelocitiesTime, lap);
 		
 		// Apply cached impulses
 		cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
@@ -668,12 +1977,37 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 		}
 		
 		// Run the impulse solver.
-		cpHastySpace *hasty = (cpHastySpace *)space;
-		if((unsigned long)(arbiters->num + constraints->num) > hasty->constraint_count_threshold){
-			RunWorkers(hasty, Solver);
+		cpBool threaded = ((unsigned long)(arbiters->num + constraints->num) > hasty->constraint_count_threshold);
+		if(hasty->solver_mode == CP_HASTY_SOLVER_ISLANDS){
+			PrepareSolverBodies(hasty);
+			BuildIslands(hasty);
+			AtomicStore(&hasty->next_island, 0);
+			
+			if(threaded){
+				RunWorkers(hasty, IslandSolver);
+			} else {
+				IslandSolver(space, 0, 1);
+			}
+		} else if(hasty->solver_mode == CP_HASTY_SOLVER_COLORED){
+			// Always run the batches, even single threaded, so the results don't depend on the thread count.
+			PrepareSolverBodies(hasty);
+			ColorConstraints(hasty, arbiters, constraints);
+			
+			if(threaded){
+				RunWorkers(hasty, ColoredSolver);
+			} else {
+				ColoredSolver(space, 0, 1);
+			}
 		} else {
-			Solver(space, 0, 1);
+			if(threaded){
+				RunWorkers(hasty, Solver);
+			} else {
+				Solver(space, 0, 1);
+			}
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->solverTime, lap);
+		stats->arbiters = arbiters->num;
+		stats->constraints = constraints->num;
 		
 		// Run the constraint post-solve callbacks
 		for(int i=0; i<constraints->num; i++){
@@ -691,4 +2025,7 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			handler->postSolveFunc(arb, space, handler->userData);
 		}
 	} cpSpaceUnlock(space, cpTrue);
+	
+	cpSpaceStepStatsLap(space, &stats->callbacksTime, lap);
+	cpSpaceStepStatsLap(space, &stats->totalTime, start);
 }
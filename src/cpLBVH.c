@@ -0,0 +1,892 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chipmunk/chipmunk_private.h"
+
+// A linear bounding volume hierarchy.
+// Rather than updating a tree incrementally, the whole tree is rebuilt from scratch every reindex.
+// The leaves are sorted along a Morton curve through the centers of their bounding boxes using a radix sort,
+// and each node is split where the highest bit of the Morton codes changes.
+// Building the tree is O(n) and most of the work can be split up between threads using cpLBVHSetRunner().
+// The nodes use the same layout as cpFlatBBTree so queries can walk them without recursion.
+
+static inline cpSpatialIndexClass *Klass();
+
+typedef struct Leaf Leaf;
+typedef struct LBVHNode LBVHNode;
+typedef struct Chunk Chunk;
+typedef struct LBVHPair LBVHPair;
+
+// The leaves are split into at most this many chunks that the workers process independently.
+// The chunks don't depend on the number of workers, so neither do the results.
+#define MAX_CHUNKS 64
+#define MIN_CHUNK_SIZE 256
+
+// Only hand the work off to the runner when there are at least this many leaves.
+#define PARALLEL_MIN_COUNT 2048
+
+// Sort the 32 bit Morton codes 8 bits at a time.
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1<<RADIX_BITS)
+
+// Segment queries keep a small stack to visit the nearest child first.
+// Subtrees that would overflow it are finished in depth first order instead.
+#define SEGMENT_STACK_SIZE 32
+
+struct LBVHPair {
+	void *a, *b;
+};
+
+struct Chunk {
+	// Bounds of the leaf centers in the chunk.
+	cpBB centers;
+	
+	// Number of keys in each radix bucket, and then where the chunk's keys in each bucket go.
+	int buckets[RADIX_BUCKETS];
+	
+	// Pairs found by the chunk's leaves.
+	LBVHPair *pairs;
+	int pairCount, pairMax;
+};
+
+struct cpLBVH {
+	cpSpatialIndex spatialIndex;
+	
+	cpHashSet *leafSet;
+	cpArray *leaves;
+	cpArray *pooledLeaves;
+	cpArray *allocatedBuffers;
+	
+	// Set when the tree needs to be rebuilt before it can be queried.
+	cpBool dirty;
+	
+	cpLBVHRunnerFunc runner;
+	void *runnerContext;
+	
+	// Nodes in depth first order, the root is nodes[0].
+	LBVHNode *nodes;
+	int nodeCount;
+	
+	// Leaf objects in Morton order and the node each belongs to.
+	void **objs;
+	int *leafNodes;
+	int leafCount;
+	
+	// Scratch space for building the tree, all 'capacity' long.
+	cpBB *bbs;
+	unsigned int *keys, *tempKeys;
+	int *values, *tempValues;
+	int capacity;
+	
+	Chunk chunks[MAX_CHUNKS];
+	int chunkCount;
+	
+	// Build state shared with the workers.
+	cpVect origin, scale;
+	int radixShift;
+	cpLBVH *staticTree;
+};
+
+struct LBVHNode {
+	cpBB bb;
+	// Index of the first node after this node's subtree.
+	int skip;
+	// Index into the tree's objs array, or -1 for internal nodes.
+	int leaf;
+};
+
+struct Leaf {
+	void *obj;
+	// Index of the leaf in the tree's leaves array.
+	int index;
+};
+
+//MARK: Leaf Functions
+
+static int leafSetEql(void *obj, Leaf *leaf){return (obj == leaf->obj);}
+
+static Leaf *
+LeafFromPool(cpLBVH *tree)
+{
+	if(tree->pooledLeaves->num == 0){
+		// leaf pool is exhausted, make more
+		int count = CP_BUFFER_BYTES/sizeof(Leaf);
+		cpAssertHard(count, "Internal Error: Buffer size is too small.");
+		
+		Leaf *buffer = (Leaf *)cpAllocatorCalloc(tree->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
+		cpArrayPush(tree->allocatedBuffers, buffer);
+		
+		for(int i=0; i<count; i++) cpArrayPush(tree->pooledLeaves, buffer + i);
+	}
+	
+	return (Leaf *)cpArrayPop(tree->pooledLeaves);
+}
+
+static void *
+leafSetTrans(void *obj, cpLBVH *tree)
+{
+	Leaf *leaf = LeafFromPool(tree);
+	leaf->obj = obj;
+	leaf->index = tree->leaves->num;
+	cpArrayPush(tree->leaves, leaf);
+	
+	return leaf;
+}
+
+//MARK: Work Functions
+
+static inline void
+ChunkRange(int count, int chunk, int chunkCount, int *begin, int *end)
+{
+	*begin = (int)((long long)count*chunk/chunkCount);
+	*end = (int)((long long)count*(chunk + 1)/chunkCount);
+}
+
+// Run 'func' for all of the chunks, using the runner if there is enough work to be worth it.
+static void
+RunChunks(cpLBVH *tree, cpLBVHWorkFunc func, cpBool parallel)
+{
+	if(parallel && tree->runner && tree->leaves->num >= PARALLEL_MIN_COUNT){
+		tree->runner(func, tree, tree->runnerContext);
+	} else {
+		func(tree, 0, 1);
+	}
+}
+
+// Spread the bits of a 16 bit number out into the even bits.
+static inline unsigned int
+SpreadBits(unsigned int x)
+{
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+static inline unsigned int
+Quantize(cpFloat value, cpFloat origin, cpFloat scale)
+{
+	cpFloat q = (value - origin)*scale;
+	return (q > 0.0f ? (q < 65535.0f ? (unsigned int)q : 65535u) : 0u);
+}
+
+static void
+BoundsWork(void *data, unsigned long worker, unsigned long worker_count)
+{
+	cpLBVH *tree = (cpLBVH *)data;
+	cpSpatialIndexBBFunc bbfunc = tree->spatialIndex.bbfunc;
+	Leaf **leaves = (Leaf **)tree->leaves->arr;
+	int count = tree->leaves->num;
+	
+	int first, last;
+	ChunkRange(tree->chunkCount, (int)worker, (int)worker_count, &first, &last);
+	
+	for(int c=first; c<last; c++){
+		int begin, end;
+		ChunkRange(count, c, tree->chunkCount, &begin, &end);
+		
+		cpBB centers = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+		for(int i=begin; i<end; i++){
+			cpBB bb = tree->bbs[i] = bbfunc(leaves[i]->obj);
+			centers = cpBBExpand(centers, cpBBCenter(bb));
+		}
+		
+		tree->chunks[c].centers = centers;
+	}
+}
+
+static void
+MortonWork(void *data, unsigned long worker, unsigned long worker_count)
+{
+	cpLBVH *tree = (cpLBVH *)data;
+	cpVect origin = tree->origin, scale = tree->scale;
+	
+	int begin, end;
+	ChunkRange(tree->leaves->num, (int)worker, (int)worker_count, &begin, &end);
+	
+	for(int i=begin; i<end; i++){
+		cpVect center = cpBBCenter(tree->bbs[i]);
+		unsigned int x = Quantize(center.x, origin.x, scale.x);
+		unsigned int y = Quantize(center.y, origin.y, scale.y);
+		
+		tree->keys[i] = SpreadBits(x) | (SpreadBits(y) << 1);
+		tree->values[i] = i;
+	}
+}
+
+static void
+HistogramWork(void *data, unsigned long worker, unsigned long worker_count)
+{
+	cpLBVH *tree = (cpLBVH *)data;
+	unsigned int *keys = tree->keys;
+	int shift = tree->radixShift;
+	
+	int first, last;
+	ChunkRange(tree->chunkCount, (int)worker, (int)worker_count, &first, &last);
+	
+	for(int c=first; c<last; c++){
+		int *buckets = tree->chunks[c].buckets;
+		for(int i=0; i<RADIX_BUCKETS; i++) buckets[i] = 0;
+		
+		int begin, end;
+		ChunkRange(tree->leafCount, c, tree->chunkCount, &begin, &end);
+		for(int i=begin; i<end; i++) buckets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+	}
+}
+
+static void
+ScatterWork(void *data, unsigned long worker, unsigned long worker_count)
+{
+	cpLBVH *tree = (cpLBVH *)data;
+	unsigned int *keys = tree->keys, *tempKeys = tree->tempKeys;
+	int *values = tree->values, *tempValues = tree->tempValues;
+	int shift = tree->radixShift;
+	
+	int first, last;
+	ChunkRange(tree->chunkCount, (int)worker, (int)worker_count, &first, &last);
+	
+	for(int c=first; c<last; c++){
+		int *buckets = tree->chunks[c].buckets;
+		
+		int begin, end;
+		ChunkRange(tree->leafCount, c, tree->chunkCount, &begin, &end);
+		for(int i=begin; i<end; i++){
+			int dst = buckets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+			tempKeys[dst] = keys[i];
+			tempValues[dst] = values[i];
+		}
+	}
+}
+
+// Stable radix sort of the keys and values.
+static void
+RadixSort(cpLBVH *tree, cpBool parallel)
+{
+	int count = tree->leafCount;
+	Chunk *chunks = tree->chunks;
+	
+	for(int shift=0; shift<32; shift += RADIX_BITS){
+		tree->radixShift = shift;
+		RunChunks(tree, HistogramWork, parallel);
+		
+		// Turn the counts into the starting index for each chunk's keys in each bucket.
+		int offset = 0;
+		cpBool sorted = cpFalse;
+		for(int bucket=0; bucket<RADIX_BUCKETS; bucket++){
+			int start = offset;
+			for(int c=0; c<tree->chunkCount; c++){
+				int n = chunks[c].buckets[bucket];
+				chunks[c].buckets[bucket] = offset;
+				offset += n;
+			}
+			
+			// Skip the pass when every key has the same digit.
+			if(offset - start == count) sorted = cpTrue;
+		}
+		if(sorted) continue;
+		
+		RunChunks(tree, ScatterWork, parallel);
+		
+		unsigned int *keys = tree->keys;
+		tree->keys = tree->tempKeys;
+		tree->tempKeys = keys;
+		
+		int *values = tree->values;
+		tree->values = tree->tempValues;
+		tree->tempValues = values;
+	}
+}
+
+static void
+PairsWork(void *data, unsigned long worker, unsigned long worker_count)
+{
+	cpLBVH *tree = (cpLBVH *)data;
+	LBVHNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	int nodeCount = tree->nodeCount;
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	
+	cpLBVH *staticTree = tree->staticTree;
+	LBVHNode *staticNodes = (staticTree ? staticTree->nodes : NULL);
+	int staticCount = (staticTree ? staticTree->nodeCount : 0);
+	
+	int first, last;
+	ChunkRange(tree->chunkCount, (int)worker, (int)worker_count, &first, &last);
+	
+	for(int c=first; c<last; c++){
+		Chunk *chunk = tree->chunks + c;
+		chunk->pairCount = 0;
+		
+		int begin, end;
+		ChunkRange(tree->leafCount, c, tree->chunkCount, &begin, &end);
+		
+		for(int leaf=begin; leaf<end; leaf++){
+			int start = tree->leafNodes[leaf];
+			void *obj = objs[leaf];
+			cpBB bb = nodes[start].bb;
+			
+			// Test each leaf only against the nodes after it to find each pair once.
+			for(int i=start + 1; i<nodeCount;){
+				LBVHNode *node = nodes + i;
+				
+				if(cpBBIntersects(bb, node->bb)){
+					if(node->leaf >= 0){
+						if(chunk->pairCount == chunk->pairMax){
+							chunk->pairMax = (chunk->pairMax ? 2*chunk->pairMax : 64);
+							chunk->pairs = (LBVHPair *)cpAllocatorRealloc(allocator, chunk->pairs, chunk->pairMax*sizeof(LBVHPair));
+						}
+						
+						LBVHPair pair = {obj, objs[node->leaf]};
+						chunk->pairs[chunk->pairCount++] = pair;
+					}
+					
+					i++;
+				} else {
+					i = node->skip;
+				}
+			}
+			
+			for(int i=0; i<staticCount;){
+				LBVHNode *node = staticNodes + i;
+				
+				if(cpBBIntersects(bb, node->bb)){
+					if(node->leaf >= 0){
+						if(chunk->pairCount == chunk->pairMax){
+							chunk->pairMax = (chunk->pairMax ? 2*chunk->pairMax : 64);
+							chunk->pairs = (LBVHPair *)cpAllocatorRealloc(allocator, chunk->pairs, chunk->pairMax*sizeof(LBVHPair));
+						}
+						
+						LBVHPair pair = {obj, staticTree->objs[node->leaf]};
+						chunk->pairs[chunk->pairCount++] = pair;
+					}
+					
+					i++;
+				} else {
+					i = node->skip;
+				}
+			}
+		}
+	}
+}
+
+//MARK: Building
+
+static void
+Reserve(cpLBVH *tree, int count)
+{
+	if(count <= tree->capacity) return;
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	int capacity = tree->capacity = (count > 2*tree->capacity ? count : 2*tree->capacity);
+	
+	tree->nodes = (LBVHNode *)cpAllocatorRealloc(allocator, tree->nodes, (2*capacity - 1)*sizeof(LBVHNode));
+	tree->objs = (void **)cpAllocatorRealloc(allocator, tree->objs, capacity*sizeof(void *));
+	tree->leafNodes = (int *)cpAllocatorRealloc(allocator, tree->leafNodes, capacity*sizeof(int));
+	
+	tree->bbs = (cpBB *)cpAllocatorRealloc(allocator, tree->bbs, capacity*sizeof(cpBB));
+	tree->keys = (unsigned int *)cpAllocatorRealloc(allocator, tree->keys, capacity*sizeof(unsigned int));
+	tree->tempKeys = (unsigned int *)cpAllocatorRealloc(allocator, tree->tempKeys, capacity*sizeof(unsigned int));
+	tree->values = (int *)cpAllocatorRealloc(allocator, tree->values, capacity*sizeof(int));
+	tree->tempValues = (int *)cpAllocatorRealloc(allocator, tree->tempValues, capacity*sizeof(int));
+}
+
+// Find the last key in [first, last) that shares more leading bits with the first key than the last key does.
+static int
+FindSplit(const unsigned int *keys, int first, int last)
+{
+	unsigned int firstKey = keys[first];
+	unsigned int diff = firstKey ^ keys[last];
+	
+	// Identical keys, split them down the middle.
+	if(diff == 0) return (first + last)/2;
+	
+	// Keys that differ from the first one in a lower bit than this are in the first half.
+	diff |= diff >> 1;
+	diff |= diff >> 2;
+	diff |= diff >> 4;
+	diff |= diff >> 8;
+	diff |= diff >> 16;
+	unsigned int highBit = diff ^ (diff >> 1);
+	
+	int split = first;
+	int step = last - first;
+	do {
+		step = (step + 1) >> 1;
+		int candidate = split + step;
+		if(candidate < last && (firstKey ^ keys[candidate]) < highBit) split = candidate;
+	} while(step > 1);
+	
+	return split;
+}
+
+static int
+BuildSubtree(cpLBVH *tree, int first, int last)
+{
+	LBVHNode *nodes = tree->nodes;
+	int index = tree->nodeCount++;
+	
+	if(first == last){
+		int value = tree->values[first];
+		tree->objs[first] = ((Leaf *)tree->leaves->arr[value])->obj;
+		tree->leafNodes[first] = index;
+		
+		nodes[index].bb = tree->bbs[value];
+		nodes[index].leaf = first;
+	} else {
+		int split = FindSplit(tree->keys, first, last);
+		BuildSubtree(tree, first, split);
+		int second = BuildSubtree(tree, split + 1, last);
+		
+		nodes[index].bb = cpBBMerge(nodes[index + 1].bb, nodes[second].bb);
+		nodes[index].leaf = -1;
+	}
+	
+	nodes[index].skip = tree->nodeCount;
+	return index;
+}
+
+static void
+Build(cpLBVH *tree, cpBool parallel)
+{
+	int count = tree->leaves->num;
+	Reserve(tree, count);
+	
+	tree->nodeCount = 0;
+	tree->leafCount = count;
+	tree->chunkCount = (count < MIN_CHUNK_SIZE ? 1 : count/MIN_CHUNK_SIZE);
+	if(tree->chunkCount > MAX_CHUNKS) tree->chunkCount = MAX_CHUNKS;
+	tree->dirty = cpFalse;
+	if(count == 0) return;
+	
+	RunChunks(tree, BoundsWork, parallel);
+	
+	cpBB centers = tree->chunks[0].centers;
+	for(int c=1; c<tree->chunkCount; c++) centers = cpBBMerge(centers, tree->chunks[c].centers);
+	
+	cpFloat width = centers.r - centers.l, height = centers.t - centers.b;
+	tree->origin = cpv(centers.l, centers.b);
+	tree->scale = cpv(width > 0.0f ? 65535.0f/width : 0.0f, height > 0.0f ? 65535.0f/height : 0.0f);
+	RunChunks(tree, MortonWork, parallel);
+	
+	RadixSort(tree, parallel);
+	BuildSubtree(tree, 0, count - 1);
+}
+
+static inline void
+EnsureBuilt(cpLBVH *tree)
+{
+	if(tree->dirty) Build(tree, cpFalse);
+}
+
+//MARK: Memory Management Functions
+
+cpLBVH *
+cpLBVHAlloc(void)
+{
+	return (cpLBVH *)cpcalloc(1, sizeof(cpLBVH));
+}
+
+cpSpatialIndex *
+cpLBVHInit(cpLBVH *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)tree, Klass(), bbfunc, staticIndex);
+	
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->leafSet = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)leafSetEql, allocator);
+	tree->leaves = cpArrayNewWithAllocator(0, allocator);
+	tree->pooledLeaves = cpArrayNewWithAllocator(0, allocator);
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	
+	tree->dirty = cpFalse;
+	
+	tree->runner = NULL;
+	tree->runnerContext = NULL;
+	
+	tree->nodes = NULL;
+	tree->nodeCount = 0;
+	
+	tree->objs = NULL;
+	tree->leafNodes = NULL;
+	tree->leafCount = 0;
+	
+	tree->bbs = NULL;
+	tree->keys = tree->tempKeys = NULL;
+	tree->values = tree->tempValues = NULL;
+	tree->capacity = 0;
+	
+	for(int i=0; i<MAX_CHUNKS; i++){
+		tree->chunks[i].pairs = NULL;
+		tree->chunks[i].pairCount = tree->chunks[i].pairMax = 0;
+	}
+	tree->chunkCount = 0;
+	
+	tree->staticTree = NULL;
+	
+	return (cpSpatialIndex *)tree;
+}
+
+cpSpatialIndex *
+cpLBVHNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpLBVHInit(cpLBVHAlloc(), bbfunc, staticIndex);
+}
+
+cpSpatialIndex *
+cpLBVHNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the tree's own arrays use it too.
+	cpLBVH *tree = (cpLBVH *)cpAllocatorCalloc(allocator, 1, sizeof(cpLBVH));
+	tree->spatialIndex.allocator = allocator;
+	
+	return cpLBVHInit(tree, bbfunc, staticIndex);
+}
+
+static void
+FreeScratch(cpLBVH *tree)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	
+	cpAllocatorFree(allocator, tree->nodes);
+	cpAllocatorFree(allocator, tree->objs);
+	cpAllocatorFree(allocator, tree->leafNodes);
+	cpAllocatorFree(allocator, tree->bbs);
+	cpAllocatorFree(allocator, tree->keys);
+	cpAllocatorFree(allocator, tree->tempKeys);
+	cpAllocatorFree(allocator, tree->values);
+	cpAllocatorFree(allocator, tree->tempValues);
+	
+	tree->nodes = NULL;
+	tree->objs = NULL;
+	tree->leafNodes = NULL;
+	tree->bbs = NULL;
+	tree->keys = tree->tempKeys = NULL;
+	tree->values = tree->tempValues = NULL;
+	tree->capacity = 0;
+	
+	for(int i=0; i<MAX_CHUNKS; i++){
+		cpAllocatorFree(allocator, tree->chunks[i].pairs);
+		tree->chunks[i].pairs = NULL;
+		tree->chunks[i].pairCount = tree->chunks[i].pairMax = 0;
+	}
+	
+	// The tree is gone with the nodes.
+	tree->nodeCount = tree->leafCount = 0;
+	tree->dirty = (tree->leaves->num > 0);
+}
+
+static void
+cpLBVHDestroy(cpLBVH *tree)
+{
+	FreeScratch(tree);
+	
+	cpHashSetFree(tree->leafSet);
+	cpArrayFree(tree->leaves);
+	cpArrayFree(tree->pooledLeaves);
+	
+	if(tree->allocatedBuffers) cpArrayFreeEachBuffer(tree->allocatedBuffers);
+	cpArrayFree(tree->allocatedBuffers);
+}
+
+void
+cpLBVHSetRunner(cpSpatialIndex *index, cpLBVHRunnerFunc runner, void *context)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpLBVHSetRunner() call to non-LBVH spatial index.");
+		return;
+	}
+	
+	cpLBVH *tree = (cpLBVH *)index;
+	tree->runner = runner;
+	tree->runnerContext = context;
+}
+
+cpBool
+cpSpatialIndexIsLBVH(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
+
+//MARK: Misc
+
+static int
+cpLBVHCount(cpLBVH *tree)
+{
+	return tree->leaves->num;
+}
+
+static void
+cpLBVHEach(cpLBVH *tree, cpSpatialIndexIteratorFunc func, void *data)
+{
+	cpArray *leaves = tree->leaves;
+	for(int i=0; i<leaves->num; i++) func(((Leaf *)leaves->arr[i])->obj, data);
+}
+
+static cpBool
+cpLBVHContains(cpLBVH *tree, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(tree->leafSet, hashid, obj) != NULL);
+}
+
+//MARK: Basic Operations
+
+static void
+cpLBVHInsert(cpLBVH *tree, void *obj, cpHashValue hashid)
+{
+	cpHashSetInsert(tree->leafSet, hashid, obj, (cpHashSetTransFunc)leafSetTrans, tree);
+	tree->dirty = cpTrue;
+}
+
+static void
+cpLBVHInsertBatch(cpLBVH *tree, void **objs, const cpHashValue *hashids, int count)
+{
+	for(int i=0; i<count; i++) cpHashSetInsert(tree->leafSet, hashids[i], objs[i], (cpHashSetTransFunc)leafSetTrans, tree);
+	tree->dirty = cpTrue;
+}
+
+static void
+cpLBVHRemove(cpLBVH *tree, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetRemove(tree->leafSet, hashid, obj);
+	if(!leaf) return;
+	
+	// Move the last leaf into the hole.
+	cpArray *leaves = tree->leaves;
+	Leaf *last = (Leaf *)leaves->arr[--leaves->num];
+	leaves->arr[leaf->index] = last;
+	last->index = leaf->index;
+	
+	cpArrayPush(tree->pooledLeaves, leaf);
+	tree->dirty = cpTrue;
+}
+
+//MARK: Reindexing Functions
+
+static void
+cpLBVHReindex(cpLBVH *tree)
+{
+	tree->dirty = cpTrue;
+}
+
+static void
+cpLBVHReindexObject(cpLBVH *tree, void *obj, cpHashValue hashid)
+{
+	if(cpHashSetFind(tree->leafSet, hashid, obj)) tree->dirty = cpTrue;
+}
+
+//MARK: Query Functions
+
+static void
+cpLBVHQuery(cpLBVH *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	EnsureBuilt(tree);
+	
+	LBVHNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	for(int i=0, count=tree->nodeCount; i<count;){
+		LBVHNode *node = nodes + i;
+		
+		if(cpBBIntersects(bb, node->bb)){
+			if(node->leaf >= 0) func(obj, objs[node->leaf], 0, data);
+			i++;
+		} else {
+			i = node->skip;
+		}
+	}
+}
+
+// Query the nodes from 'start' up to 'end' in depth first order.
+static cpFloat
+SkipSegmentQuery(cpLBVH *tree, int start, int end, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	LBVHNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	for(int i=start; i<end;){
+		LBVHNode *node = nodes + i;
+		
+		if(cpBBSegmentQuery(node->bb, a, b) < t_exit){
+			if(node->leaf >= 0) t_exit = cpfmin(t_exit, func(obj, objs[node->leaf], data));
+			i++;
+		} else {
+			i = node->skip;
+		}
+	}
+	
+	return t_exit;
+}
+
+typedef struct SegmentStackEntry {
+	int node;
+	cpFloat t;
+} SegmentStackEntry;
+
+static void
+cpLBVHSegmentQuery(cpLBVH *tree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	EnsureBuilt(tree);
+	
+	LBVHNode *nodes = tree->nodes;
+	void **objs = tree->objs;
+	
+	SegmentStackEntry stack[SEGMENT_STACK_SIZE];
+	int depth = 0;
+	
+	if(tree->nodeCount > 0){
+		SegmentStackEntry root = {0, cpBBSegmentQuery(nodes[0].bb, a, b)};
+		stack[depth++] = root;
+	}
+	
+	while(depth > 0){
+		SegmentStackEntry entry = stack[--depth];
+		if(entry.t >= t_exit) continue;
+		
+		LBVHNode *node = nodes + entry.node;
+		if(node->leaf >= 0){
+			t_exit = cpfmin(t_exit, func(obj, objs[node->leaf], data));
+		} else if(depth + 2 > SEGMENT_STACK_SIZE){
+			t_exit = SkipSegmentQuery(tree, entry.node, node->skip, obj, a, b, t_exit, func, data);
+		} else {
+			int child_a = entry.node + 1;
+			int child_b = nodes[child_a].skip;
+			SegmentStackEntry near = {child_a, cpBBSegmentQuery(nodes[child_a].bb, a, b)};
+			SegmentStackEntry far = {child_b, cpBBSegmentQuery(nodes[child_b].bb, a, b)};
+			
+			if(far.t < near.t){
+				SegmentStackEntry tmp = near;
+				near = far;
+				far = tmp;
+			}
+			
+			// Push the far child first so the near one is visited first.
+			if(far.t < t_exit) stack[depth++] = far;
+			if(near.t < t_exit) stack[depth++] = near;
+		}
+	}
+}
+
+//MARK: Reindex/Query
+
+static void
+cpLBVHReindexQuery(cpLBVH *tree, cpSpatialIndexQueryFunc func, void *data)
+{
+	Build(tree, cpTrue);
+	
+	// A static LBVH is read only once it's built, so the workers can query it too.
+	cpSpatialIndex *staticIndex = tree->spatialIndex.staticIndex;
+	cpLBVH *staticTree = (staticIndex && staticIndex->klass == Klass() ? (cpLBVH *)staticIndex : NULL);
+	if(staticTree) EnsureBuilt(staticTree);
+	tree->staticTree = staticTree;
+	
+	if(tree->leafCount > 0) RunChunks(tree, PairsWork, cpTrue);
+	
+	// Report the pairs in order so the results don't depend on the chunks.
+	for(int c=0; c<tree->chunkCount; c++){
+		Chunk *chunk = tree->chunks + c;
+		for(int i=0; i<chunk->pairCount; i++) func(chunk->pairs[i].a, chunk->pairs[i].b, 0, data);
+		chunk->pairCount = 0;
+	}
+	
+	tree->staticTree = NULL;
+	
+	// Reindex query is also responsible for colliding against the static index.
+	if(!staticTree) cpSpatialIndexCollideStatic((cpSpatialIndex *)tree, staticIndex, func, data);
+}
+
+//MARK: Memory Trimming
+
+static void *
+leafMove(Leaf *leaf, cpLBVH *tree)
+{
+	Leaf *copy = LeafFromPool(tree);
+	(*copy) = (*leaf);
+	tree->leaves->arr[copy->index] = copy;
+	
+	return copy;
+}
+
+static size_t
+cpLBVHTrim(cpLBVH *tree, size_t keepBytes)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	size_t freed = 0;
+	
+	// The tree is rebuilt from scratch anyway, so just drop all of the build data if it's too big.
+	size_t scratchBytes = tree->capacity*(2*sizeof(LBVHNode) + sizeof(void *) + sizeof(cpBB) + 5*sizeof(int));
+	for(int i=0; i<MAX_CHUNKS; i++) scratchBytes += tree->chunks[i].pairMax*sizeof(LBVHPair);
+	
+	if(scratchBytes > keepBytes){
+		FreeScratch(tree);
+		freed += scratchBytes;
+	}
+	
+	cpArray *buffers = tree->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	tree->pooledLeaves->num = 0;
+	
+	freed += cpHashSetTrim(tree->leafSet, (cpHashSetRemapFunc)leafMove, tree, keepBytes);
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		Leaf *buffer = (Leaf *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(tree->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(Leaf);
+			for(int j=0; j<count; j++) cpArrayPush(tree->pooledLeaves, buffer + j);
+		} else {
+			cpAllocatorFree(allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = tree->allocatedBuffers->num*CP_BUFFER_BYTES;
+	return freed + (before > after ? before - after : 0);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpLBVHDestroy,
+	
+	(cpSpatialIndexCountImpl)cpLBVHCount,
+	(cpSpatialIndexEachImpl)cpLBVHEach,
+	(cpSpatialIndexContainsImpl)cpLBVHContains,
+	
+	(cpSpatialIndexInsertImpl)cpLBVHInsert,
+	(cpSpatialIndexRemoveImpl)cpLBVHRemove,
+	
+	(cpSpatialIndexReindexImpl)cpLBVHReindex,
+	(cpSpatialIndexReindexObjectImpl)cpLBVHReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpLBVHReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpLBVHQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpLBVHSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpLBVHTrim,
+	(cpSpatialIndexInsertBatchImpl)cpLBVHInsertBatch,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -161,6 +161,16 @@ SetVerts(cpPolyShape *poly, int count, const cpVect *verts)
 		poly->planes[i + count].v0 = b;
 		poly->planes[i + count].n = n;
 	}
+	
+	// A counter-clockwise quad with perpendicular neighboring edges is a rectangle.
+	// Clockwise ones (ex: from an inverted bounding box) would give the box kernels negative extents, so they are left to GJK.
+	// Body transforms are rigid, so it stays one after being transformed.
+	poly->box = (count == 4);
+	for(int i=0; i<count && poly->box; i++){
+		cpVect n1 = poly->planes[i + count].n;
+		cpVect n2 = poly->planes[(i + 1)%count + count].n;
+		poly->box = (cpvlengthsq(n1) > 0.5f && cpfabs(cpvdot(n1, n2)) < 1e-6f && cpvcross(n1, n2) > 0.0f);
+	}
 }
 
 static struct cpShapeMassInfo
@@ -53,8 +53,8 @@ applyCachedImpulse(cpRotaryLimitJoint *joint, cpFloat dt_coef)
 	cpBody *b = joint->constraint.b;
 	
 	cpFloat j = joint->jAcc*dt_coef;
-	a->w -= j*a->i_inv;
-	b->w += j*b->i_inv;
+	apply_angular_impulse(a, -j);
+	apply_angular_impulse(b, j);
 }
 
 static void
@@ -81,8 +81,8 @@ applyImpulse(cpRotaryLimitJoint *joint, cpFloat dt)
 	j = joint->jAcc - jOld;
 	
 	// apply impulse
-	a->w -= j*a->i_inv;
-	b->w += j*b->i_inv;
+	apply_angular_impulse(a, -j);
+	apply_angular_impulse(b, j);
 }
 
 static cpFloat
@@ -260,7 +260,7 @@ cpContactPointSet
 cpShapesCollide(const cpShape *a, const cpShape *b)
 {
 	struct cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
-	struct cpCollisionInfo info = cpCollide(a, b, 0, contacts);
+	struct cpCollisionInfo info = cpCollide(a, b, 0, contacts, NULL);
 	
 	cpContactPointSet set;
 	set.count = info.count;
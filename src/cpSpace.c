@@ -50,9 +50,9 @@ handlerSetEql(cpCollisionHandler *check, cpCollisionHandler *pair)
 
 // Transformation function for collisionHandlers.
 static void *
-handlerSetTrans(cpCollisionHandler *handler, void *unused)
+handlerSetTrans(cpCollisionHandler *handler, cpSpace *space)
 {
-	cpCollisionHandler *copy = (cpCollisionHandler *)cpcalloc(1, sizeof(cpCollisionHandler));
+	cpCollisionHandler *copy = (cpCollisionHandler *)cpAllocatorCalloc(cpSpaceAllocator(space), 1, sizeof(cpCollisionHandler));
 	memcpy(copy, handler, sizeof(cpCollisionHandler));
 	
 	return copy;
@@ -106,7 +106,7 @@ cpCollisionHandler cpCollisionHandlerDoNothing = {
 static cpVect ShapeVelocityFunc(cpShape *shape){return shape->body->v;}
 
 // Used for disposing of collision handlers.
-static void FreeWrap(void *ptr, void *unused){cpfree(ptr);}
+static void FreeWrap(void *ptr, cpSpace *space){cpAllocatorFree(cpSpaceAllocator(space), ptr);}
 
 //MARK: Memory Management Functions
 
@@ -118,6 +118,12 @@ cpSpaceAlloc(void)
 
 cpSpace*
 cpSpaceInit(cpSpace *space)
+{
+	return cpSpaceInitWithAllocator(space, NULL);
+}
+
+cpSpace*
+cpSpaceInitWithAllocator(cpSpace *space, const cpAllocator *allocator)
 {
 #ifndef NDEBUG
 	static cpBool done = cpFalse;
@@ -137,39 +143,58 @@ cpSpaceInit(cpSpace *space)
 	space->collisionBias = cpfpow(1.0f - 0.1f, 60.0f);
 	space->collisionPersistence = 3;
 	
+	space->collisionBudget.gjkIterations = 30;
+	space->collisionBudget.epaIterations = 30;
+	space->collisionBudget.tolerance = 0.0f;
+	
 	space->locked = 0;
 	space->stamp = 0;
 	
+	// Copy the allocator so the caller doesn't need to keep it around.
+	if(allocator){
+		space->allocator = (*allocator);
+		allocator = &space->allocator;
+	} else {
+		memset(&space->allocator, 0, sizeof(cpAllocator));
+	}
+	
 	space->shapeIDCounter = 0;
-	space->staticShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
-	space->dynamicShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes);
+	space->staticShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, NULL, allocator);
+	space->dynamicShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes, allocator);
 	cpBBTreeSetVelocityFunc(space->dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocityFunc);
 	
-	space->allocatedBuffers = cpArrayNew(0);
+	space->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
 	
-	space->dynamicBodies = cpArrayNew(0);
-	space->staticBodies = cpArrayNew(0);
-	space->sleepingComponents = cpArrayNew(0);
-	space->rousedBodies = cpArrayNew(0);
+	space->dynamicBodies = cpArrayNewWithAllocator(0, allocator);
+	space->staticBodies = cpArrayNewWithAllocator(0, allocator);
+	space->sleepingComponents = cpArrayNewWithAllocator(0, allocator);
+	space->rousedBodies = cpArrayNewWithAllocator(0, allocator);
 	
 	space->sleepTimeThreshold = INFINITY;
 	space->idleSpeedThreshold = 0.0f;
 	
-	space->arbiters = cpArrayNew(0);
-	space->pooledArbiters = cpArrayNew(0);
+	space->arbiters = cpArrayNewWithAllocator(0, allocator);
+	space->pooledArbiters = cpArrayNewWithAllocator(0, allocator);
 	
 	space->contactBuffersHead = NULL;
-	space->cachedArbiters = cpHashSetNew(0, (cpHashSetEqlFunc)arbiterSetEql);
+	space->cachedArbiters = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)arbiterSetEql, allocator);
 	
-	space->constraints = cpArrayNew(0);
+	space->constraints = cpArrayNewWithAllocator(0, allocator);
 	
 	space->usesWildcards = cpFalse;
 	memcpy(&space->defaultHandler, &cpCollisionHandlerDoNothing, sizeof(cpCollisionHandler));
-	space->collisionHandlers = cpHashSetNew(0, (cpHashSetEqlFunc)handlerSetEql);
+	space->collisionHandlers = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)handlerSetEql, allocator);
 	
-	space->postStepCallbacks = cpArrayNew(0);
+	space->postStepCallbacks = cpArrayNewWithAllocator(0, allocator);
 	space->skipPostStep = cpFalse;
 	
+	memset(&space->collisionPairs, 0, sizeof(struct cpCollisionPairArray));
+	memset(&space->prevCollisionPairs, 0, sizeof(struct cpCollisionPairArray));
+	
+	space->stepStatsEnabled = cpFalse;
+	memset(&space->stepStats, 0, sizeof(cpSpaceStepStats));
+	memset(&space->broadphase, 0, sizeof(space->broadphase));
+	
 	cpBody *staticBody = cpBodyInit(&space->_staticBody, 0.0f, 0.0f);
 	cpBodySetType(staticBody, CP_BODY_TYPE_STATIC);
 	cpSpaceSetStaticBody(space, staticBody);
@@ -183,6 +208,12 @@ cpSpaceNew(void)
 	return cpSpaceInit(cpSpaceAlloc());
 }
 
+cpSpace*
+cpSpaceNewWithAllocator(const cpAllocator *allocator)
+{
+	return cpSpaceInitWithAllocator((cpSpace *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpace)), allocator);
+}
+
 static void cpBodyActivateWrap(cpBody *body, void *unused){cpBodyActivate(body);}
 
 void
@@ -205,17 +236,23 @@ cpSpaceDestroy(cpSpace *space)
 	cpArrayFree(space->arbiters);
 	cpArrayFree(space->pooledArbiters);
 	
+	const cpAllocator *allocator = cpSpaceAllocator(space);
+	cpAllocatorFree(allocator, space->collisionPairs.arr);
+	cpAllocatorFree(allocator, space->collisionPairs.order);
+	cpAllocatorFree(allocator, space->prevCollisionPairs.arr);
+	cpAllocatorFree(allocator, space->prevCollisionPairs.order);
+	
 	if(space->allocatedBuffers){
-		cpArrayFreeEach(space->allocatedBuffers, cpfree);
+		cpArrayFreeEachBuffer(space->allocatedBuffers);
 		cpArrayFree(space->allocatedBuffers);
 	}
 	
 	if(space->postStepCallbacks){
-		cpArrayFreeEach(space->postStepCallbacks, cpfree);
+		cpArrayFreeEachBuffer(space->postStepCallbacks);
 		cpArrayFree(space->postStepCallbacks);
 	}
 	
-	if(space->collisionHandlers) cpHashSetEach(space->collisionHandlers, FreeWrap, NULL);
+	if(space->collisionHandlers) cpHashSetEach(space->collisionHandlers, (cpHashSetIteratorFunc)FreeWrap, space);
 	cpHashSetFree(space->collisionHandlers);
 }
 
@@ -223,8 +260,11 @@ void
 cpSpaceFree(cpSpace *space)
 {
 	if(space){
+		// The allocator is stored in the space, copy it first.
+		cpAllocator allocator = space->allocator;
+		
 		cpSpaceDestroy(space);
-		cpfree(space);
+		cpAllocatorFree(allocator.callocFunc ? &allocator : NULL, space);
 	}
 }
 
@@ -323,6 +363,45 @@ cpSpaceSetCollisionBias(cpSpace *space, cpFloat collisionBias)
 	space->collisionBias = collisionBias;
 }
 
+int
+cpSpaceGetGJKIterations(const cpSpace *space)
+{
+	return space->collisionBudget.gjkIterations;
+}
+
+void
+cpSpaceSetGJKIterations(cpSpace *space, int iterations)
+{
+	cpAssertHard(iterations > 0, "Iterations must be positive and non-zero.");
+	space->collisionBudget.gjkIterations = iterations;
+}
+
+int
+cpSpaceGetEPAIterations(const cpSpace *space)
+{
+	return space->collisionBudget.epaIterations;
+}
+
+void
+cpSpaceSetEPAIterations(cpSpace *space, int iterations)
+{
+	cpAssertHard(0 < iterations && iterations <= CP_MAX_EPA_ITERATIONS, "Iterations must be positive and no more than CP_MAX_EPA_ITERATIONS.");
+	space->collisionBudget.epaIterations = iterations;
+}
+
+cpFloat
+cpSpaceGetCollisionTolerance(const cpSpace *space)
+{
+	return space->collisionBudget.tolerance;
+}
+
+void
+cpSpaceSetCollisionTolerance(cpSpace *space, cpFloat tolerance)
+{
+	cpAssertHard(tolerance >= 0.0f, "Tolerance must be positive.");
+	space->collisionBudget.tolerance = tolerance;
+}
+
 cpTimestamp
 cpSpaceGetCollisionPersistence(const cpSpace *space)
 {
@@ -359,6 +438,24 @@ cpSpaceGetCurrentTimeStep(const cpSpace *space)
 	return space->curr_dt;
 }
 
+void
+cpSpaceSetStepStatsEnabled(cpSpace *space, cpBool enabled)
+{
+	space->stepStatsEnabled = enabled;
+}
+
+cpBool
+cpSpaceGetStepStatsEnabled(const cpSpace *space)
+{
+	return space->stepStatsEnabled;
+}
+
+cpSpaceStepStats
+cpSpaceGetStepStats(const cpSpace *space)
+{
+	return space->stepStats;
+}
+
 void
 cpSpaceSetStaticBody(cpSpace *space, cpBody *body)
 {
@@ -399,7 +496,7 @@ cpCollisionHandler *cpSpaceAddCollisionHandler(cpSpace *space, cpCollisionType a
 {
 	cpHashValue hash = CP_HASH_PAIR(a, b);
 	cpCollisionHandler handler = {a, b, DefaultBegin, DefaultPreSolve, DefaultPostSolve, DefaultSeparate, NULL};
-	return (cpCollisionHandler*)cpHashSetInsert(space->collisionHandlers, hash, &handler, (cpHashSetTransFunc)handlerSetTrans, NULL);
+	return (cpCollisionHandler*)cpHashSetInsert(space->collisionHandlers, hash, &handler, (cpHashSetTransFunc)handlerSetTrans, space);
 }
 
 cpCollisionHandler *
@@ -409,7 +506,7 @@ cpSpaceAddWildcardHandler(cpSpace *space, cpCollisionType type)
 	
 	cpHashValue hash = CP_HASH_PAIR(type, CP_WILDCARD_COLLISION_TYPE);
 	cpCollisionHandler handler = {type, CP_WILDCARD_COLLISION_TYPE, AlwaysCollide, AlwaysCollide, DoNothing, DoNothing, NULL};
-	return (cpCollisionHandler*)cpHashSetInsert(space->collisionHandlers, hash, &handler, (cpHashSetTransFunc)handlerSetTrans, NULL);
+	return (cpCollisionHandler*)cpHashSetInsert(space->collisionHandlers, hash, &handler, (cpHashSetTransFunc)handlerSetTrans, space);
 }
 
 
@@ -436,6 +533,45 @@ cpSpaceAddShape(cpSpace *space, cpShape *shape)
 	return shape;
 }
 
+void
+cpSpaceAddShapes(cpSpace *space, cpShape **shapes, int count)
+{
+	cpAssertSpaceUnlocked(space);
+	if(count <= 0) return;
+	
+	// Static shapes are collected from the front of the arrays and dynamic shapes from the back.
+	const cpAllocator *allocator = cpSpaceAllocator(space);
+	void **objs = (void **)cpAllocatorCalloc(allocator, count, sizeof(void *));
+	cpHashValue *hashids = (cpHashValue *)cpAllocatorCalloc(allocator, count, sizeof(cpHashValue));
+	int staticCount = 0, dynamicStart = count;
+	
+	for(int i=0; i<count; i++){
+		cpShape *shape = shapes[i];
+		cpBody *body = shape->body;
+		
+		cpAssertHard(shape->space != space, "You have already added this shape to this space. You must not add it a second time.");
+		cpAssertHard(!shape->space, "You have already added this shape to another space. You cannot add it to a second.");
+		
+		cpBool isStatic = (cpBodyGetType(body) == CP_BODY_TYPE_STATIC);
+		if(!isStatic) cpBodyActivate(body);
+		cpBodyAddShape(body, shape);
+		
+		shape->hashid = space->shapeIDCounter++;
+		cpShapeUpdate(shape, body->transform);
+		shape->space = space;
+		
+		int j = (isStatic ? staticCount++ : --dynamicStart);
+		objs[j] = shape;
+		hashids[j] = shape->hashid;
+	}
+	
+	if(staticCount > 0) cpSpatialIndexInsertBatch(space->staticShapes, objs, hashids, staticCount);
+	if(dynamicStart < count) cpSpatialIndexInsertBatch(space->dynamicShapes, objs + dynamicStart, hashids + dynamicStart, count - dynamicStart);
+	
+	cpAllocatorFree(allocator, objs);
+	cpAllocatorFree(allocator, hashids);
+}
+
 cpBody *
 cpSpaceAddBody(cpSpace *space, cpBody *body)
 {
@@ -683,11 +819,11 @@ copyShapes(cpShape *shape, cpSpatialIndex *index)
 	cpSpatialIndexInsert(index, shape, shape->hashid);
 }
 
-void
-cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
+// Copy the shapes into a new pair of spatial indexes, then free the old ones.
+static void
+cpSpaceSwapSpatialIndexes(cpSpace *space, cpSpatialIndex *staticShapes, cpSpatialIndex *dynamicShapes)
 {
-	cpSpatialIndex *staticShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
-	cpSpatialIndex *dynamicShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes);
+	cpAssertHard(!space->locked, "The spatial indexes cannot be replaced while the space is locked.");
 	
 	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)copyShapes, staticShapes);
 	cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)copyShapes, dynamicShapes);
@@ -698,3 +834,274 @@ cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
 	space->staticShapes = staticShapes;
 	space->dynamicShapes = dynamicShapes;
 }
+
+void
+cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
+{
+	// The hashes retune themselves as the first shapes are copied in, so the starting size doesn't matter much.
+	cpBool autoResize = (dim <= 0.0f);
+	if(autoResize) dim = 1.0f;
+	
+	cpSpatialIndex *staticShapes = cpSpaceHashNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL, cpSpaceAllocator(space));
+	cpSpatialIndex *dynamicShapes = cpSpaceHashNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, cpSpaceAllocator(space));
+	
+	cpSpaceHashSetAutoResize((cpSpaceHash *)staticShapes, autoResize);
+	cpSpaceHashSetAutoResize((cpSpaceHash *)dynamicShapes, autoResize);
+	
+	cpSpaceSwapSpatialIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseSpatialGrid(cpSpace *space, cpFloat dim, int count)
+{
+	cpSpatialIndex *staticShapes = cpSpaceGridNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL, cpSpaceAllocator(space));
+	cpSpatialIndex *dynamicShapes = cpSpaceGridNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, cpSpaceAllocator(space));
+	cpSpaceSwapSpatialIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseFlatBBTree(cpSpace *space)
+{
+	cpSpatialIndex *staticShapes = cpFlatBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, NULL, cpSpaceAllocator(space));
+	cpSpatialIndex *dynamicShapes = cpFlatBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, cpSpaceAllocator(space));
+	cpSpaceSwapSpatialIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseLBVH(cpSpace *space)
+{
+	cpSpatialIndex *staticShapes = cpLBVHNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, NULL, cpSpaceAllocator(space));
+	cpSpatialIndex *dynamicShapes = cpLBVHNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, cpSpaceAllocator(space));
+	cpSpaceSwapSpatialIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceSetBBTreeRefitThreshold(cpSpace *space, cpFloat threshold)
+{
+	cpBBTreeSetRefitThreshold(space->dynamicShapes, threshold);
+}
+
+//MARK: Adaptive Broadphase
+
+// Number of steps sampled before each decision.
+#define BROADPHASE_SAMPLE_STEPS 32
+// Decisions to wait after a switch before considering another one.
+#define BROADPHASE_COOLDOWN 4
+// Longest time in decisions that an index that lost a trial sits out for.
+#define BROADPHASE_MAX_BACKOFF 64
+// Another index is tried when it is estimated to be this much cheaper,
+// and kept when it then actually takes this much less time than the one it replaced.
+#define BROADPHASE_ESTIMATE_RATIO 0.9f
+#define BROADPHASE_TRIAL_RATIO 0.95f
+// Trials and switches are only judged while the number of pairs per step changes by less than this between samples.
+#define BROADPHASE_STEADY_RATIO 0.25f
+// Too few shapes to be worth switching away from the tree.
+#define BROADPHASE_MIN_SHAPES 128
+
+// Rough costs used by EstimateBroadphaseCosts(), in nanoseconds.
+// Colliding a pair.
+#define COST_PAIR 400.0f
+// Reporting a pair from the broadphase that is then rejected or collided.
+#define COST_PAIR_REPORT 10.0f
+// Updating a tree leaf and reporting its cached pairs, reinserting a leaf per level of the tree.
+#define COST_TREE_LEAF 600.0f
+#define COST_TREE_REINSERT 30.0f
+// Querying the static tree per level.
+#define COST_STATIC_QUERY 100.0f
+// Hashing a shape into a cell.
+#define COST_HASH_CELL 25.0f
+// Sorting a shape and testing a pair that overlaps on the sweep axis.
+#define COST_SWEEP_SORT 50.0f
+#define COST_SWEEP_TEST 1.0f
+
+// Pairs reported per colliding pair because of the padded tree leaves and shared hash cells.
+#define TREE_PAIRS 2.2f
+#define HASH_PAIRS 3.0f
+
+struct BroadphaseSample {
+	cpFloat dt;
+	cpFloat count, reinserts;
+	cpFloat sumW, sumH, sumWH, sumLogSize;
+	cpFloat sumX, sumY, sumXX, sumYY;
+};
+
+static void
+SampleShape(cpShape *shape, struct BroadphaseSample *sample)
+{
+	cpBB bb = shape->bb;
+	cpFloat w = bb.r - bb.l, h = bb.t - bb.b;
+	cpFloat x = 0.5f*(bb.l + bb.r), y = 0.5f*(bb.b + bb.t);
+	
+	sample->count += 1.0f;
+	sample->sumW += w;
+	sample->sumH += h;
+	sample->sumWH += w*h;
+	sample->sumLogSize += (cpFloat)log(cpfmax(cpfmax(w, h), 1e-6f));
+	sample->sumX += x;
+	sample->sumY += y;
+	sample->sumXX += x*x;
+	sample->sumYY += y*y;
+	
+	// A bounding box tree pads each shape by 10% of its size plus a tenth of a second of its velocity,
+	// and reinserts it once it moves outside of that. Estimate how often that happens.
+	cpBody *body = shape->body;
+	cpFloat speed = cpvlength(body->v) + cpfabs(body->w)*0.5f*(w + h);
+	sample->reinserts += cpfmin(speed*sample->dt/(0.1f*(cpfmax(w, h) + speed)), 1.0f);
+}
+
+// Estimate the time per step each index would take to find and collide the pairs.
+static void
+EstimateBroadphaseCosts(cpSpace *space, cpFloat pairs, cpFloat costs[3])
+{
+	struct BroadphaseSample sample = {0};
+	sample.dt = space->curr_dt;
+	cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)SampleShape, &sample);
+	
+	cpFloat n = sample.count;
+	if(n == 0.0f){
+		costs[CP_BROADPHASE_BBTREE] = costs[CP_BROADPHASE_SPATIAL_HASH] = costs[CP_BROADPHASE_SWEEP_1D] = 0.0f;
+		return;
+	}
+	
+	cpFloat logCount = (cpFloat)log2(n + 1.0f);
+	cpFloat logStatic = (cpFloat)log2(cpSpatialIndexCount(space->staticShapes) + 1.0);
+	
+	// The tree only queries for the shapes it reinserts, the others query the static shapes for every shape.
+	costs[CP_BROADPHASE_BBTREE] = n*COST_TREE_LEAF + sample.reinserts*logCount*COST_TREE_REINSERT
+		+ sample.reinserts*logStatic*COST_STATIC_QUERY + pairs*(COST_PAIR + TREE_PAIRS*COST_PAIR_REPORT);
+	
+	// The hash sizes its cells close to the typical shape, so count the cells each shape covers at the geometric mean size.
+	cpFloat dim = cpfexp(sample.sumLogSize/n);
+	cpFloat cells = 1.0f + (sample.sumW + sample.sumH)/(n*dim) + sample.sumWH/(n*dim*dim);
+	costs[CP_BROADPHASE_SPATIAL_HASH] = n*cells*COST_HASH_CELL + n*(logStatic + 1.0f)*COST_STATIC_QUERY
+		+ pairs*(COST_PAIR + HASH_PAIRS*COST_PAIR_REPORT);
+	
+	// The sweep tests every pair that overlaps on its axis, the one the centers are spread out the most along.
+	cpFloat varX = cpfmax(sample.sumXX/n - cpfpow(sample.sumX/n, 2.0f), 0.0f);
+	cpFloat varY = cpfmax(sample.sumYY/n - cpfpow(sample.sumY/n, 2.0f), 0.0f);
+	cpFloat extent = (varX >= varY ? sample.sumW : sample.sumH)/n;
+	cpFloat span = cpfsqrt(12.0f*cpfmax(varX, varY));
+	cpFloat axisPairs = (span > 0.0f ? cpfmin(n*extent/span, n) : n);
+	costs[CP_BROADPHASE_SWEEP_1D] = n*(COST_SWEEP_SORT + axisPairs*COST_SWEEP_TEST) + n*(logStatic + 1.0f)*COST_STATIC_QUERY
+		+ pairs*(COST_PAIR + COST_PAIR_REPORT);
+}
+
+static void
+cpSpaceUseBroadphase(cpSpace *space, cpSpaceBroadphase broadphase)
+{
+	const cpAllocator *allocator = cpSpaceAllocator(space);
+	
+	// Static shapes rarely move and can be any size, so they always stay in a tree.
+	cpSpatialIndex *staticShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, NULL, allocator);
+	cpSpatialIndex *dynamicShapes = NULL;
+	
+	switch(broadphase){
+		case CP_BROADPHASE_BBTREE:
+			dynamicShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, allocator);
+			cpBBTreeSetVelocityFunc(dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocityFunc);
+			break;
+		case CP_BROADPHASE_SPATIAL_HASH:
+			dynamicShapes = cpSpaceHashNewWithAllocator(1.0f, 0, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, allocator);
+			cpSpaceHashSetAutoResize((cpSpaceHash *)dynamicShapes, cpTrue);
+			break;
+		case CP_BROADPHASE_SWEEP_1D:
+			dynamicShapes = cpSweep1DNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, allocator);
+			break;
+	}
+	
+	cpSpaceSwapSpatialIndexes(space, staticShapes, dynamicShapes);
+	space->broadphase.current = broadphase;
+}
+
+static cpBool
+Steady(cpFloat pairs, cpFloat lastPairs)
+{
+	return cpfabs(pairs - lastPairs) <= BROADPHASE_STEADY_RATIO*cpfmax(pairs, lastPairs) + 16.0f;
+}
+
+void
+cpSpaceAdaptBroadphase(cpSpace *space)
+{
+	struct cpSpaceBroadphaseSampler *sampler = &space->broadphase;
+	if(!sampler->enabled || sampler->steps < BROADPHASE_SAMPLE_STEPS) return;
+	
+	cpFloat time = (cpFloat)sampler->time/(cpFloat)sampler->steps;
+	cpFloat pairs = (cpFloat)sampler->pairs/(cpFloat)sampler->steps;
+	cpBool steady = Steady(pairs, sampler->lastPairs);
+	sampler->lastPairs = pairs;
+	sampler->steps = 0;
+	sampler->time = sampler->pairs = 0;
+	
+	for(int i=0; i<3; i++){
+		if(sampler->banned[i] > 0) sampler->banned[i]--;
+	}
+	
+	if(sampler->trialBaseline > 0.0f){
+		cpSpaceBroadphase tried = sampler->current;
+		
+		if(!steady){
+			// The workload changed under the trial so the times can't be compared. Go back and try again later.
+			cpSpaceUseBroadphase(space, sampler->previous);
+		} else if(time > sampler->trialBaseline*BROADPHASE_TRIAL_RATIO){
+			// The estimate was wrong for this workload. Go back, and wait longer each time before trying it again.
+			sampler->banned[tried] = sampler->backoff[tried];
+			sampler->backoff[tried] = (sampler->backoff[tried] < BROADPHASE_MAX_BACKOFF/2 ? 2*sampler->backoff[tried] : BROADPHASE_MAX_BACKOFF);
+			cpSpaceUseBroadphase(space, sampler->previous);
+		} else {
+			sampler->backoff[tried] = BROADPHASE_COOLDOWN;
+		}
+		
+		sampler->trialBaseline = 0.0f;
+		sampler->cooldown = BROADPHASE_COOLDOWN;
+		return;
+	}
+	
+	if(sampler->cooldown > 0){
+		sampler->cooldown--;
+		return;
+	}
+	
+	if(!steady) return;
+	if(sampler->current == CP_BROADPHASE_BBTREE && cpSpatialIndexCount(space->dynamicShapes) < BROADPHASE_MIN_SHAPES) return;
+	
+	cpFloat costs[3];
+	EstimateBroadphaseCosts(space, pairs, costs);
+	
+	cpSpaceBroadphase best = sampler->current;
+	for(int i=0; i<3; i++){
+		if(sampler->banned[i] == 0 && costs[i] < costs[best]) best = (cpSpaceBroadphase)i;
+	}
+	
+	if(best != sampler->current && costs[best] < costs[sampler->current]*BROADPHASE_ESTIMATE_RATIO){
+		sampler->previous = sampler->current;
+		sampler->trialBaseline = cpfmax(time, 1.0f);
+		cpSpaceUseBroadphase(space, best);
+	}
+}
+
+void
+cpSpaceSetAdaptiveBroadphase(cpSpace *space, cpBool enabled)
+{
+	cpAssertHard(!space->locked, "The broadphase cannot be changed while the space is locked.");
+	
+	struct cpSpaceBroadphaseSampler *sampler = &space->broadphase;
+	if(enabled == sampler->enabled) return;
+	
+	memset(sampler, 0, sizeof(*sampler));
+	for(int i=0; i<3; i++) sampler->backoff[i] = BROADPHASE_COOLDOWN;
+	
+	if(enabled) cpSpaceUseBroadphase(space, CP_BROADPHASE_BBTREE);
+	sampler->enabled = enabled;
+}
+
+cpBool
+cpSpaceGetAdaptiveBroadphase(const cpSpace *space)
+{
+	return space->broadphase.enabled;
+}
+
+cpSpaceBroadphase
+cpSpaceGetBroadphase(const cpSpace *space)
+{
+	return space->broadphase.current;
+}
@@ -0,0 +1,638 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chipmunk/chipmunk_private.h"
+
+// A uniform grid of square cells, hashed into a fixed size table of buckets like cpSpaceHash.
+// Rather than keeping linked lists of bins up to date, the whole table is rebuilt from scratch every reindex.
+// A counting sort packs the objects in each bucket into a single array of references in a few linear passes,
+// so nothing is allocated per object and there are no handles to retain or purge.
+// Objects that overlap several cells are only reported once, from the cell that holds the lower left corner of their overlap.
+
+static inline cpSpatialIndexClass *Klass();
+
+typedef struct Leaf Leaf;
+typedef struct CellRange CellRange;
+
+struct cpSpaceGrid {
+	cpSpatialIndex spatialIndex;
+	
+	cpFloat celldim;
+	// The number of buckets is a power of two so they can be found with a mask.
+	unsigned int mask;
+	
+	cpHashSet *leafSet;
+	cpArray *leaves;
+	cpArray *pooledLeaves;
+	cpArray *allocatedBuffers;
+	
+	// Set when the table needs to be rebuilt before it can be queried.
+	cpBool dirty;
+	
+	// Per object data, copied from the leaves in the same order, all 'capacity' long.
+	void **objs;
+	cpBB *bbs;
+	CellRange *ranges;
+	unsigned int *stamps;
+	int count, capacity;
+	
+	// The references in bucket 'i' are refs[cells[i]] to refs[cells[i + 1] - 1], sorted by object index.
+	int *cells;
+	int *refs;
+	int refCapacity;
+	
+	// Used to avoid visiting objects twice in segment queries.
+	unsigned int stamp;
+};
+
+struct CellRange {
+	int l, b, r, t;
+};
+
+struct Leaf {
+	void *obj;
+	// Index of the leaf in the grid's leaves array.
+	int index;
+};
+
+//MARK: Leaf Functions
+
+static int leafSetEql(void *obj, Leaf *leaf){return (obj == leaf->obj);}
+
+static Leaf *
+LeafFromPool(cpSpaceGrid *grid)
+{
+	if(grid->pooledLeaves->num == 0){
+		// leaf pool is exhausted, make more
+		int count = CP_BUFFER_BYTES/sizeof(Leaf);
+		cpAssertHard(count, "Internal Error: Buffer size is too small.");
+		
+		Leaf *buffer = (Leaf *)cpAllocatorCalloc(grid->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
+		cpArrayPush(grid->allocatedBuffers, buffer);
+		
+		for(int i=0; i<count; i++) cpArrayPush(grid->pooledLeaves, buffer + i);
+	}
+	
+	return (Leaf *)cpArrayPop(grid->pooledLeaves);
+}
+
+static void *
+leafSetTrans(void *obj, cpSpaceGrid *grid)
+{
+	Leaf *leaf = LeafFromPool(grid);
+	leaf->obj = obj;
+	leaf->index = grid->leaves->num;
+	cpArrayPush(grid->leaves, leaf);
+	
+	return leaf;
+}
+
+//MARK: Helper Functions
+
+// Much faster than (int)floor(f)
+static inline int
+floor_int(cpFloat f)
+{
+	int i = (int)f;
+	return (f < 0.0f && f != i ? i - 1 : i);
+}
+
+static inline CellRange
+CellRangeForBB(cpSpaceGrid *grid, cpBB bb)
+{
+	cpFloat dim = grid->celldim;
+	CellRange range = {floor_int(bb.l/dim), floor_int(bb.b/dim), floor_int(bb.r/dim), floor_int(bb.t/dim)};
+	return range;
+}
+
+static inline int
+CellIndex(cpSpaceGrid *grid, int x, int y)
+{
+	unsigned int h = (unsigned int)x*2654435761u ^ (unsigned int)y*2246822519u;
+	return (int)((h ^ (h >> 16)) & grid->mask);
+}
+
+// Check if 'range' holds the lower left corner of its overlap with the cell range 'other'.
+static inline cpBool
+OwnsCorner(CellRange range, CellRange other, int x, int y)
+{
+	return ((range.l > other.l ? range.l : other.l) == x && (range.b > other.b ? range.b : other.b) == y);
+}
+
+//MARK: Building
+
+static void
+EnsureCapacity(cpSpaceGrid *grid, int count)
+{
+	if(count <= grid->capacity) return;
+	
+	const cpAllocator *allocator = grid->spatialIndex.allocator;
+	int capacity = (grid->capacity ? grid->capacity : 32);
+	while(capacity < count) capacity *= 2;
+	
+	grid->capacity = capacity;
+	grid->objs = (void **)cpAllocatorRealloc(allocator, grid->objs, capacity*sizeof(void *));
+	grid->bbs = (cpBB *)cpAllocatorRealloc(allocator, grid->bbs, capacity*sizeof(cpBB));
+	grid->ranges = (CellRange *)cpAllocatorRealloc(allocator, grid->ranges, capacity*sizeof(CellRange));
+	
+	// The stamps need to start out cleared.
+	cpAllocatorFree(allocator, grid->stamps);
+	grid->stamps = (unsigned int *)cpAllocatorCalloc(allocator, capacity, sizeof(unsigned int));
+}
+
+static void
+Build(cpSpaceGrid *grid)
+{
+	const cpAllocator *allocator = grid->spatialIndex.allocator;
+	cpSpatialIndexBBFunc bbfunc = grid->spatialIndex.bbfunc;
+	
+	int count = grid->leaves->num;
+	EnsureCapacity(grid, count);
+	
+	int bucketCount = (int)grid->mask + 1;
+	if(!grid->cells) grid->cells = (int *)cpAllocatorCalloc(allocator, bucketCount + 1, sizeof(int));
+	
+	int *cells = grid->cells;
+	memset(cells, 0, (bucketCount + 1)*sizeof(int));
+	
+	// Update the bounds and count the references in each bucket.
+	Leaf **leaves = (Leaf **)grid->leaves->arr;
+	int refCount = 0;
+	
+	for(int i=0; i<count; i++){
+		void *obj = leaves[i]->obj;
+		cpBB bb = bbfunc(obj);
+		CellRange range = CellRangeForBB(grid, bb);
+		
+		grid->objs[i] = obj;
+		grid->bbs[i] = bb;
+		grid->ranges[i] = range;
+		
+		for(int x=range.l; x<=range.r; x++){
+			for(int y=range.b; y<=range.t; y++) cells[CellIndex(grid, x, y)]++;
+		}
+		
+		refCount += (range.r - range.l + 1)*(range.t - range.b + 1);
+	}
+	
+	if(refCount > grid->refCapacity){
+		int capacity = (grid->refCapacity ? grid->refCapacity : 64);
+		while(capacity < refCount) capacity *= 2;
+		
+		cpAllocatorFree(allocator, grid->refs);
+		grid->refs = (int *)cpAllocatorCalloc(allocator, capacity, sizeof(int));
+		grid->refCapacity = capacity;
+	}
+	
+	// Turn the counts into the end of each bucket.
+	for(int i=1; i<bucketCount; i++) cells[i] += cells[i - 1];
+	cells[bucketCount] = refCount;
+	
+	// Fill the buckets from their ends, backwards, so each one is sorted by object index.
+	// That also leaves the cells pointing to the start of their buckets.
+	int *refs = grid->refs;
+	for(int i=count - 1; i>=0; i--){
+		CellRange range = grid->ranges[i];
+		
+		for(int x=range.r; x>=range.l; x--){
+			for(int y=range.t; y>=range.b; y--) refs[--cells[CellIndex(grid, x, y)]] = i;
+		}
+	}
+	
+	grid->count = count;
+	grid->dirty = cpFalse;
+}
+
+static inline void
+EnsureBuilt(cpSpaceGrid *grid)
+{
+	if(grid->dirty) Build(grid);
+}
+
+//MARK: Memory Management Functions
+
+cpSpaceGrid *
+cpSpaceGridAlloc(void)
+{
+	return (cpSpaceGrid *)cpcalloc(1, sizeof(cpSpaceGrid));
+}
+
+static unsigned int
+BucketMask(int numcells)
+{
+	unsigned int count = 16;
+	while(count < (unsigned int)numcells && count < (1u << 30)) count *= 2;
+	
+	return count - 1;
+}
+
+cpSpatialIndex *
+cpSpaceGridInit(cpSpaceGrid *grid, cpFloat celldim, int numcells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)grid, Klass(), bbfunc, staticIndex);
+	
+	grid->celldim = celldim;
+	grid->mask = BucketMask(numcells);
+	
+	const cpAllocator *allocator = grid->spatialIndex.allocator;
+	grid->leafSet = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)leafSetEql, allocator);
+	grid->leaves = cpArrayNewWithAllocator(0, allocator);
+	grid->pooledLeaves = cpArrayNewWithAllocator(0, allocator);
+	grid->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	
+	grid->dirty = cpTrue;
+	
+	grid->objs = NULL;
+	grid->bbs = NULL;
+	grid->ranges = NULL;
+	grid->stamps = NULL;
+	grid->count = grid->capacity = 0;
+	
+	grid->cells = NULL;
+	grid->refs = NULL;
+	grid->refCapacity = 0;
+	
+	grid->stamp = 1;
+	
+	return (cpSpatialIndex *)grid;
+}
+
+cpSpatialIndex *
+cpSpaceGridNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpSpaceGridInit(cpSpaceGridAlloc(), celldim, cells, bbfunc, staticIndex);
+}
+
+cpSpatialIndex *
+cpSpaceGridNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the grid's own arrays use it too.
+	cpSpaceGrid *grid = (cpSpaceGrid *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpaceGrid));
+	grid->spatialIndex.allocator = allocator;
+	
+	return cpSpaceGridInit(grid, celldim, cells, bbfunc, staticIndex);
+}
+
+static void
+FreeScratch(cpSpaceGrid *grid)
+{
+	const cpAllocator *allocator = grid->spatialIndex.allocator;
+	
+	cpAllocatorFree(allocator, grid->objs);
+	cpAllocatorFree(allocator, grid->bbs);
+	cpAllocatorFree(allocator, grid->ranges);
+	cpAllocatorFree(allocator, grid->stamps);
+	cpAllocatorFree(allocator, grid->cells);
+	cpAllocatorFree(allocator, grid->refs);
+	
+	grid->objs = NULL;
+	grid->bbs = NULL;
+	grid->ranges = NULL;
+	grid->stamps = NULL;
+	grid->count = grid->capacity = 0;
+	
+	grid->cells = NULL;
+	grid->refs = NULL;
+	grid->refCapacity = 0;
+	
+	grid->dirty = cpTrue;
+}
+
+static void
+cpSpaceGridDestroy(cpSpaceGrid *grid)
+{
+	FreeScratch(grid);
+	
+	cpHashSetFree(grid->leafSet);
+	cpArrayFree(grid->leaves);
+	cpArrayFree(grid->pooledLeaves);
+	
+	if(grid->allocatedBuffers) cpArrayFreeEachBuffer(grid->allocatedBuffers);
+	cpArrayFree(grid->allocatedBuffers);
+}
+
+void
+cpSpaceGridResize(cpSpatialIndex *index, cpFloat celldim, int numcells)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpSpaceGridResize() call to non-cpSpaceGrid spatial index.");
+		return;
+	}
+	
+	cpSpaceGrid *grid = (cpSpaceGrid *)index;
+	grid->celldim = celldim;
+	grid->mask = BucketMask(numcells);
+	
+	cpAllocatorFree(grid->spatialIndex.allocator, grid->cells);
+	grid->cells = NULL;
+	grid->dirty = cpTrue;
+}
+
+//MARK: Misc
+
+static int
+cpSpaceGridCount(cpSpaceGrid *grid)
+{
+	return grid->leaves->num;
+}
+
+static void
+cpSpaceGridEach(cpSpaceGrid *grid, cpSpatialIndexIteratorFunc func, void *data)
+{
+	cpArray *leaves = grid->leaves;
+	for(int i=0; i<leaves->num; i++) func(((Leaf *)leaves->arr[i])->obj, data);
+}
+
+static cpBool
+cpSpaceGridContains(cpSpaceGrid *grid, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(grid->leafSet, hashid, obj) != NULL);
+}
+
+//MARK: Basic Operations
+
+static void
+cpSpaceGridInsert(cpSpaceGrid *grid, void *obj, cpHashValue hashid)
+{
+	cpHashSetInsert(grid->leafSet, hashid, obj, (cpHashSetTransFunc)leafSetTrans, grid);
+	grid->dirty = cpTrue;
+}
+
+static void
+cpSpaceGridInsertBatch(cpSpaceGrid *grid, void **objs, const cpHashValue *hashids, int count)
+{
+	for(int i=0; i<count; i++) cpHashSetInsert(grid->leafSet, hashids[i], objs[i], (cpHashSetTransFunc)leafSetTrans, grid);
+	grid->dirty = cpTrue;
+}
+
+static void
+cpSpaceGridRemove(cpSpaceGrid *grid, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetRemove(grid->leafSet, hashid, obj);
+	if(!leaf) return;
+	
+	// Move the last leaf into the hole.
+	cpArray *leaves = grid->leaves;
+	Leaf *last = (Leaf *)leaves->arr[--leaves->num];
+	leaves->arr[leaf->index] = last;
+	last->index = leaf->index;
+	
+	cpArrayPush(grid->pooledLeaves, leaf);
+	grid->dirty = cpTrue;
+}
+
+//MARK: Reindexing Functions
+
+static void
+cpSpaceGridReindex(cpSpaceGrid *grid)
+{
+	grid->dirty = cpTrue;
+}
+
+static void
+cpSpaceGridReindexObject(cpSpaceGrid *grid, void *obj, cpHashValue hashid)
+{
+	if(cpHashSetFind(grid->leafSet, hashid, obj)) grid->dirty = cpTrue;
+}
+
+//MARK: Query Functions
+
+static void
+cpSpaceGridQuery(cpSpaceGrid *grid, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	EnsureBuilt(grid);
+	if(grid->count == 0) return;
+	
+	CellRange range = CellRangeForBB(grid, bb);
+	int *cells = grid->cells, *refs = grid->refs;
+	
+	for(int x=range.l; x<=range.r; x++){
+		for(int y=range.b; y<=range.t; y++){
+			int idx = CellIndex(grid, x, y);
+			
+			for(int i=cells[idx], end=cells[idx + 1], prev=-1; i<end; i++){
+				int ref = refs[i];
+				
+				// Skip the repeats of objects with several cells in the same bucket.
+				if(ref == prev) continue;
+				prev = ref;
+				
+				void *other = grid->objs[ref];
+				if(other != obj && cpBBIntersects(bb, grid->bbs[ref]) && OwnsCorner(range, grid->ranges[ref], x, y)){
+					func(obj, other, 0, data);
+				}
+			}
+		}
+	}
+}
+
+// modified from http://playtechs.blogspot.com/2007/03/raytracing-on-grid.html
+static void
+cpSpaceGridSegmentQuery(cpSpaceGrid *grid, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	EnsureBuilt(grid);
+	if(grid->count == 0) return;
+	
+	// Unlike pairs, the cells along a segment can't tell which one to report an object from.
+	unsigned int stamp = grid->stamp++;
+	if(grid->stamp == 0){
+		memset(grid->stamps, 0, grid->capacity*sizeof(unsigned int));
+		grid->stamp = 1;
+	}
+	
+	cpVect ga = cpvmult(a, 1.0f/grid->celldim);
+	cpVect gb = cpvmult(b, 1.0f/grid->celldim);
+	
+	int cell_x = floor_int(ga.x), cell_y = floor_int(ga.y);
+	
+	cpFloat t = 0;
+	
+	int x_inc, y_inc;
+	cpFloat temp_v, temp_h;
+	
+	if (gb.x > ga.x){
+		x_inc = 1;
+		temp_h = (cpffloor(ga.x + 1.0f) - ga.x);
+	} else {
+		x_inc = -1;
+		temp_h = (ga.x - cpffloor(ga.x));
+	}
+	
+	if (gb.y > ga.y){
+		y_inc = 1;
+		temp_v = (cpffloor(ga.y + 1.0f) - ga.y);
+	} else {
+		y_inc = -1;
+		temp_v = (ga.y - cpffloor(ga.y));
+	}
+	
+	// Division by zero is *very* slow on ARM
+	cpFloat dx = cpfabs(gb.x - ga.x), dy = cpfabs(gb.y - ga.y);
+	cpFloat dt_dx = (dx ? 1.0f/dx : INFINITY), dt_dy = (dy ? 1.0f/dy : INFINITY);
+	
+	// A segment that starts on a cell boundary and heads left or down crosses it right away.
+	// Also avoids the NANs in horizontal and vertical directions.
+	cpFloat next_h = (temp_h ? temp_h*dt_dx : (dx ? 0.0f : INFINITY));
+	cpFloat next_v = (temp_v ? temp_v*dt_dy : (dy ? 0.0f : INFINITY));
+	
+	int *cells = grid->cells, *refs = grid->refs;
+	unsigned int *stamps = grid->stamps;
+	
+	while(t < t_exit){
+		int idx = CellIndex(grid, cell_x, cell_y);
+		
+		for(int i=cells[idx], end=cells[idx + 1]; i<end; i++){
+			int ref = refs[i];
+			if(stamps[ref] == stamp) continue;
+			stamps[ref] = stamp;
+			
+			if(cpBBSegmentQuery(grid->bbs[ref], a, b) < t_exit){
+				t_exit = cpfmin(t_exit, func(obj, grid->objs[ref], data));
+			}
+		}
+		
+		if (next_v < next_h){
+			cell_y += y_inc;
+			t = next_v;
+			next_v += dt_dy;
+		} else {
+			cell_x += x_inc;
+			t = next_h;
+			next_h += dt_dx;
+		}
+	}
+}
+
+static void
+cpSpaceGridReindexQuery(cpSpaceGrid *grid, cpSpatialIndexQueryFunc func, void *data)
+{
+	Build(grid);
+	
+	int *cells = grid->cells, *refs = grid->refs;
+	void **objs = grid->objs;
+	cpBB *bbs = grid->bbs;
+	CellRange *ranges = grid->ranges;
+	
+	// Every overlapping pair of objects shares the bucket of the cell that holds the lower left corner of their overlap.
+	for(int idx=0, bucketCount=(int)grid->mask + 1; idx<bucketCount; idx++){
+		int begin = cells[idx], end = cells[idx + 1];
+		
+		for(int i=begin; i<end; i++){
+			int refA = refs[i];
+			if(i > begin && refs[i - 1] == refA) continue;
+			
+			cpBB bb = bbs[refA];
+			CellRange range = ranges[refA];
+			
+			for(int j=i + 1; j<end; j++){
+				int refB = refs[j];
+				if(refs[j - 1] == refB || !cpBBIntersects(bb, bbs[refB])) continue;
+				
+				CellRange other = ranges[refB];
+				int x = (range.l > other.l ? range.l : other.l);
+				int y = (range.b > other.b ? range.b : other.b);
+				if(CellIndex(grid, x, y) == idx) func(objs[refA], objs[refB], 0, data);
+			}
+		}
+	}
+	
+	// Reindex query is also responsible for colliding against the static index.
+	// Fortunately there is a helper function for that.
+	cpSpatialIndexCollideStatic((cpSpatialIndex *)grid, grid->spatialIndex.staticIndex, func, data);
+}
+
+//MARK: Memory Trimming
+
+static void *
+leafMove(Leaf *leaf, cpSpaceGrid *grid)
+{
+	Leaf *copy = LeafFromPool(grid);
+	(*copy) = (*leaf);
+	grid->leaves->arr[copy->index] = copy;
+	
+	return copy;
+}
+
+static size_t
+cpSpaceGridTrim(cpSpaceGrid *grid, size_t keepBytes)
+{
+	const cpAllocator *allocator = grid->spatialIndex.allocator;
+	size_t freed = 0;
+	
+	// The table is rebuilt from scratch anyway, so just drop all of it if it's too big.
+	size_t scratchBytes = grid->capacity*(sizeof(void *) + sizeof(cpBB) + sizeof(CellRange) + sizeof(unsigned int)) + grid->refCapacity*sizeof(int);
+	if(grid->cells) scratchBytes += (grid->mask + 2)*sizeof(int);
+	
+	if(scratchBytes > keepBytes){
+		FreeScratch(grid);
+		freed += scratchBytes;
+	}
+	
+	cpArray *buffers = grid->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	grid->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	grid->pooledLeaves->num = 0;
+	
+	freed += cpHashSetTrim(grid->leafSet, (cpHashSetRemapFunc)leafMove, grid, keepBytes);
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		Leaf *buffer = (Leaf *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(grid->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(Leaf);
+			for(int j=0; j<count; j++) cpArrayPush(grid->pooledLeaves, buffer + j);
+		} else {
+			cpAllocatorFree(allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = grid->allocatedBuffers->num*CP_BUFFER_BYTES;
+	return freed + (before > after ? before - after : 0);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpSpaceGridDestroy,
+	
+	(cpSpatialIndexCountImpl)cpSpaceGridCount,
+	(cpSpatialIndexEachImpl)cpSpaceGridEach,
+	(cpSpatialIndexContainsImpl)cpSpaceGridContains,
+	
+	(cpSpatialIndexInsertImpl)cpSpaceGridInsert,
+	(cpSpatialIndexRemoveImpl)cpSpaceGridRemove,
+	
+	(cpSpatialIndexReindexImpl)cpSpaceGridReindex,
+	(cpSpatialIndexReindexObjectImpl)cpSpaceGridReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpSpaceGridReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpSpaceGridQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpSpaceGridSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpSpaceGridTrim,
+	(cpSpatialIndexInsertBatchImpl)cpSpaceGridInsertBatch,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}
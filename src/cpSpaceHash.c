@@ -39,6 +39,11 @@ struct cpSpaceHash {
 	cpArray *allocatedBuffers;
 	
 	cpTimestamp stamp;
+	
+	// Set when the hash picks its own cell dimensions and table size.
+	cpBool autoResize;
+	int insertsSinceResize;
+	int reindexesSinceResize;
 };
 
 
@@ -71,21 +76,27 @@ cpHandleRelease(cpHandle *hand, cpArray *pooledHandles)
 
 static int handleSetEql(void *obj, cpHandle *hand){return (obj == hand->obj);}
 
-static void *
-handleSetTrans(void *obj, cpSpaceHash *hash)
+static cpHandle *
+handleFromPool(cpSpaceHash *hash)
 {
 	if(hash->pooledHandles->num == 0){
 		// handle pool is exhausted, make more
 		int count = CP_BUFFER_BYTES/sizeof(cpHandle);
 		cpAssertHard(count, "Internal Error: Buffer size is too small.");
 		
-		cpHandle *buffer = (cpHandle *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpHandle *buffer = (cpHandle *)cpAllocatorCalloc(hash->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(hash->allocatedBuffers, buffer);
 		
 		for(int i=0; i<count; i++) cpArrayPush(hash->pooledHandles, buffer + i);
 	}
 	
-	cpHandle *hand = cpHandleInit((cpHandle *)cpArrayPop(hash->pooledHandles), obj);
+	return (cpHandle *)cpArrayPop(hash->pooledHandles);
+}
+
+static void *
+handleSetTrans(void *obj, cpSpaceHash *hash)
+{
+	cpHandle *hand = cpHandleInit(handleFromPool(hash), obj);
 	cpHandleRetain(hand);
 	
 	return hand;
@@ -141,7 +152,7 @@ getEmptyBin(cpSpaceHash *hash)
 		int count = CP_BUFFER_BYTES/sizeof(cpSpaceHashBin);
 		cpAssertHard(count, "Internal Error: Buffer size is too small.");
 		
-		cpSpaceHashBin *buffer = (cpSpaceHashBin *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpSpaceHashBin *buffer = (cpSpaceHashBin *)cpAllocatorCalloc(hash->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(hash->allocatedBuffers, buffer);
 		
 		// push all but the first one, return the first instead
@@ -162,10 +173,10 @@ cpSpaceHashAlloc(void)
 static void
 cpSpaceHashAllocTable(cpSpaceHash *hash, int numcells)
 {
-	cpfree(hash->table);
+	cpAllocatorFree(hash->spatialIndex.allocator, hash->table);
 	
 	hash->numcells = numcells;
-	hash->table = (cpSpaceHashBin **)cpcalloc(numcells, sizeof(cpSpaceHashBin *));
+	hash->table = (cpSpaceHashBin **)cpAllocatorCalloc(hash->spatialIndex.allocator, numcells, sizeof(cpSpaceHashBin *));
 }
 
 static inline cpSpatialIndexClass *Klass();
@@ -178,15 +189,19 @@ cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpatialIndex
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
 	hash->celldim = celldim;
 	
-	hash->handleSet = cpHashSetNew(0, (cpHashSetEqlFunc)handleSetEql);
+	hash->handleSet = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)handleSetEql, hash->spatialIndex.allocator);
 	
-	hash->pooledHandles = cpArrayNew(0);
+	hash->pooledHandles = cpArrayNewWithAllocator(0, hash->spatialIndex.allocator);
 	
 	hash->pooledBins = NULL;
-	hash->allocatedBuffers = cpArrayNew(0);
+	hash->allocatedBuffers = cpArrayNewWithAllocator(0, hash->spatialIndex.allocator);
 	
 	hash->stamp = 1;
 	
+	hash->autoResize = cpFalse;
+	hash->insertsSinceResize = 0;
+	hash->reindexesSinceResize = 0;
+	
 	return (cpSpatialIndex *)hash;
 }
 
@@ -196,15 +211,25 @@ cpSpaceHashNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatia
 	return cpSpaceHashInit(cpSpaceHashAlloc(), celldim, cells, bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpSpaceHashNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the hash's own memory uses it too.
+	cpSpaceHash *hash = (cpSpaceHash *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpaceHash));
+	hash->spatialIndex.allocator = allocator;
+	
+	return cpSpaceHashInit(hash, celldim, cells, bbfunc, staticIndex);
+}
+
 static void
 cpSpaceHashDestroy(cpSpaceHash *hash)
 {
 	if(hash->table) clearTable(hash);
-	cpfree(hash->table);
+	cpAllocatorFree(hash->spatialIndex.allocator, hash->table);
 	
 	cpHashSetFree(hash->handleSet);
 	
-	cpArrayFreeEach(hash->allocatedBuffers, cpfree);
+	cpArrayFreeEachBuffer(hash->allocatedBuffers);
 	cpArrayFree(hash->allocatedBuffers);
 	cpArrayFree(hash->pooledHandles);
 }
@@ -267,13 +292,139 @@ hashHandle(cpSpaceHash *hash, cpHandle *hand, cpBB bb)
 	}
 }
 
+static void
+rehash_helper(cpHandle *hand, cpSpaceHash *hash)
+{
+	hashHandle(hash, hand, hash->spatialIndex.bbfunc(hand->obj));
+}
+
+//MARK: Automatic Resizing
+
+// How often the hash checks its size while it's being reindexed every step.
+#define AUTO_RESIZE_INTERVAL 32
+
+// Object sizes are binned by their power of two, from 2^-16 to 2^15.
+#define SIZE_HISTOGRAM_BINS 32
+#define SIZE_HISTOGRAM_OFFSET 16
+
+typedef struct sizeStats {
+	cpSpatialIndexBBFunc bbfunc;
+	int count;
+	
+	int binCounts[SIZE_HISTOGRAM_BINS];
+	cpFloat binSums[SIZE_HISTOGRAM_BINS];
+	
+	// Used to estimate how many cells the objects will cover for a given cell size.
+	cpFloat sumW, sumH, sumWH;
+} sizeStats;
+
+static void
+sizeStats_helper(cpHandle *hand, sizeStats *stats)
+{
+	cpBB bb = stats->bbfunc(hand->obj);
+	cpFloat w = bb.r - bb.l, h = bb.t - bb.b;
+	cpFloat size = cpfmax(w, h);
+	
+	int exponent;
+	frexp(size, &exponent);
+	
+	int bin = exponent + SIZE_HISTOGRAM_OFFSET;
+	bin = (bin < 0 ? 0 : (bin >= SIZE_HISTOGRAM_BINS ? SIZE_HISTOGRAM_BINS - 1 : bin));
+	
+	stats->count++;
+	stats->binCounts[bin]++;
+	stats->binSums[bin] += size;
+	
+	stats->sumW += w;
+	stats->sumH += h;
+	stats->sumWH += w*h;
+}
+
+// Retune the cell size to the median object size, and the table size to twice the number of cells the objects cover.
+// Nothing changes unless the cell size is off by more than 2x or the table is more than full or less than 1/8 full.
+// Returns true if the hash was resized, which leaves the table empty.
+static cpBool
+AutoResize(cpSpaceHash *hash)
+{
+	hash->insertsSinceResize = 0;
+	hash->reindexesSinceResize = 0;
+	
+	sizeStats stats = {hash->spatialIndex.bbfunc, 0, {0}, {0.0f}, 0.0f, 0.0f, 0.0f};
+	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)sizeStats_helper, &stats);
+	if(stats.count == 0) return cpFalse;
+	
+	int bin = 0;
+	for(int seen = stats.binCounts[0]; 2*seen < stats.count; seen += stats.binCounts[bin]) bin++;
+	
+	cpFloat celldim = hash->celldim;
+	cpFloat median = stats.binSums[bin]/stats.binCounts[bin];
+	if(median > 0.0f && (median < 0.5f*celldim || 2.0f*celldim < median)) celldim = median;
+	
+	// An object w by h covers about (1 + w/dim)*(1 + h/dim) cells.
+	cpFloat cells = stats.count + (stats.sumW + stats.sumH)/celldim + stats.sumWH/(celldim*celldim);
+	int target = (int)cpfmin(2.0f*cells, (cpFloat)(1 << 28));
+	
+	if(celldim == hash->celldim && cells <= hash->numcells && hash->numcells <= 8.0f*cells) return cpFalse;
+	
+	clearTable(hash);
+	hash->celldim = celldim;
+	cpSpaceHashAllocTable(hash, next_prime(target));
+	
+	return cpTrue;
+}
+
+typedef struct cellCountContext {
+	cpSpaceHash *hash;
+	cpFloat count;
+} cellCountContext;
+
+static void
+cellCount_helper(cpHandle *hand, cellCountContext *context)
+{
+	cpFloat dim = context->hash->celldim;
+	cpBB bb = context->hash->spatialIndex.bbfunc(hand->obj);
+	
+	cpFloat w = floor_int(bb.r/dim) - floor_int(bb.l/dim) + 1;
+	cpFloat h = floor_int(bb.t/dim) - floor_int(bb.b/dim) + 1;
+	context->count += w*h;
+}
+
+// Check if the objects now cover far more cells than the table has, or than there are objects.
+static cpBool
+Overloaded(cpSpaceHash *hash)
+{
+	cellCountContext context = {hash, 0.0f};
+	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)cellCount_helper, &context);
+	
+	return (context.count > 2*hash->numcells || context.count > 16*cpHashSetCount(hash->handleSet));
+}
+
+void
+cpSpaceHashSetAutoResize(cpSpaceHash *hash, cpBool autoResize)
+{
+	if(hash->spatialIndex.klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpSpaceHashSetAutoResize() call to non-cpSpaceHash spatial index.");
+		return;
+	}
+	
+	hash->autoResize = autoResize;
+	if(autoResize && AutoResize(hash)) cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)rehash_helper, hash);
+}
+
 //MARK: Basic Operations
 
 static void
 cpSpaceHashInsert(cpSpaceHash *hash, void *obj, cpHashValue hashid)
 {
 	cpHandle *hand = (cpHandle *)cpHashSetInsert(hash->handleSet, hashid, obj, (cpHashSetTransFunc)handleSetTrans, hash);
-	hashHandle(hash, hand, hash->spatialIndex.bbfunc(obj));
+	
+	// Check the size each time the number of objects grows by half, so the cost stays linear.
+	if(hash->autoResize && 2*(++hash->insertsSinceResize) >= cpHashSetCount(hash->handleSet) && AutoResize(hash)){
+		// Rehash the new object along with the rest.
+		cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)rehash_helper, hash);
+	} else {
+		hashHandle(hash, hand, hash->spatialIndex.bbfunc(obj));
+	}
 }
 
 static void
@@ -289,15 +440,11 @@ cpSpaceHashRehashObject(cpSpaceHash *hash, void *obj, cpHashValue hashid)
 	}
 }
 
-static void
-rehash_helper(cpHandle *hand, cpSpaceHash *hash)
-{
-	hashHandle(hash, hand, hash->spatialIndex.bbfunc(hand->obj));
-}
-
 static void
 cpSpaceHashRehash(cpSpaceHash *hash)
 {
+	if(hash->autoResize) AutoResize(hash);
+	
 	clearTable(hash);
 	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)rehash_helper, hash);
 }
@@ -448,12 +595,18 @@ queryRehash_helper(cpHandle *hand, queryRehashContext *context)
 static void
 cpSpaceHashReindexQuery(cpSpaceHash *hash, cpSpatialIndexQueryFunc func, void *data)
 {
+	if(hash->autoResize){
+		// Check before hashing anything, since a cell size that is far too small makes the hash explode.
+		if(++hash->reindexesSinceResize >= AUTO_RESIZE_INTERVAL || Overloaded(hash)) AutoResize(hash);
+	}
+	
 	clearTable(hash);
 	
 	queryRehashContext context = {hash, func, data};
 	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)queryRehash_helper, &context);
 	
 	cpSpatialIndexCollideStatic((cpSpatialIndex *)hash, hash->spatialIndex.staticIndex, func, data);
+
 }
 
 static inline cpFloat
@@ -517,9 +670,10 @@ cpSpaceHashSegmentQuery(cpSpaceHash *hash, void *obj, cpVect a, cpVect b, cpFloa
 	cpFloat dx = cpfabs(b.x - a.x), dy = cpfabs(b.y - a.y);
 	cpFloat dt_dx = (dx ? 1.0f/dx : INFINITY), dt_dy = (dy ? 1.0f/dy : INFINITY);
 	
-	// fix NANs in horizontal directions
-	cpFloat next_h = (temp_h ? temp_h*dt_dx : dt_dx);
-	cpFloat next_v = (temp_v ? temp_v*dt_dy : dt_dy);
+	// A segment that starts on a cell boundary and heads left or down crosses it right away.
+	// Also avoids the NANs in horizontal and vertical directions.
+	cpFloat next_h = (temp_h ? temp_h*dt_dx : (dx ? 0.0f : INFINITY));
+	cpFloat next_v = (temp_v ? temp_v*dt_dy : (dy ? 0.0f : INFINITY));
 	
 	int n = hash->numcells;
 	cpSpaceHashBin **table = hash->table;
@@ -556,6 +710,9 @@ cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells)
 	
 	hash->celldim = celldim;
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
+	
+	// Put the objects back into the new table so queries keep working until the next reindex.
+	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)rehash_helper, hash);
 }
 
 static int
@@ -570,6 +727,53 @@ cpSpaceHashContains(cpSpaceHash *hash, void *obj, cpHashValue hashid)
 	return cpHashSetFind(hash->handleSet, hashid, obj) != NULL;
 }
 
+//MARK: Memory Trimming
+
+static void *
+handleMove(cpHandle *hand, cpSpaceHash *hash)
+{
+	cpHandle *copy = handleFromPool(hash);
+	(*copy) = (*hand);
+	
+	return copy;
+}
+
+static size_t
+cpSpaceHashTrim(cpSpaceHash *hash, size_t keepBytes)
+{
+	// Once the table is cleared, the only references to the handles are from the handle set.
+	clearTable(hash);
+	
+	cpArray *buffers = hash->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	hash->allocatedBuffers = cpArrayNewWithAllocator(0, hash->spatialIndex.allocator);
+	hash->pooledBins = NULL;
+	hash->pooledHandles->num = 0;
+	
+	size_t freed = cpHashSetTrim(hash->handleSet, (cpHashSetRemapFunc)handleMove, hash, keepBytes);
+	cpSpaceHashRehash(hash);
+	
+	// The old buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		cpSpaceHashBin *buffer = (cpSpaceHashBin *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(hash->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(cpSpaceHashBin);
+			for(int j=0; j<count; j++) recycleBin(hash, buffer + j);
+		} else {
+			cpAllocatorFree(hash->spatialIndex.allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = hash->allocatedBuffers->num*CP_BUFFER_BYTES;
+	return freed + (before > after ? before - after : 0);
+}
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpSpaceHashDestroy,
 	
@@ -586,6 +790,8 @@ static cpSpatialIndexClass klass = {
 	
 	(cpSpatialIndexQueryImpl)cpSpaceHashQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpSpaceHashSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpSpaceHashTrim,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
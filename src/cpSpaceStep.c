@@ -45,7 +45,7 @@ cpSpaceAddPostStepCallback(cpSpace *space, cpPostStepFunc func, void *key, void
 		"Post-step callbacks will not called until the end of the next call to cpSpaceStep() or the next query.");
 	
 	if(!cpSpaceGetPostStepCallback(space, key)){
-		cpPostStepCallback *callback = (cpPostStepCallback *)cpcalloc(1, sizeof(cpPostStepCallback));
+		cpPostStepCallback *callback = (cpPostStepCallback *)cpAllocatorCalloc(cpSpaceAllocator(space), 1, sizeof(cpPostStepCallback));
 		callback->func = (func ? func : PostStepDoNothing);
 		callback->key = key;
 		callback->data = data;
@@ -95,7 +95,7 @@ cpSpaceUnlock(cpSpace *space, cpBool runPostStep)
 				if(func) func(space, callback->key, callback->data);
 				
 				arr->arr[i] = NULL;
-				cpfree(callback);
+				cpAllocatorFree(cpSpaceAllocator(space), callback);
 			}
 			
 			arr->num = 0;
@@ -121,7 +121,8 @@ typedef struct cpContactBuffer {
 static cpContactBufferHeader *
 cpSpaceAllocContactBuffer(cpSpace *space)
 {
-	cpContactBuffer *buffer = (cpContactBuffer *)cpcalloc(1, sizeof(cpContactBuffer));
+	// Allocate a full CP_BUFFER_BYTES so cpSpaceTrimMemory() can reuse it for arbiters.
+	cpContactBuffer *buffer = (cpContactBuffer *)cpAllocatorCalloc(cpSpaceAllocator(space), 1, CP_BUFFER_BYTES);
 	cpArrayPush(space->allocatedBuffers, buffer);
 	return (cpContactBufferHeader *)buffer;
 }
@@ -184,21 +185,27 @@ cpSpacePopContacts(cpSpace *space, int count){
 
 //MARK: Collision Detection Functions
 
-static void *
-cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space)
+static cpArbiter *
+cpSpaceArbiterFromPool(cpSpace *space)
 {
 	if(space->pooledArbiters->num == 0){
 		// arbiter pool is exhausted, make more
 		int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
 		cpAssertHard(count, "Internal Error: Buffer size too small.");
 		
-		cpArbiter *buffer = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpArbiter *buffer = (cpArbiter *)cpAllocatorCalloc(cpSpaceAllocator(space), 1, CP_BUFFER_BYTES);
 		cpArrayPush(space->allocatedBuffers, buffer);
 		
 		for(int i=0; i<count; i++) cpArrayPush(space->pooledArbiters, buffer + i);
 	}
 	
-	return cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters), shapes[0], shapes[1]);
+	return (cpArbiter *)cpArrayPop(space->pooledArbiters);
+}
+
+static void *
+cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space)
+{
+	return cpArbiterInit(cpSpaceArbiterFromPool(space), shapes[0], shapes[1]);
 }
 
 static inline cpBool
@@ -231,25 +238,19 @@ QueryReject(cpShape *a, cpShape *b)
 	);
 }
 
-// Callback from the spatial hash.
-cpCollisionID
-cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+// Find or create the arbiter for a collision and run the begin/pre-solve callbacks.
+// The contacts must already be pushed onto the space's contact buffer.
+static void
+cpSpaceProcessCollision(cpSpace *space, struct cpCollisionInfo *info)
 {
-	// Reject any of the simple cases
-	if(QueryReject(a,b)) return id;
-	
-	// Narrow-phase collision detection.
-	struct cpCollisionInfo info = cpCollide(a, b, id, cpContactBufferGetArray(space));
-	
-	if(info.count == 0) return info.id; // Shapes are not colliding.
-	cpSpacePushContacts(space, info.count);
+	const cpShape *a = info->a, *b = info->b;
 	
 	// Get an arbiter from space->arbiterSet for the two shapes.
 	// This is where the persistant contact magic comes from.
-	const cpShape *shape_pair[] = {info.a, info.b};
-	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)info.a, (cpHashValue)info.b);
+	const cpShape *shape_pair[] = {a, b};
+	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
 	cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, (cpHashSetTransFunc)cpSpaceArbiterSetTrans, space);
-	cpArbiterUpdate(arb, &info, space);
+	cpArbiterUpdate(arb, info, space);
 	
 	cpCollisionHandler *handler = arb->handler;
 	
@@ -273,7 +274,7 @@ cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
 	){
 		cpArrayPush(space->arbiters, arb);
 	} else {
-		cpSpacePopContacts(space, info.count);
+		cpSpacePopContacts(space, info->count);
 		
 		arb->contacts = NULL;
 		arb->count = 0;
@@ -285,9 +286,193 @@ cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
 	
 	// Time stamp the arbiter so we know it was used recently.
 	arb->stamp = space->stamp;
+}
+
+// Callback from the spatial hash.
+cpCollisionID
+cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+{
+	cpSpaceStepStats *stats = &space->stepStats;
+	stats->pairsTested++;
+	
+	// Reject any of the simple cases
+	if(QueryReject(a,b)){
+		stats->pairsRejected++;
+		return id;
+	}
+	
+	// Narrow-phase collision detection.
+	struct cpCollisionInfo info = cpCollide(a, b, id, cpContactBufferGetArray(space), &space->collisionBudget);
+	stats->collideCalls++;
+	
+	if(info.exhausted){
+		if(info.exhausted & CP_GJK_EXHAUSTED) stats->gjkBudgetExceeded++;
+		if(info.exhausted & CP_EPA_EXHAUSTED) stats->epaBudgetExceeded++;
+	}
+	
+	if(info.count == 0) return info.id; // Shapes are not colliding.
+	cpSpacePushContacts(space, info.count);
+	stats->contacts += info.count;
+	
+	cpSpaceProcessCollision(space, &info);
 	return info.id;
 }
 
+//MARK: Deferred Narrowphase
+
+static void
+CollisionPairArrayResize(const cpAllocator *allocator, struct cpCollisionPairArray *pairs, int max)
+{
+	pairs->max = max;
+	
+	if(max > 0){
+		pairs->arr = (struct cpCollisionPair *)cpAllocatorRealloc(allocator, pairs->arr, max*sizeof(struct cpCollisionPair));
+		pairs->order = (int *)cpAllocatorRealloc(allocator, pairs->order, max*sizeof(int));
+	} else {
+		cpAllocatorFree(allocator, pairs->arr);
+		cpAllocatorFree(allocator, pairs->order);
+		pairs->arr = NULL;
+		pairs->order = NULL;
+	}
+}
+
+void
+cpSpaceBeginDeferredCollisions(cpSpace *space)
+{
+	// Keep the pairs from the previous step so their collision IDs can be looked up.
+	struct cpCollisionPairArray prev = space->prevCollisionPairs;
+	space->prevCollisionPairs = space->collisionPairs;
+	space->collisionPairs = prev;
+	space->collisionPairs.num = 0;
+}
+
+// Spatial index callback that queues the pair instead of colliding it immediately.
+// The spatial index remembers the returned value as the pair's collision ID and passes it back next step.
+// Since the real ID isn't known until after the narrowphase, the index of the pair is returned as a handle instead.
+// Handles are validated against the shapes so a stale or foreign ID can only cost a cold start.
+cpCollisionID
+cpSpaceDeferCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+{
+	cpSpaceStepStats *stats = &space->stepStats;
+	stats->pairsTested++;
+	
+	// Reject any of the simple cases
+	if(QueryReject(a,b)){
+		stats->pairsRejected++;
+		return 0;
+	}
+	
+	struct cpCollisionPairArray *prev = &space->prevCollisionPairs;
+	cpCollisionID prevID = 0;
+	if(0 < id && id <= (cpCollisionID)prev->num){
+		struct cpCollisionPair *match = prev->arr + (id - 1);
+		if((match->a == a && match->b == b) || (match->a == b && match->b == a)) prevID = match->info.id;
+	}
+	
+	struct cpCollisionPairArray *pairs = &space->collisionPairs;
+	if(pairs->num == pairs->max) CollisionPairArrayResize(cpSpaceAllocator(space), pairs, pairs->max ? 2*pairs->max : 64);
+	
+	struct cpCollisionPair *pair = pairs->arr + pairs->num;
+	pair->a = a;
+	pair->b = b;
+	pair->id = prevID;
+	pair->type = cpCollisionFuncIndex(a, b);
+	pair->info.id = prevID;
+	pair->info.count = 0;
+	
+	return (cpCollisionID)(++pairs->num);
+}
+
+// Counting sort the pairs' indexes into 'order' by collision type.
+// The narrowphase can then run each type's collision function over long runs of pairs.
+void
+cpSpaceBucketCollisionPairs(cpSpace *space)
+{
+	struct cpCollisionPairArray *pairs = &space->collisionPairs;
+	
+	int starts[CP_NUM_SHAPES*CP_NUM_SHAPES] = {0};
+	for(int i=0; i<pairs->num; i++) starts[pairs->arr[i].type]++;
+	
+	for(int type=0, start=0; type<CP_NUM_SHAPES*CP_NUM_SHAPES; type++){
+		int count = starts[type];
+		starts[type] = start;
+		start += count;
+	}
+	
+	for(int i=0; i<pairs->num; i++) pairs->order[starts[pairs->arr[i].type]++] = i;
+}
+
+// Number of pairs starting at 'order[i]' with the same collision type that can be collided as one batch.
+static inline int
+CollisionBlockSize(const struct cpCollisionPair *pairs, const int *order, int i, int end)
+{
+	int type = pairs[order[i]].type;
+	int count = 1;
+	while(count < CP_COLLIDE_BATCH_SIZE && i + count < end && pairs[order[i + count]].type == type) count++;
+	
+	return count;
+}
+
+// Run the narrowphase for a range of the bucketed pairs, storing the contacts into 'contacts'.
+// Does not touch any other space state so ranges may be run concurrently.
+void
+cpSpaceCollidePairs(cpSpace *space, int begin, int end, struct cpContactArray *contacts)
+{
+	struct cpCollisionPair *pairs = space->collisionPairs.arr;
+	const int *order = space->collisionPairs.order;
+	
+	for(int i=begin; i<end;){
+		int count = CollisionBlockSize(pairs, order, i, end);
+		if(contacts->max - contacts->num < count*CP_MAX_CONTACTS_PER_ARBITER){
+			while(contacts->max - contacts->num < count*CP_MAX_CONTACTS_PER_ARBITER) contacts->max = (contacts->max ? 2*contacts->max : 256);
+			contacts->arr = (struct cpContact *)cpAllocatorRealloc(cpSpaceAllocator(space), contacts->arr, contacts->max*sizeof(struct cpContact));
+		}
+		
+		struct cpContact *arr = contacts->arr + contacts->num;
+		contacts->num += cpCollideBatch(pairs, order + i, count, arr, &space->collisionBudget);
+		
+		for(int j=0; j<count; j++){
+			struct cpCollisionPair *pair = pairs + order[i + j];
+			pair->source = contacts;
+			pair->offset = (int)(pair->info.arr - contacts->arr);
+		}
+		
+		i += count;
+	}
+}
+
+// Copy the contacts of the collided pairs into the contact buffers and update their arbiters.
+// Processing the pairs in broadphase order keeps the results independent of how the narrowphase was split up.
+void
+cpSpaceMergeCollisionPairs(cpSpace *space)
+{
+	struct cpCollisionPairArray *pairs = &space->collisionPairs;
+	
+	for(int i=0; i<pairs->num; i++){
+		struct cpCollisionPair *pair = pairs->arr + i;
+		struct cpCollisionInfo *info = &pair->info;
+		
+		// Every deferred pair went through cpSpaceCollidePairs() by now.
+		space->stepStats.collideCalls++;
+		
+		if(info->exhausted){
+			if(info->exhausted & CP_GJK_EXHAUSTED) space->stepStats.gjkBudgetExceeded++;
+			if(info->exhausted & CP_EPA_EXHAUSTED) space->stepStats.epaBudgetExceeded++;
+		}
+		
+		if(info->count == 0) continue; // Shapes are not colliding.
+		
+		struct cpContact *arr = cpContactBufferGetArray(space);
+		memcpy(arr, pair->source->arr + pair->offset, info->count*sizeof(struct cpContact));
+		info->arr = arr;
+		
+		cpSpacePushContacts(space, info->count);
+		space->stepStats.contacts += info->count;
+		
+		cpSpaceProcessCollision(space, info);
+	}
+}
+
 // Hashset filter func to throw away old arbiters.
 cpBool
 cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
@@ -324,6 +509,135 @@ cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
 	return cpTrue;
 }
 
+//MARK: Memory Trimming
+
+// Moved arbiters are left with a NULL 'a' shape and a forwarding pointer to their copy in 'data'.
+static inline cpArbiter *
+ArbiterForward(cpArbiter *arb)
+{
+	return (arb && arb->a == NULL ? (cpArbiter *)arb->data : arb);
+}
+
+typedef struct ArbiterMoveContext {
+	cpSpace *space;
+	cpArray *moved;
+} ArbiterMoveContext;
+
+static void *
+ArbiterMove(cpArbiter *arb, ArbiterMoveContext *context)
+{
+	cpArbiter *copy = ArbiterForward(arb);
+	if(copy == arb){
+		copy = cpSpaceArbiterFromPool(context->space);
+		(*copy) = (*arb);
+		cpArrayPush(context->moved, copy);
+		
+		arb->a = NULL;
+		arb->data = copy;
+	}
+	
+	return copy;
+}
+
+static void
+ArbiterMoveContacts(cpArbiter *arb, cpSpace *space)
+{
+	struct cpContact *contacts = cpContactBufferGetArray(space);
+	memcpy(contacts, arb->contacts, arb->count*sizeof(struct cpContact));
+	cpSpacePushContacts(space, arb->count);
+	
+	arb->contacts = contacts;
+}
+
+size_t
+cpSpaceTrimMemory(cpSpace *space, size_t keepBytes)
+{
+	cpAssertSpaceUnlocked(space);
+	const cpAllocator *allocator = cpSpaceAllocator(space);
+	
+	cpArray *buffers = space->allocatedBuffers;
+	size_t before = buffers->num*CP_BUFFER_BYTES;
+	
+	space->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	space->pooledArbiters->num = 0;
+	
+	// Move the cached arbiters, then the ones that went to sleep with their bodies.
+	ArbiterMoveContext context = {space, cpArrayNewWithAllocator(0, allocator)};
+	size_t freed = cpHashSetTrim(space->cachedArbiters, (cpHashSetRemapFunc)ArbiterMove, &context, keepBytes);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		for(cpBody *body = (cpBody *)components->arr[i]; body; body = body->sleeping.next){
+			CP_BODY_FOREACH_ARBITER(body, arb) ArbiterMove(arb, &context);
+		}
+	}
+	
+	// Fix up the contact graph.
+	for(int i=0; i<context.moved->num; i++){
+		cpArbiter *arb = (cpArbiter *)context.moved->arr[i];
+		arb->thread_a.prev = ArbiterForward(arb->thread_a.prev);
+		arb->thread_a.next = ArbiterForward(arb->thread_a.next);
+		arb->thread_b.prev = ArbiterForward(arb->thread_b.prev);
+		arb->thread_b.next = ArbiterForward(arb->thread_b.next);
+		
+		arb->body_a->arbiterList = ArbiterForward(arb->body_a->arbiterList);
+		arb->body_b->arbiterList = ArbiterForward(arb->body_b->arbiterList);
+	}
+	cpArrayFree(context.moved);
+	
+	cpArray *arbiters = space->arbiters;
+	for(int i=0; i<arbiters->num; i++) arbiters->arr[i] = ArbiterForward((cpArbiter *)arbiters->arr[i]);
+	
+	// Copy the contacts of the cached arbiters into a fresh ring of contact buffers.
+	// Sleeping arbiters keep their contacts in separate allocations.
+	if(space->contactBuffersHead){
+		space->contactBuffersHead = NULL;
+		cpSpacePushFreshContactBuffer(space);
+		cpHashSetEach(space->cachedArbiters, (cpHashSetIteratorFunc)ArbiterMoveContacts, space);
+	}
+	
+	// The old arbiter and contact buffers are all idle now.
+	for(int i=0; i<buffers->num; i++){
+		cpArbiter *buffer = (cpArbiter *)buffers->arr[i];
+		
+		if(keepBytes >= CP_BUFFER_BYTES){
+			keepBytes -= CP_BUFFER_BYTES;
+			cpArrayPush(space->allocatedBuffers, buffer);
+			
+			int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
+			for(int j=0; j<count; j++) cpArrayPush(space->pooledArbiters, buffer + j);
+		} else {
+			cpAllocatorFree(allocator, buffer);
+		}
+	}
+	cpArrayFree(buffers);
+	
+	size_t after = space->allocatedBuffers->num*CP_BUFFER_BYTES;
+	freed += (before > after ? before - after : 0);
+	
+	// The pairs from the step before last are only scratch memory now.
+	const size_t pairBytes = sizeof(struct cpCollisionPair) + sizeof(int);
+	struct cpCollisionPairArray *prev = &space->prevCollisionPairs;
+	if(prev->max*pairBytes > keepBytes){
+		freed += prev->max*pairBytes;
+		CollisionPairArrayResize(allocator, prev, 0);
+		prev->num = 0;
+	}
+	
+	// The last step's pairs are still needed to look up collision IDs.
+	struct cpCollisionPairArray *pairs = &space->collisionPairs;
+	size_t max = pairs->num + keepBytes/pairBytes;
+	if(max < (size_t)pairs->max){
+		freed += (pairs->max - max)*pairBytes;
+		CollisionPairArrayResize(allocator, pairs, (int)max);
+	}
+	
+	freed += cpSpatialIndexTrim(space->dynamicShapes, keepBytes);
+	freed += cpSpatialIndexTrim(space->staticShapes, keepBytes);
+	
+	return freed;
+}
+
 //MARK: All Important cpSpaceStep() Function
 
  void
@@ -340,6 +654,12 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 	
 	space->stamp++;
 	
+	// Switch spatial indexes before anything can be holding on to the current ones.
+	cpSpaceAdaptBroadphase(space);
+	
+	cpSpaceStepStats *stats = &space->stepStats;
+	uint64_t start = cpSpaceStepStatsBegin(space), lap = start;
+	
 	cpFloat prev_dt = space->curr_dt;
 	space->curr_dt = dt;
 		
@@ -365,19 +685,27 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			cpBody *body = (cpBody *)bodies->arr[i];
 			body->position_func(body, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->integratePositionsTime, lap);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
 		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
+		lap = cpSpaceStepStatsLap(space, &stats->updateBBTime, lap);
+		
+		uint64_t broadphaseStart = cpSpaceBroadphaseSampleBegin(space);
 		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceCollideShapes, space);
+		cpSpaceBroadphaseSampleEnd(space, broadphaseStart);
+		lap = cpSpaceStepStatsLap(space, &stats->collideTime, lap);
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
 	cpSpaceProcessComponents(space, dt);
+	lap = cpSpaceStepStatsLap(space, &stats->componentsTime, lap);
 	
 	cpSpaceLock(space); {
 		// Clear out old cached arbiters and call separate callbacks
 		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
+		lap = cpSpaceStepStatsLap(space, &stats->arbiterFilterTime, lap);
 
 		// Prestep the arbiters and constraints.
 		cpFloat slop = space->collisionSlop;
@@ -394,6 +722,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			
 			constraint->klass->preStep(constraint, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->preStepTime, lap);
 	
 		// Integrate velocities.
 		cpFloat damping = cpfpow(space->damping, dt);
@@ -402,6 +731,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			cpBody *body = (cpBody *)bodies->arr[i];
 			body->velocity_func(body, gravity, damping, dt);
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->integrateVelocitiesTime, lap);
 		
 		// Apply cached impulses
 		cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
@@ -425,6 +755,9 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 				constraint->klass->applyImpulse(constraint, dt);
 			}
 		}
+		lap = cpSpaceStepStatsLap(space, &stats->solverTime, lap);
+		stats->arbiters = arbiters->num;
+		stats->constraints = constraints->num;
 		
 		// Run the constraint post-solve callbacks
 		for(int i=0; i<constraints->num; i++){
@@ -442,4 +775,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			handler->postSolveFunc(arb, space, handler->userData);
 		}
 	} cpSpaceUnlock(space, cpTrue);
+	
+	cpSpaceStepStatsLap(space, &stats->callbacksTime, lap);
+	cpSpaceStepStatsLap(space, &stats->totalTime, start);
 }
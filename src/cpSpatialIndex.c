@@ -26,7 +26,7 @@ cpSpatialIndexFree(cpSpatialIndex *index)
 {
 	if(index){
 		cpSpatialIndexDestroy(index);
-		cpfree(index);
+		cpAllocatorFree(index->allocator, index);
 	}
 }
 
@@ -47,23 +47,35 @@ cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialI
 
 typedef struct dynamicToStaticContext {
 	cpSpatialIndexBBFunc bbfunc;
-	cpSpatialIndex *staticIndex;
-	cpSpatialIndexQueryFunc queryFunc;
-	void *data;
+	void **objs;
+	cpBB *bbs;
+	int count;
 } dynamicToStaticContext;
 
 static void
 dynamicToStaticIter(void *obj, dynamicToStaticContext *context)
 {
-	cpSpatialIndexQuery(context->staticIndex, obj, context->bbfunc(obj), context->queryFunc, context->data);
+	int i = context->count++;
+	context->objs[i] = obj;
+	context->bbs[i] = context->bbfunc(obj);
 }
 
 void
 cpSpatialIndexCollideStatic(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(staticIndex && cpSpatialIndexCount(staticIndex) > 0){
-		dynamicToStaticContext context = {dynamicIndex->bbfunc, staticIndex, func, data};
+	int count = cpSpatialIndexCount(dynamicIndex);
+	if(staticIndex && cpSpatialIndexCount(staticIndex) > 0 && count > 0){
+		// Gather the dynamic objects so the static index can run all of their queries together.
+		const cpAllocator *allocator = dynamicIndex->allocator;
+		dynamicToStaticContext context = {dynamicIndex->bbfunc, NULL, NULL, 0};
+		context.objs = (void **)cpAllocatorCalloc(allocator, count, sizeof(void *));
+		context.bbs = (cpBB *)cpAllocatorCalloc(allocator, count, sizeof(cpBB));
+		
 		cpSpatialIndexEach(dynamicIndex, (cpSpatialIndexIteratorFunc)dynamicToStaticIter, &context);
+		cpSpatialIndexQueryBatch(staticIndex, context.objs, context.bbs, context.count, func, data);
+		
+		cpAllocatorFree(allocator, context.objs);
+		cpAllocatorFree(allocator, context.bbs);
 	}
 }
 
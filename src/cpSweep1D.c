@@ -19,20 +19,73 @@
  * SOFTWARE.
  */
 
+#include <limits.h>
+
 #include "chipmunk/chipmunk_private.h"
 
 static inline cpSpatialIndexClass *Klass();
 
-//MARK: Basic Structures
+// The table is kept sorted by the minimum bound along the sweep axis.
+// Objects don't move far between steps, so an insertion sort is usually close to linear.
+// When it has to shift the cells around too much, the table is radix sorted instead.
+// The sweep axis is switched to whichever axis the objects are more spread out along.
 
-typedef struct Bounds {
-	cpFloat min, max;
-} Bounds;
+// Give up on the insertion sort after shifting this many cells per object.
+#define INSERTION_SORT_BUDGET 4
 
-typedef struct TableCell {
-	void *obj;
-	Bounds bounds;
-} TableCell;
+// Only switch axes when the other axis has this much more variance, so the table isn't resorted back and forth.
+#define AXIS_SWITCH_RATIO 1.5f
+
+// The radix sort uses 3 passes of 11 bits over 32 bit keys.
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1<<RADIX_BITS)
+
+// The sweep tests several cells at once when SIMD is available.
+#if defined(__AVX__)
+	#include <immintrin.h>
+	
+	#if CP_USE_DOUBLES
+		typedef __m256d SweepLanes;
+		#define SWEEP_WIDTH 4
+		#define sweep_load _mm256_loadu_pd
+		#define sweep_set1 _mm256_set1_pd
+		#define sweep_le(__a, __b) _mm256_cmp_pd(__a, __b, _CMP_LE_OQ)
+		#define sweep_and _mm256_and_pd
+		#define sweep_bits _mm256_movemask_pd
+	#else
+		typedef __m256 SweepLanes;
+		#define SWEEP_WIDTH 8
+		#define sweep_load _mm256_loadu_ps
+		#define sweep_set1 _mm256_set1_ps
+		#define sweep_le(__a, __b) _mm256_cmp_ps(__a, __b, _CMP_LE_OQ)
+		#define sweep_and _mm256_and_ps
+		#define sweep_bits _mm256_movemask_ps
+	#endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	
+	#if CP_USE_DOUBLES
+		typedef __m128d SweepLanes;
+		#define SWEEP_WIDTH 2
+		#define sweep_load _mm_loadu_pd
+		#define sweep_set1 _mm_set1_pd
+		#define sweep_le _mm_cmple_pd
+		#define sweep_and _mm_and_pd
+		#define sweep_bits _mm_movemask_pd
+	#else
+		typedef __m128 SweepLanes;
+		#define SWEEP_WIDTH 4
+		#define sweep_load _mm_loadu_ps
+		#define sweep_set1 _mm_set1_ps
+		#define sweep_le _mm_cmple_ps
+		#define sweep_and _mm_and_ps
+		#define sweep_bits _mm_movemask_ps
+	#endif
+#else
+	#define SWEEP_WIDTH 1
+#endif
+
+//MARK: Basic Structures
 
 struct cpSweep1D
 {
@@ -40,27 +93,51 @@ struct cpSweep1D
 	
 	int num;
 	int max;
-	TableCell *table;
+	
+	// The table is stored as separate arrays so the sweep can load the bounds of several cells at once.
+	// 'mins' and 'maxs' are the bounds along the sweep axis, the others are the bounds along the other axis.
+	void **objs;
+	cpFloat *mins, *maxs;
+	cpFloat *crossMins, *crossMaxs;
+	
+	// 0 when sweeping along the x axis, 1 for the y axis.
+	int axis;
+	
+	// Scratch space for the radix sort, allocated when first needed.
+	unsigned int *keys;
+	int *order;
+	void *temp;
+	int scratchMax;
 };
 
 static inline cpBool
-BoundsOverlap(Bounds a, Bounds b)
+BoundsOverlap(cpFloat minA, cpFloat maxA, cpFloat minB, cpFloat maxB)
 {
-	return (a.min <= b.max && b.min <= a.max);
+	return (minA <= maxB && minB <= maxA);
 }
 
-static inline Bounds
-BBToBounds(cpSweep1D *sweep, cpBB bb)
+static inline void
+SetCell(cpSweep1D *sweep, int i, void *obj, cpBB bb)
 {
-	Bounds bounds = {bb.l, bb.r};
-	return bounds;
+	sweep->objs[i] = obj;
+	
+	if(sweep->axis == 0){
+		sweep->mins[i] = bb.l; sweep->maxs[i] = bb.r;
+		sweep->crossMins[i] = bb.b; sweep->crossMaxs[i] = bb.t;
+	} else {
+		sweep->mins[i] = bb.b; sweep->maxs[i] = bb.t;
+		sweep->crossMins[i] = bb.l; sweep->crossMaxs[i] = bb.r;
+	}
 }
 
-static inline TableCell
-MakeTableCell(cpSweep1D *sweep, void *obj)
+static inline cpBool
+CellOverlapsBB(cpSweep1D *sweep, int i, cpBB bb)
 {
-	TableCell cell = {obj, BBToBounds(sweep, sweep->spatialIndex.bbfunc(obj))};
-	return cell;
+	if(sweep->axis == 0){
+		return BoundsOverlap(sweep->mins[i], sweep->maxs[i], bb.l, bb.r) && BoundsOverlap(sweep->crossMins[i], sweep->crossMaxs[i], bb.b, bb.t);
+	} else {
+		return BoundsOverlap(sweep->mins[i], sweep->maxs[i], bb.b, bb.t) && BoundsOverlap(sweep->crossMins[i], sweep->crossMaxs[i], bb.l, bb.r);
+	}
 }
 
 //MARK: Memory Management Functions
@@ -74,8 +151,29 @@ cpSweep1DAlloc(void)
 static void
 ResizeTable(cpSweep1D *sweep, int size)
 {
+	const cpAllocator *allocator = sweep->spatialIndex.allocator;
+	
 	sweep->max = size;
-	sweep->table = (TableCell *)cprealloc(sweep->table, size*sizeof(TableCell));
+	sweep->objs = (void **)cpAllocatorRealloc(allocator, sweep->objs, size*sizeof(void *));
+	sweep->mins = (cpFloat *)cpAllocatorRealloc(allocator, sweep->mins, size*sizeof(cpFloat));
+	sweep->maxs = (cpFloat *)cpAllocatorRealloc(allocator, sweep->maxs, size*sizeof(cpFloat));
+	sweep->crossMins = (cpFloat *)cpAllocatorRealloc(allocator, sweep->crossMins, size*sizeof(cpFloat));
+	sweep->crossMaxs = (cpFloat *)cpAllocatorRealloc(allocator, sweep->crossMaxs, size*sizeof(cpFloat));
+}
+
+static void
+FreeScratch(cpSweep1D *sweep)
+{
+	const cpAllocator *allocator = sweep->spatialIndex.allocator;
+	
+	cpAllocatorFree(allocator, sweep->keys);
+	cpAllocatorFree(allocator, sweep->order);
+	cpAllocatorFree(allocator, sweep->temp);
+	
+	sweep->keys = NULL;
+	sweep->order = NULL;
+	sweep->temp = NULL;
+	sweep->scratchMax = 0;
 }
 
 cpSpatialIndex *
@@ -84,8 +182,18 @@ cpSweep1DInit(cpSweep1D *sweep, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *sta
 	cpSpatialIndexInit((cpSpatialIndex *)sweep, Klass(), bbfunc, staticIndex);
 	
 	sweep->num = 0;
+	sweep->objs = NULL;
+	sweep->mins = sweep->maxs = NULL;
+	sweep->crossMins = sweep->crossMaxs = NULL;
 	ResizeTable(sweep, 32);
 	
+	sweep->axis = 0;
+	
+	sweep->keys = NULL;
+	sweep->order = NULL;
+	sweep->temp = NULL;
+	sweep->scratchMax = 0;
+	
 	return (cpSpatialIndex *)sweep;
 }
 
@@ -95,11 +203,29 @@ cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 	return cpSweep1DInit(cpSweep1DAlloc(), bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpSweep1DNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	// The allocator needs to be set before initializing so the table uses it too.
+	cpSweep1D *sweep = (cpSweep1D *)cpAllocatorCalloc(allocator, 1, sizeof(cpSweep1D));
+	sweep->spatialIndex.allocator = allocator;
+	
+	return cpSweep1DInit(sweep, bbfunc, staticIndex);
+}
+
 static void
 cpSweep1DDestroy(cpSweep1D *sweep)
 {
-	cpfree(sweep->table);
-	sweep->table = NULL;
+	const cpAllocator *allocator = sweep->spatialIndex.allocator;
+	
+	cpAllocatorFree(allocator, sweep->objs);
+	cpAllocatorFree(allocator, sweep->mins);
+	cpAllocatorFree(allocator, sweep->maxs);
+	cpAllocatorFree(allocator, sweep->crossMins);
+	cpAllocatorFree(allocator, sweep->crossMaxs);
+	sweep->objs = NULL;
+	
+	FreeScratch(sweep);
 }
 
 //MARK: Misc
@@ -113,16 +239,16 @@ cpSweep1DCount(cpSweep1D *sweep)
 static void
 cpSweep1DEach(cpSweep1D *sweep, cpSpatialIndexIteratorFunc func, void *data)
 {
-	TableCell *table = sweep->table;
-	for(int i=0, count=sweep->num; i<count; i++) func(table[i].obj, data);
+	void **objs = sweep->objs;
+	for(int i=0, count=sweep->num; i<count; i++) func(objs[i], data);
 }
 
 static int
 cpSweep1DContains(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		if(table[i].obj == obj) return cpTrue;
+		if(objs[i] == obj) return cpTrue;
 	}
 	
 	return cpFalse;
@@ -135,20 +261,23 @@ cpSweep1DInsert(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
 	if(sweep->num == sweep->max) ResizeTable(sweep, sweep->max*2);
 	
-	sweep->table[sweep->num] = MakeTableCell(sweep, obj);
+	SetCell(sweep, sweep->num, obj, sweep->spatialIndex.bbfunc(obj));
 	sweep->num++;
 }
 
 static void
 cpSweep1DRemove(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		if(table[i].obj == obj){
-			int num = --sweep->num;
-			
-			table[i] = table[num];
-			table[num].obj = NULL;
+		if(objs[i] == obj){
+			// Shift the rest of the table down to keep it sorted.
+			int tail = --sweep->num - i;
+			memmove(sweep->objs + i, sweep->objs + i + 1, tail*sizeof(void *));
+			memmove(sweep->mins + i, sweep->mins + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->maxs + i, sweep->maxs + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->crossMins + i, sweep->crossMins + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->crossMaxs + i, sweep->crossMaxs + i + 1, tail*sizeof(cpFloat));
 			
 			return;
 		}
@@ -178,12 +307,9 @@ cpSweep1DQuery(cpSweep1D *sweep, void *obj, cpBB bb, cpSpatialIndexQueryFunc fun
 	// Implementing binary search here would allow you to find an upper limit
 	// but not a lower limit. Probably not worth the hassle.
 	
-	Bounds bounds = BBToBounds(sweep, bb);
-	
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		TableCell cell = table[i];
-		if(BoundsOverlap(bounds, cell.bounds) && obj != cell.obj) func(obj, cell.obj, 0, data);
+		if(CellOverlapsBB(sweep, i, bb) && obj != objs[i]) func(obj, objs[i], 0, data);
 	}
 }
 
@@ -191,40 +317,205 @@ static void
 cpSweep1DSegmentQuery(cpSweep1D *sweep, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
 	cpBB bb = cpBBExpand(cpBBNew(a.x, a.y, a.x, a.y), b);
-	Bounds bounds = BBToBounds(sweep, bb);
 	
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		TableCell cell = table[i];
-		if(BoundsOverlap(bounds, cell.bounds)) func(obj, cell.obj, data);
+		if(CellOverlapsBB(sweep, i, bb)) func(obj, objs[i], data);
+	}
+}
+
+//MARK: Sorting
+
+// Insertion sort the table by 'mins'. Returns false if it gave up after shifting 'budget' cells.
+static cpBool
+InsertionSort(cpSweep1D *sweep, int budget)
+{
+	void **objs = sweep->objs;
+	cpFloat *mins = sweep->mins, *maxs = sweep->maxs;
+	cpFloat *crossMins = sweep->crossMins, *crossMaxs = sweep->crossMaxs;
+	
+	for(int i=1, count=sweep->num; i<count; i++){
+		cpFloat min = mins[i];
+		if(mins[i - 1] <= min) continue;
+		
+		void *obj = objs[i];
+		cpFloat max = maxs[i], crossMin = crossMins[i], crossMax = crossMaxs[i];
+		
+		int j = i;
+		do {
+			objs[j] = objs[j - 1];
+			mins[j] = mins[j - 1];
+			maxs[j] = maxs[j - 1];
+			crossMins[j] = crossMins[j - 1];
+			crossMaxs[j] = crossMaxs[j - 1];
+			j--;
+		} while(j > 0 && mins[j - 1] > min);
+		
+		objs[j] = obj;
+		mins[j] = min;
+		maxs[j] = max;
+		crossMins[j] = crossMin;
+		crossMaxs[j] = crossMax;
+		
+		budget -= i - j;
+		if(budget < 0) return cpFalse;
+	}
+	
+	return cpTrue;
+}
+
+// Map a float to an unsigned int with the same ordering.
+static inline unsigned int
+SortKey(cpFloat value)
+{
+	union {float f; unsigned int u;} bits = {(float)value};
+	return (bits.u & 0x80000000u ? ~bits.u : bits.u | 0x80000000u);
+}
+
+static void
+PermuteFloats(cpFloat *values, const int *order, cpFloat *temp, int count)
+{
+	for(int i=0; i<count; i++) temp[i] = values[order[i]];
+	memcpy(values, temp, count*sizeof(cpFloat));
+}
+
+// Radix sort the table by the single precision value of 'mins'.
+// The order is only approximate for values that round to the same float, so it needs an insertion sort to finish.
+static void
+RadixSort(cpSweep1D *sweep)
+{
+	int count = sweep->num;
+	
+	if(sweep->scratchMax < count){
+		FreeScratch(sweep);
+		
+		const cpAllocator *allocator = sweep->spatialIndex.allocator;
+		sweep->scratchMax = sweep->max;
+		sweep->keys = (unsigned int *)cpAllocatorCalloc(allocator, 2*sweep->scratchMax, sizeof(unsigned int));
+		sweep->order = (int *)cpAllocatorCalloc(allocator, 2*sweep->scratchMax, sizeof(int));
+		sweep->temp = cpAllocatorCalloc(allocator, sweep->scratchMax, (sizeof(cpFloat) > sizeof(void *) ? sizeof(cpFloat) : sizeof(void *)));
+	}
+	
+	unsigned int *keys = sweep->keys, *tempKeys = sweep->keys + sweep->scratchMax;
+	int *order = sweep->order, *tempOrder = sweep->order + sweep->scratchMax;
+	
+	for(int i=0; i<count; i++){
+		keys[i] = SortKey(sweep->mins[i]);
+		order[i] = i;
+	}
+	
+	for(int shift=0; shift<32; shift += RADIX_BITS){
+		int offsets[RADIX_BUCKETS] = {0};
+		for(int i=0; i<count; i++) offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+		
+		int offset = 0;
+		for(int bucket=0; bucket<RADIX_BUCKETS; bucket++){
+			int n = offsets[bucket];
+			offsets[bucket] = offset;
+			offset += n;
+		}
+		
+		for(int i=0; i<count; i++){
+			int dst = offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+			tempKeys[dst] = keys[i];
+			tempOrder[dst] = order[i];
+		}
+		
+		unsigned int *swapKeys = keys; keys = tempKeys; tempKeys = swapKeys;
+		int *swapOrder = order; order = tempOrder; tempOrder = swapOrder;
 	}
+	
+	void **tempObjs = (void **)sweep->temp;
+	for(int i=0; i<count; i++) tempObjs[i] = sweep->objs[order[i]];
+	memcpy(sweep->objs, tempObjs, count*sizeof(void *));
+	
+	cpFloat *temp = (cpFloat *)sweep->temp;
+	PermuteFloats(sweep->mins, order, temp, count);
+	PermuteFloats(sweep->maxs, order, temp, count);
+	PermuteFloats(sweep->crossMins, order, temp, count);
+	PermuteFloats(sweep->crossMaxs, order, temp, count);
 }
 
 //MARK: Reindex/Query
 
-static int
-TableSort(TableCell *a, TableCell *b)
+// Update the bounds and switch axes if the objects are spread out more along the other axis.
+static void
+UpdateBounds(cpSweep1D *sweep)
 {
-	return (a->bounds.min < b->bounds.min ? -1 : (a->bounds.min > b->bounds.min ? 1 : 0));
+	cpSpatialIndexBBFunc bbfunc = sweep->spatialIndex.bbfunc;
+	int count = sweep->num;
+	if(count == 0) return;
+	
+	cpFloat sum[2] = {0.0f, 0.0f}, sumSq[2] = {0.0f, 0.0f};
+	for(int i=0; i<count; i++){
+		void *obj = sweep->objs[i];
+		cpBB bb = bbfunc(obj);
+		SetCell(sweep, i, obj, bb);
+		
+		cpFloat x = (bb.l + bb.r)*0.5f, y = (bb.b + bb.t)*0.5f;
+		sum[0] += x; sumSq[0] += x*x;
+		sum[1] += y; sumSq[1] += y*y;
+	}
+	
+	// Variance along each axis, scaled by the count.
+	int axis = sweep->axis, other = 1 - axis;
+	cpFloat current = sumSq[axis] - sum[axis]*sum[axis]/count;
+	cpFloat candidate = sumSq[other] - sum[other]*sum[other]/count;
+	
+	if(candidate > AXIS_SWITCH_RATIO*current){
+		sweep->axis = other;
+		
+		cpFloat *mins = sweep->mins, *maxs = sweep->maxs;
+		sweep->mins = sweep->crossMins;
+		sweep->maxs = sweep->crossMaxs;
+		sweep->crossMins = mins;
+		sweep->crossMaxs = maxs;
+	}
 }
 
 static void
 cpSweep1DReindexQuery(cpSweep1D *sweep, cpSpatialIndexQueryFunc func, void *data)
 {
-	TableCell *table = sweep->table;
 	int count = sweep->num;
 	
 	// Update bounds and sort
-	for(int i=0; i<count; i++) table[i] = MakeTableCell(sweep, table[i].obj);
-	qsort(table, count, sizeof(TableCell), (int (*)(const void *, const void *))TableSort); // TODO: use insertion sort instead
+	UpdateBounds(sweep);
+	if(!InsertionSort(sweep, INSERTION_SORT_BUDGET*count)){
+		RadixSort(sweep);
+		InsertionSort(sweep, INT_MAX);
+	}
+	
+	void **objs = sweep->objs;
+	cpFloat *mins = sweep->mins, *maxs = sweep->maxs;
+	cpFloat *crossMins = sweep->crossMins, *crossMaxs = sweep->crossMaxs;
 	
 	for(int i=0; i<count; i++){
-		TableCell cell = table[i];
-		cpFloat max = cell.bounds.max;
+		void *obj = objs[i];
+		cpFloat max = maxs[i], crossMin = crossMins[i], crossMax = crossMaxs[i];
+		int j = i + 1;
+
+#if SWEEP_WIDTH > 1
+		SweepLanes vmax = sweep_set1(max), vcrossMin = sweep_set1(crossMin), vcrossMax = sweep_set1(crossMax);
+		
+		for(; j + SWEEP_WIDTH <= count; j += SWEEP_WIDTH){
+			// The table is sorted, so the cells that overlap along the sweep axis are always the first lanes.
+			SweepLanes sweeping = sweep_le(sweep_load(mins + j), vmax);
+			SweepLanes crossing = sweep_and(sweep_le(sweep_load(crossMins + j), vcrossMax), sweep_le(vcrossMin, sweep_load(crossMaxs + j)));
+			
+			int hits = sweep_bits(sweep_and(sweeping, crossing));
+			for(int lane=0; hits; lane++, hits >>= 1){
+				if(hits & 1) func(obj, objs[j + lane], 0, data);
+			}
+			
+			if(sweep_bits(sweeping) != (1 << SWEEP_WIDTH) - 1) goto next;
+		}
+#endif
 		
-		for(int j=i+1; table[j].bounds.min < max && j<count; j++){
-			func(cell.obj, table[j].obj, 0, data);
+		for(; j<count && mins[j] <= max; j++){
+			if(BoundsOverlap(crossMin, crossMax, crossMins[j], crossMaxs[j])) func(obj, objs[j], 0, data);
 		}
+		
+		next:;
 	}
 	
 	// Reindex query is also responsible for colliding against the static index.
@@ -232,6 +523,30 @@ cpSweep1DReindexQuery(cpSweep1D *sweep, cpSpatialIndexQueryFunc func, void *data
 	cpSpatialIndexCollideStatic((cpSpatialIndex *)sweep, sweep->spatialIndex.staticIndex, func, data);
 }
 
+//MARK: Memory Trimming
+
+static size_t
+cpSweep1DTrim(cpSweep1D *sweep, size_t keepBytes)
+{
+	size_t freed = 0;
+	
+	size_t scratchBytes = sweep->scratchMax*(2*sizeof(unsigned int) + 2*sizeof(int) + sizeof(cpFloat));
+	if(scratchBytes > keepBytes){
+		FreeScratch(sweep);
+		freed += scratchBytes;
+	}
+	
+	size_t cellBytes = sizeof(void *) + 4*sizeof(cpFloat);
+	size_t size = sweep->num + keepBytes/cellBytes;
+	if(size < 32) size = 32;
+	if(size >= (size_t)sweep->max) return freed;
+	
+	freed += (sweep->max - size)*cellBytes;
+	ResizeTable(sweep, (int)size);
+	
+	return freed;
+}
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpSweep1DDestroy,
 	
@@ -248,7 +563,8 @@ static cpSpatialIndexClass klass = {
 	
 	(cpSpatialIndexQueryImpl)cpSweep1DQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpSweep1DSegmentQuery,
+	
+	(cpSpatialIndexTrimImpl)cpSweep1DTrim,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
-
@@ -0,0 +1,230 @@
+// Checks that cpHastySpaceStep() matches cpSpaceStep().
+// The default solver run on a single thread does exactly the same work as cpSpaceStep(), so the results must be identical.
+// The colored and island solvers solve in a different order, but must give identical results for any thread count,
+// with or without the SIMD contact solver.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk/chipmunk.h"
+#include "chipmunk/cpHastySpace.h"
+
+#define BODY_COUNT 240
+// The kinematic body is in the space's body list too.
+#define STATE_COUNT (BODY_COUNT + 1)
+#define STEPS 120
+
+struct BodyState {
+	cpVect p, v;
+	cpFloat a, w;
+};
+
+//MARK: Scene
+
+// Results must be identical from run to run, so avoid rand().
+static uint32_t Seed;
+
+static cpFloat
+RandUnit(void)
+{
+	// xorshift32
+	uint32_t x = Seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Seed = x;
+
+	return (cpFloat)(x >> 8)/(cpFloat)(1 << 24);
+}
+
+// A pile of boxes, circles and polygons in a bin, with pivot joints and motors to static and kinematic bodies.
+static void
+BuildScene(cpSpace *space)
+{
+	Seed = 0x12345678;
+
+	cpSpaceSetGravity(space, cpv(0.0f, -100.0f));
+	cpSpaceSetIterations(space, 10);
+
+	cpBody *staticBody = cpSpaceGetStaticBody(space);
+	cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-20.0f, 0.0f), cpv(20.0f, 0.0f), 0.0f));
+	cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-20.0f, 0.0f), cpv(-20.0f, 100.0f), 0.0f));
+	cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(20.0f, 0.0f), cpv(20.0f, 100.0f), 0.0f));
+
+	cpBody *kinematic = cpSpaceAddBody(space, cpBodyNewKinematic());
+	cpBodySetAngularVelocity(kinematic, 1.0f);
+
+	cpVect triangle[] = {{-0.5f, -0.4f}, {0.5f, -0.4f}, {0.0f, 0.5f}};
+
+	for(int i=0; i<BODY_COUNT; i++){
+		cpVect pos = cpv(-18.0f + (i%30)*1.2f + 0.1f*RandUnit(), 0.6f + (i/30)*1.2f);
+		cpBody *body;
+		cpShape *shape;
+
+		switch(i%3){
+			case 0:
+				body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForBox(1.0f, 1.0f, 1.0f)));
+				shape = cpSpaceAddShape(space, cpBoxShapeNew(body, 1.0f, 1.0f, 0.01f));
+				break;
+			case 1:
+				body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForCircle(1.0f, 0.0f, 0.5f, cpvzero)));
+				shape = cpSpaceAddShape(space, cpCircleShapeNew(body, 0.5f, cpvzero));
+				break;
+			default:
+				body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForPoly(1.0f, 3, triangle, cpvzero, 0.0f)));
+				shape = cpSpaceAddShape(space, cpPolyShapeNew(body, 3, triangle, cpTransformIdentity, 0.0f));
+				break;
+		}
+
+		cpBodySetPosition(body, pos);
+		cpShapeSetFriction(shape, 0.7f);
+
+		if(i%40 == 0) cpSpaceAddConstraint(space, cpPivotJointNew(staticBody, body, pos));
+		if(i%40 == 20) cpSpaceAddConstraint(space, cpSimpleMotorNew(kinematic, body, 2.0f));
+	}
+}
+
+//MARK: Space Cleanup
+
+static void
+PostShapeFree(cpSpace *space, cpShape *shape, void *unused)
+{
+	cpSpaceRemoveShape(space, shape);
+	cpShapeFree(shape);
+}
+
+static void
+PostConstraintFree(cpSpace *space, cpConstraint *constraint, void *unused)
+{
+	cpSpaceRemoveConstraint(space, constraint);
+	cpConstraintFree(constraint);
+}
+
+static void
+PostBodyFree(cpSpace *space, cpBody *body, void *unused)
+{
+	cpSpaceRemoveBody(space, body);
+	cpBodyFree(body);
+}
+
+static void
+ShapeFreeWrap(cpShape *shape, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostShapeFree, shape, NULL);
+}
+
+static void
+ConstraintFreeWrap(cpConstraint *constraint, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostConstraintFree, constraint, NULL);
+}
+
+static void
+BodyFreeWrap(cpBody *body, cpSpace *space)
+{
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)PostBodyFree, body, NULL);
+}
+
+static void
+FreeSpaceChildren(cpSpace *space)
+{
+	// Must remove these BEFORE freeing the body or you will access dangling pointers.
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)ShapeFreeWrap, space);
+	cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)ConstraintFreeWrap, space);
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)BodyFreeWrap, space);
+}
+
+//MARK: Test
+
+static void
+SaveBody(cpBody *body, struct BodyState **state)
+{
+	struct BodyState *s = (*state)++;
+	s->p = cpBodyGetPosition(body);
+	s->v = cpBodyGetVelocity(body);
+	s->a = cpBodyGetAngle(body);
+	s->w = cpBodyGetAngularVelocity(body);
+}
+
+static void
+SaveState(cpSpace *space, struct BodyState *state)
+{
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)SaveBody, &state);
+}
+
+static void
+RunSpace(struct BodyState *state)
+{
+	cpSpace *space = cpSpaceNew();
+	BuildScene(space);
+	for(int i=0; i<STEPS; i++) cpSpaceStep(space, 1.0f/60.0f);
+
+	SaveState(space, state);
+	FreeSpaceChildren(space);
+	cpSpaceFree(space);
+}
+
+static void
+RunHastySpace(struct BodyState *state, cpHastySolverMode mode, cpBool simd, unsigned long threads)
+{
+	cpSpace *space = cpHastySpaceNew();
+	cpHastySpaceSetThreads(space, threads);
+	cpHastySpaceSetSolverMode(space, mode);
+	cpHastySpaceSetSIMDContacts(space, simd);
+
+	BuildScene(space);
+	for(int i=0; i<STEPS; i++) cpHastySpaceStep(space, 1.0f/60.0f);
+
+	SaveState(space, state);
+	FreeSpaceChildren(space);
+	cpHastySpaceFree(space);
+}
+
+static int
+Compare(const char *name, const struct BodyState *expected, const struct BodyState *state)
+{
+	for(int i=0; i<STATE_COUNT; i++){
+		const struct BodyState *a = expected + i, *b = state + i;
+		if(a->p.x != b->p.x || a->p.y != b->p.y || a->v.x != b->v.x || a->v.y != b->v.y || a->a != b->a || a->w != b->w){
+			printf("%-40s FAILED\n", name);
+			fprintf(stderr, "body %d: position (%.17g, %.17g) expected (%.17g, %.17g)\n", i, b->p.x, b->p.y, a->p.x, a->p.y);
+			return 1;
+		}
+	}
+
+	printf("%-40s ok\n", name);
+	return 0;
+}
+
+int
+main(void)
+{
+	static struct BodyState expected[STATE_COUNT], state[STATE_COUNT];
+	int failures = 0;
+
+	RunSpace(expected);
+	RunHastySpace(state, CP_HASTY_SOLVER_DEFAULT, cpFalse, 1);
+	failures += Compare("default solver, 1 thread vs cpSpaceStep", expected, state);
+
+	struct {const char *name; cpHastySolverMode mode; cpBool simd;} solvers[] = {
+		{"colored solver", CP_HASTY_SOLVER_COLORED, cpFalse},
+		{"colored solver, SIMD", CP_HASTY_SOLVER_COLORED, cpTrue},
+		{"island solver", CP_HASTY_SOLVER_ISLANDS, cpFalse},
+		{"island solver, SIMD", CP_HASTY_SOLVER_ISLANDS, cpTrue},
+	};
+
+	for(int i=0; i<(int)(sizeof(solvers)/sizeof(*solvers)); i++){
+		RunHastySpace(expected, solvers[i].mode, solvers[i].simd, 1);
+
+		for(unsigned long threads=2; threads<=4; threads++){
+			char name[64];
+			snprintf(name, sizeof(name), "%s, %lu threads vs 1", solvers[i].name, threads);
+
+			RunHastySpace(state, solvers[i].mode, solvers[i].simd, threads);
+			failures += Compare(name, expected, state);
+		}
+	}
+
+	return (failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,351 @@
+// Checks every spatial index against a brute force O(n^2) search over the same bounding boxes.
+// Indexes may report extra pairs and objects (ex: fattened tree leaves), but must never miss
+// one that overlaps or report the same one twice.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk/chipmunk.h"
+
+#define DYNAMIC_COUNT 400
+#define STATIC_COUNT 100
+#define OBJECT_COUNT (DYNAMIC_COUNT + STATIC_COUNT)
+
+#define FRAMES 6
+#define QUERIES 50
+
+struct TestObject {
+	cpBB bb;
+	int index;
+	cpBool removed;
+};
+
+static struct TestObject Objects[OBJECT_COUNT];
+
+// How many times each pair, or each object for queries, was reported.
+static unsigned char Reported[OBJECT_COUNT*OBJECT_COUNT];
+
+static int Failures = 0;
+
+#define CHECK(__cond__, ...) if(!(__cond__)){ \
+	fprintf(stderr, "FAIL %s: ", IndexName); \
+	fprintf(stderr, __VA_ARGS__); \
+	fprintf(stderr, "\n"); \
+	Failures++; \
+}
+
+static const char *IndexName;
+
+//MARK: Random Boxes
+
+// Results must be identical from run to run, so avoid rand().
+static uint32_t Seed;
+
+static cpFloat
+RandUnit(void)
+{
+	// xorshift32
+	uint32_t x = Seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Seed = x;
+
+	return (cpFloat)(x >> 8)/(cpFloat)(1 << 24);
+}
+
+static cpFloat
+RandRange(cpFloat min, cpFloat max)
+{
+	return min + (max - min)*RandUnit();
+}
+
+// Mostly small boxes, with a few points and a few boxes much larger than the rest.
+static cpBB
+RandomBB(void)
+{
+	cpVect center = cpv(RandRange(-50.0f, 50.0f), RandRange(-50.0f, 50.0f));
+	cpFloat kind = RandUnit();
+
+	cpFloat hw, hh;
+	if(kind < 0.05f){
+		hw = hh = 0.0f;
+	} else if(kind < 0.1f){
+		hw = RandRange(5.0f, 20.0f);
+		hh = RandRange(5.0f, 20.0f);
+	} else {
+		hw = RandRange(0.1f, 2.0f);
+		hh = RandRange(0.1f, 2.0f);
+	}
+
+	return cpBBNewForExtents(center, hw, hh);
+}
+
+// Move a box a little, or jump it somewhere else entirely.
+static cpBB
+MoveBB(cpBB bb)
+{
+	if(RandUnit() < 0.1f) return RandomBB();
+
+	cpVect delta = cpv(RandRange(-1.0f, 1.0f), RandRange(-1.0f, 1.0f));
+	return cpBBNew(bb.l + delta.x, bb.b + delta.y, bb.r + delta.x, bb.t + delta.y);
+}
+
+static cpBB
+TestObjectBB(struct TestObject *obj)
+{
+	return obj->bb;
+}
+
+//MARK: Indexes
+
+struct IndexType {
+	const char *name;
+	cpSpatialIndex *(*New)(cpSpatialIndex *staticIndex);
+};
+
+static cpSpatialIndex *
+NewBBTree(cpSpatialIndex *staticIndex)
+{
+	return cpBBTreeNew((cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static cpSpatialIndex *
+NewRefitBBTree(cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndex *index = cpBBTreeNew((cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+	cpBBTreeSetRefitThreshold(index, 1.5f);
+	return index;
+}
+
+static cpSpatialIndex *
+NewFlatBBTree(cpSpatialIndex *staticIndex)
+{
+	return cpFlatBBTreeNew((cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static cpSpatialIndex *
+NewLBVH(cpSpatialIndex *staticIndex)
+{
+	return cpLBVHNew((cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static cpSpatialIndex *
+NewSpaceHash(cpSpatialIndex *staticIndex)
+{
+	return cpSpaceHashNew(2.0f, 1000, (cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static cpSpatialIndex *
+NewAutoSpaceHash(cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndex *index = cpSpaceHashNew(2.0f, 1000, (cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+	cpSpaceHashSetAutoResize((cpSpaceHash *)index, cpTrue);
+	return index;
+}
+
+static cpSpatialIndex *
+NewSpaceGrid(cpSpatialIndex *staticIndex)
+{
+	return cpSpaceGridNew(2.0f, 1000, (cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static cpSpatialIndex *
+NewSweep1D(cpSpatialIndex *staticIndex)
+{
+	return cpSweep1DNew((cpSpatialIndexBBFunc)TestObjectBB, staticIndex);
+}
+
+static const struct IndexType IndexTypes[] = {
+	{"cpBBTree", NewBBTree},
+	{"cpBBTree (refit)", NewRefitBBTree},
+	{"cpFlatBBTree", NewFlatBBTree},
+	{"cpLBVH", NewLBVH},
+	{"cpSpaceHash", NewSpaceHash},
+	{"cpSpaceHash (auto resize)", NewAutoSpaceHash},
+	{"cpSpaceGrid", NewSpaceGrid},
+	{"cpSweep1D", NewSweep1D},
+};
+
+//MARK: Pairs
+
+static cpCollisionID
+PairFunc(struct TestObject *a, struct TestObject *b, cpCollisionID id, void *data)
+{
+	CHECK(a != b, "object %d paired with itself", a->index);
+	CHECK(!a->removed && !b->removed, "removed object reported in pair %d %d", a->index, b->index);
+
+	int i = (a->index < b->index ? a->index : b->index);
+	int j = (a->index < b->index ? b->index : a->index);
+	if(Reported[i*OBJECT_COUNT + j] < 255) Reported[i*OBJECT_COUNT + j]++;
+
+	return id;
+}
+
+static void
+CheckPairs(cpSpatialIndex *index, int frame)
+{
+	memset(Reported, 0, sizeof(Reported));
+	cpSpatialIndexReindexQuery(index, (cpSpatialIndexQueryFunc)PairFunc, NULL);
+
+	for(int i=0; i<DYNAMIC_COUNT; i++){
+		for(int j=i + 1; j<OBJECT_COUNT; j++){
+			struct TestObject *a = Objects + i, *b = Objects + j;
+			int count = Reported[i*OBJECT_COUNT + j];
+
+			CHECK(count <= 1, "frame %d: pair %d %d reported %d times", frame, i, j, count);
+			if(!a->removed && !b->removed && cpBBIntersects(a->bb, b->bb)){
+				CHECK(count == 1, "frame %d: overlapping pair %d %d not reported", frame, i, j);
+			}
+		}
+	}
+
+	for(int i=DYNAMIC_COUNT; i<OBJECT_COUNT; i++){
+		for(int j=i + 1; j<OBJECT_COUNT; j++){
+			CHECK(Reported[i*OBJECT_COUNT + j] == 0, "frame %d: static pair %d %d reported", frame, i, j);
+		}
+	}
+}
+
+//MARK: Queries
+
+static cpCollisionID
+QueryFunc(void *obj, struct TestObject *leaf, cpCollisionID id, void *data)
+{
+	CHECK(!leaf->removed, "removed object %d reported by query", leaf->index);
+	if(Reported[leaf->index] < 255) Reported[leaf->index]++;
+
+	return id;
+}
+
+static cpFloat
+SegmentQueryFunc(void *obj, struct TestObject *leaf, void *data)
+{
+	CHECK(!leaf->removed, "removed object %d reported by segment query", leaf->index);
+	if(Reported[leaf->index] < 255) Reported[leaf->index]++;
+
+	return 1.0f;
+}
+
+static void
+CheckQueryResults(int begin, int end, const char *kind, int query)
+{
+	for(int i=begin; i<end; i++){
+		CHECK(Reported[i] <= 1, "%s %d: object %d reported %d times", kind, query, i, Reported[i]);
+	}
+}
+
+static void
+CheckQueries(cpSpatialIndex *index, int begin, int end)
+{
+	for(int query=0; query<QUERIES; query++){
+		cpBB bb = RandomBB();
+
+		memset(Reported, 0, OBJECT_COUNT);
+		cpSpatialIndexQuery(index, NULL, bb, (cpSpatialIndexQueryFunc)QueryFunc, NULL);
+		CheckQueryResults(begin, end, "bb query", query);
+
+		for(int i=begin; i<end; i++){
+			if(!Objects[i].removed && cpBBIntersects(bb, Objects[i].bb)){
+				CHECK(Reported[i] == 1, "bb query %d: overlapping object %d not reported", query, i);
+			}
+		}
+
+		cpVect a = cpv(RandRange(-60.0f, 60.0f), RandRange(-60.0f, 60.0f));
+		cpVect b = cpv(RandRange(-60.0f, 60.0f), RandRange(-60.0f, 60.0f));
+
+		memset(Reported, 0, OBJECT_COUNT);
+		cpSpatialIndexSegmentQuery(index, NULL, a, b, 1.0f, (cpSpatialIndexSegmentQueryFunc)SegmentQueryFunc, NULL);
+		CheckQueryResults(begin, end, "segment query", query);
+
+		for(int i=begin; i<end; i++){
+			if(!Objects[i].removed && cpBBIntersectsSegment(Objects[i].bb, a, b)){
+				CHECK(Reported[i] == 1, "segment query %d: object %d not reported", query, i);
+			}
+		}
+	}
+}
+
+//MARK: Test
+
+static void
+CountFunc(struct TestObject *obj, int *count)
+{
+	(*count)++;
+}
+
+static void
+CheckContents(cpSpatialIndex *index, int begin, int end)
+{
+	int expected = 0;
+	for(int i=begin; i<end; i++){
+		struct TestObject *obj = Objects + i;
+		CHECK(cpSpatialIndexContains(index, obj, obj->index) == !obj->removed, "contains is wrong for object %d", i);
+		if(!obj->removed) expected++;
+	}
+
+	int count = 0;
+	cpSpatialIndexEach(index, (cpSpatialIndexIteratorFunc)CountFunc, &count);
+	CHECK(count == expected, "iterated %d objects, expected %d", count, expected);
+	CHECK(cpSpatialIndexCount(index) == expected, "count is %d, expected %d", cpSpatialIndexCount(index), expected);
+}
+
+static void
+TestIndex(const struct IndexType *type)
+{
+	IndexName = type->name;
+	Seed = 0x12345678;
+
+	for(int i=0; i<OBJECT_COUNT; i++){
+		Objects[i].bb = RandomBB();
+		Objects[i].index = i;
+		Objects[i].removed = cpFalse;
+	}
+
+	cpSpatialIndex *staticIndex = type->New(NULL);
+	cpSpatialIndex *index = type->New(staticIndex);
+
+	for(int i=DYNAMIC_COUNT; i<OBJECT_COUNT; i++) cpSpatialIndexInsert(staticIndex, Objects + i, i);
+	for(int i=0; i<DYNAMIC_COUNT; i++) cpSpatialIndexInsert(index, Objects + i, i);
+	cpSpatialIndexReindex(staticIndex);
+
+	for(int frame=0; frame<FRAMES; frame++){
+		CheckPairs(index, frame);
+		CheckQueries(index, 0, DYNAMIC_COUNT);
+
+		// Move about half of the dynamic objects.
+		for(int i=0; i<DYNAMIC_COUNT; i++){
+			if(RandUnit() < 0.5f) Objects[i].bb = MoveBB(Objects[i].bb);
+		}
+	}
+
+	CheckQueries(staticIndex, DYNAMIC_COUNT, OBJECT_COUNT);
+	CheckContents(staticIndex, DYNAMIC_COUNT, OBJECT_COUNT);
+
+	// Remove every third dynamic object, and make sure it's gone for good.
+	for(int i=0; i<DYNAMIC_COUNT; i += 3){
+		cpSpatialIndexRemove(index, Objects + i, i);
+		Objects[i].removed = cpTrue;
+	}
+
+	CheckContents(index, 0, DYNAMIC_COUNT);
+	CheckPairs(index, FRAMES);
+	CheckQueries(index, 0, DYNAMIC_COUNT);
+
+	cpSpatialIndexFree(index);
+	cpSpatialIndexFree(staticIndex);
+}
+
+int
+main(void)
+{
+	int count = (int)(sizeof(IndexTypes)/sizeof(*IndexTypes));
+	for(int i=0; i<count; i++){
+		int failures = Failures;
+		TestIndex(IndexTypes + i);
+		printf("%-28s %s\n", IndexTypes[i].name, Failures == failures ? "ok" : "FAILED");
+	}
+
+	return (Failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}